@@ -0,0 +1,69 @@
+#ifndef _ADAPTIVE_POLL_H_
+#define _ADAPTIVE_POLL_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//the packet rate is measured over windows of this length
+#define ADAPTIVE_POLL_WINDOW_NS (10*1000000ULL)
+
+//spinning stops after this many windows in a row below the exit rate
+#define ADAPTIVE_POLL_EXIT_WINDOWS (5)
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* Chooses between blocking in epoll_wait() and spinning on it
+*
+* The loop spins with a zero timeout once the packet rate of a window reaches
+* enterPps and goes back to blocking after ADAPTIVE_POLL_EXIT_WINDOWS windows
+* in a row below exitPps, which is lower so that a rate close to the
+* threshold does not flip the state on every window.
+**/
+struct adaptivePoll{
+	uint64_t enterPps;
+	uint64_t exitPps;
+
+	bool spinning;
+	uint64_t stateStart;
+	unsigned quietWindows;
+
+	uint64_t windowStart;
+	uint64_t windowPackets;
+
+	//time spent and number of periods in each state, indexed by spinning
+	uint64_t stateNs[2];
+	uint64_t periods[2];
+
+	uint64_t spins;
+	uint64_t emptySpins;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+void adaptivePoll_init(struct adaptivePoll* p, uint64_t enterPps, uint64_t now);
+void adaptivePoll_update(
+	struct adaptivePoll* p, int events, uint64_t packets, uint64_t now
+);
+void adaptivePoll_report(struct adaptivePoll* p, uint64_t now);
+/*******************************************************************************
+*                               INLINE FUNCTIONS                               *
+*******************************************************************************/
+/**
+* Returns the epoll_wait() timeout to use next
+*
+* Args:
+* p - the polling state
+* blockingTimeout - the timeout the loop uses while blocking
+**/
+static inline int adaptivePoll_timeout(
+	const struct adaptivePoll* p, int blockingTimeout
+){
+	return p->spinning ? 0 : blockingTimeout;
+}
+#endif //_ADAPTIVE_POLL_H_
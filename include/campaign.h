@@ -0,0 +1,112 @@
+#ifndef _CAMPAIGN_H_
+#define _CAMPAIGN_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "seqStats.h"
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* Counters of a session at the end of its warm-up
+*
+* Everything up to the mark is left out of the session's run.
+**/
+struct campaignMark{
+	bool set;
+	uint64_t ns;
+	uint64_t bytes;
+	uint64_t received;
+	uint32_t max;
+};
+
+/**
+* Result of a single session measured after its warm-up
+**/
+struct campaignRun{
+	uint32_t session;
+	bool tcp;
+	uint64_t bytes;
+	uint64_t ns;
+	double throughput; //kib/s
+	double loss; //percent, UDP only
+};
+
+/**
+* Results of every session of a campaign
+*
+* discarded counts sessions which ended before their warm-up was over. count
+* may be read from other threads with campaign_measured().
+**/
+struct campaign{
+	uint64_t warmupNs;
+	uint64_t warmupPackets;
+
+	struct campaignRun* runs;
+	size_t count;
+	size_t mem;
+
+	uint64_t discarded;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+struct campaign* campaign_create(unsigned warmupMs, unsigned warmupPackets);
+void campaign_addRun(
+	struct campaign* c, uint32_t session, bool tcp,
+	const struct campaignMark* m, uint64_t lastNs, uint64_t bytes,
+	const struct seqStats* seq
+);
+void campaign_report(const struct campaign* c);
+void campaign_destroy(struct campaign* c);
+/*******************************************************************************
+*                               INLINE FUNCTIONS                               *
+*******************************************************************************/
+/**
+* Returns the number of sessions measured so far
+*
+* Sessions which ended during their warm-up are not counted, so this is what
+* a campaign of a given number of sessions waits for.
+**/
+static inline size_t campaign_measured(const struct campaign* c){
+	return __atomic_load_n(&c->count,__ATOMIC_RELAXED);
+}
+/**
+* Marks the end of a session's warm-up once it is over
+*
+* Must be called before the counters are updated for the data just received
+* so that this data is part of the run.
+*
+* Args:
+* c - the campaign
+* m - mark of the session
+* firstNs - time the session started
+* packets - packets (or reads) received by the session so far
+* now - the current time in ns
+* bytes - bytes received by the session so far
+* seq - sequence numbers of the session, NULL for TCP
+**/
+static inline void campaign_mark(
+	const struct campaign* c, struct campaignMark* m, uint64_t firstNs,
+	uint64_t packets, uint64_t now, uint64_t bytes,
+	const struct seqStats* seq
+){
+	if(m->set || now - firstNs < c->warmupNs || packets < c->warmupPackets){
+		return;
+	}
+
+	m->set = true;
+	m->ns = now;
+	m->bytes = bytes;
+
+	if(seq){
+		m->received = seq->received;
+		m->max = seq->max;
+	}
+}
+#endif //_CAMPAIGN_H_
@@ -7,5 +7,6 @@
 void cleanExit_add_fd(int fd);
 void cleanExit_add_signal(int signum);
 void cleanExit_stop(void);
+int cleanExit_signalfd(void);
 
 #endif // _CLEAN_EXIT_H_
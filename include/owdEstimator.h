@@ -0,0 +1,88 @@
+#ifndef _OWD_ESTIMATOR_H_
+#define _OWD_ESTIMATOR_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//the lowest delay of each window of this length is a sample of the base delay
+#define OWD_WINDOW_NS (100*1000000ULL)
+
+//the clock offset and drift are fitted to the samples of this many windows
+#define OWD_WINDOWS (64)
+
+//least squares passes towards the lower envelope of the samples
+#define OWD_FIT_PASSES (3)
+
+//delays are counted in power of two buckets split into 8 linear sub-buckets,
+//enough to cover every 64 bit value
+#define OWD_SUB_BUCKETS (8)
+#define OWD_BUCKETS (OWD_SUB_BUCKETS + 61*OWD_SUB_BUCKETS)
+
+//packets carrying a transmit timestamp hold it as little endian ns right
+//after the sequence number
+#define OWD_TS_OFFSET (4)
+#define OWD_MIN_LEN (OWD_TS_OFFSET + 8)
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* Lowest delay seen during one window
+**/
+struct owdSample{
+	double t;
+	double delay;
+};
+
+/**
+* One-way delay of a session whose client clock is not synchronized
+*
+* The raw delay of a packet is its receive time minus its transmit time,
+* which includes the unknown offset between the clocks. The lowest raw delay
+* of every window approximates the base delay of the path plus that offset,
+* and a line fitted to the samples of the last OWD_WINDOWS windows follows
+* the offset as the clocks drift apart. What a packet takes longer than that
+* line is its queueing delay.
+*
+* Times are ns since the first packet and delays ns relative to the raw delay
+* of the first packet so that doubles keep full precision.
+**/
+struct owdEstimator{
+	bool started;
+	uint64_t firstRx;
+	int64_t firstRaw;
+
+	uint64_t windowStart;
+	struct owdSample windowMin;
+
+	struct owdSample samples[OWD_WINDOWS];
+	unsigned numSamples;
+	unsigned nextSample;
+
+	//base delay line, base(t) = offset + drift*t
+	double offset;
+	double drift;
+
+	uint64_t packets;
+	uint64_t belowBase;
+	uint64_t maxDelay;
+	uint64_t hist[OWD_BUCKETS];
+
+	//least squares sums of queueing delay over time in s
+	double sumT;
+	double sumD;
+	double sumTT;
+	double sumTD;
+	double lastT;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+void owd_init(struct owdEstimator* e);
+void owd_add(struct owdEstimator* e, uint64_t txNs, uint64_t rxNs);
+void owd_print(const struct owdEstimator* e);
+#endif //_OWD_ESTIMATOR_H_
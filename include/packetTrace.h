@@ -0,0 +1,153 @@
+#ifndef _PACKET_TRACE_H_
+#define _PACKET_TRACE_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+#define PACKET_TRACE_MAGIC "TSTRACE1"
+#define PACKET_TRACE_VERSION (1)
+#define PACKET_TRACE_HEADER_SIZE (64)
+
+//size of each mapped window of the trace file and the number of windows which
+//are kept mapped at once (the current window plus pre-faulted windows ahead)
+#define PACKET_TRACE_WINDOW_SIZE (4*1024*1024)
+#define PACKET_TRACE_RING_WINDOWS (4)
+
+//file space is preallocated in steps of this size
+#define PACKET_TRACE_PREALLOC_SIZE (64*1024*1024)
+
+#define TRACE_FLAG_TCP   (1<<0)
+#define TRACE_FLAG_STOP  (1<<1)
+#define TRACE_FLAG_TRUNC (1<<2)
+#define TRACE_FLAG_NOSEQ (1<<3)
+#define TRACE_FLAG_REPLY (1<<4)
+#define TRACE_FLAG_TX    (1<<5)
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* A single fixed size trace record
+*
+* For UDP each record describes one datagram. For TCP each record describes a
+* single read() from the stream; seqno is then the read count and aux is the
+* stream offset of the first byte in the chunk. Records with TRACE_FLAG_TX
+* describe packets sent by the server rather than received.
+**/
+struct traceRecord{
+	uint64_t timestamp; //CLOCK_MONOTONIC receive time in ns
+	uint32_t seqno;
+	uint32_t len;
+	uint32_t session;
+	uint32_t flags;
+	uint64_t aux;
+};
+
+/**
+* Header found at offset zero of every trace file
+*
+* recordCount and clean are only written when the trace is closed. Records
+* which were never written are zero filled so readers can still recover the
+* records of a trace which was not closed cleanly.
+**/
+struct traceHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint64_t recordCount;
+	uint64_t startRealtime;
+	uint64_t startMonotonic;
+	uint32_t clean;
+	uint8_t reserved[20];
+};
+
+/**
+* A trace being recorded
+*
+* Window n of the file lives in ring slot n % PACKET_TRACE_RING_WINDOWS. The
+* writer fills window retired while a helper thread unmaps the windows it has
+* finished and maps and pre-faults the ones after it, up to mapped. retired,
+* mapped, failed and stop are protected by lock. The helper thread owns
+* fileSize and the ring slots of windows from mapped on.
+**/
+struct packetTrace{
+	int fd;
+
+	struct traceRecord* next;
+	struct traceRecord* end;
+
+	uint8_t* ring[PACKET_TRACE_RING_WINDOWS];
+	uint64_t retired;
+	uint64_t mapped;
+	bool failed;
+	bool stop;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	off_t fileSize;
+
+	uint64_t count;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+struct packetTrace* packetTrace_open(const char* path);
+void packetTrace_close(struct packetTrace* trace);
+int packetTrace_advance(struct packetTrace* trace);
+int packetTrace_readHeader(int fd, struct traceHeader* hdr, uint64_t* count);
+/*******************************************************************************
+*                               INLINE FUNCTIONS                               *
+*******************************************************************************/
+/**
+* Returns the current CLOCK_MONOTONIC time in ns
+**/
+static inline uint64_t packetTrace_now(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+
+	return ((uint64_t)ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+/**
+* Appends a record to the trace
+*
+* Only touches already mapped memory unless the current window is full. Does
+* nothing if trace is NULL so callers need not check whether tracing is on.
+**/
+static inline void packetTrace_record(
+	struct packetTrace* trace, uint64_t timestamp, uint32_t seqno,
+	uint32_t len, uint32_t session, uint32_t flags, uint64_t aux
+){
+	if(!trace){
+		return;
+	}
+
+	if(trace->next == trace->end){
+		if(packetTrace_advance(trace)){
+			return;
+		}
+	}
+
+	struct traceRecord* rec = trace->next;
+
+	rec->timestamp = timestamp;
+	rec->seqno = seqno;
+	rec->len = len;
+	rec->session = session;
+	rec->flags = flags;
+	rec->aux = aux;
+
+	trace->next += 1;
+	trace->count += 1;
+}
+#endif //_PACKET_TRACE_H_
@@ -0,0 +1,31 @@
+#ifndef _PERIODIC_TASK_H_
+#define _PERIODIC_TASK_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+struct periodicTask{
+	void (*fn)(void* arg);
+	void* arg;
+	uint64_t intervalNs;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+int periodicTask_start(
+	struct periodicTask* task, unsigned intervalMs,
+	void (*fn)(void* arg), void* arg
+);
+void periodicTask_stop(struct periodicTask* task);
+#endif //_PERIODIC_TASK_H_
@@ -0,0 +1,91 @@
+#ifndef _PKT_SHAPE_H_
+#define _PKT_SHAPE_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+#define SHAPE_DEFAULT_GAP_US (1000)
+
+//datagram sizes are counted in buckets of SHAPE_SIZE_STEP bytes, the last
+//bucket holds everything from SHAPE_SIZE_STEP*(SHAPE_SIZE_BUCKETS-1) bytes
+#define SHAPE_SIZE_STEP (16)
+#define SHAPE_SIZE_BUCKETS (129)
+
+//burst lengths and idle gaps use power of two buckets
+#define SHAPE_LOG_BUCKETS (64)
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* Size and timing structure of the packets of one UDP session
+*
+* Packets which arrive at most gapNs after the previous one belong to the
+* same burst. Every longer gap ends a burst and is counted as an idle gap.
+**/
+struct pktShape{
+	uint64_t gapNs;
+
+	uint64_t lastNs;
+	uint64_t burstLen;
+
+	uint64_t truncated;
+	uint64_t sizeHist[SHAPE_SIZE_BUCKETS];
+	uint64_t burstHist[SHAPE_LOG_BUCKETS];
+	uint64_t idleHist[SHAPE_LOG_BUCKETS];
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+void pktShape_init(struct pktShape* sh, unsigned gapUs);
+void pktShape_print(struct pktShape* sh, uint32_t truncSize);
+/*******************************************************************************
+*                               INLINE FUNCTIONS                               *
+*******************************************************************************/
+/**
+* Returns the power of two bucket of v
+**/
+static inline int pktShape_log2(uint64_t v){
+	return v ? 63 - __builtin_clzll(v) : 0;
+}
+/**
+* Accounts for one packet
+*
+* Args:
+* sh - the session's histograms, may be NULL
+* len - real length of the packet
+* truncated - the packet did not fit into the receive buffer
+* now - time the packet was received
+**/
+static inline void pktShape_add(
+	struct pktShape* sh, uint64_t len, bool truncated, uint64_t now
+){
+	if(!sh){
+		return;
+	}
+
+	uint64_t bucket = len/SHAPE_SIZE_STEP;
+
+	sh->sizeHist[(bucket < SHAPE_SIZE_BUCKETS) ?
+		bucket : SHAPE_SIZE_BUCKETS-1] += 1;
+	sh->truncated += truncated;
+
+	if(!sh->burstLen){
+		sh->burstLen = 1;
+	}
+	else if(now - sh->lastNs <= sh->gapNs){
+		sh->burstLen += 1;
+	}
+	else{
+		sh->burstHist[pktShape_log2(sh->burstLen)] += 1;
+		sh->idleHist[pktShape_log2(now - sh->lastNs)] += 1;
+		sh->burstLen = 1;
+	}
+
+	sh->lastNs = now;
+}
+#endif //_PKT_SHAPE_H_
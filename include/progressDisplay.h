@@ -0,0 +1,117 @@
+#ifndef _PROGRESS_DISPLAY_H_
+#define _PROGRESS_DISPLAY_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <netinet/in.h>
+
+#include "periodicTask.h"
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+#define DEFAULT_REFRESH_MS (1000)
+
+//sessions beyond this many are only counted, not shown
+#define PROGRESS_MAX_ROWS (32)
+/*******************************************************************************
+*                                     ENUMS                                    *
+*******************************************************************************/
+enum progressMode {PROGRESS_NONE, PROGRESS_LINE, PROGRESS_TABLE};
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* Counters of a single session at the time of a snapshot
+*
+* expected is zero for sessions without sequence numbers and rtt is zero when
+* it is not known.
+**/
+struct progressRow{
+	uint32_t id;
+	in_port_t port;
+	bool tcp;
+	struct in6_addr addr;
+
+	uint64_t bytes;
+	uint64_t expected;
+	uint64_t lost;
+	uint32_t rtt; //us
+};
+
+/**
+* Copy of the server counters taken by the receive loop
+*
+* bytes and packets include sessions which have already ended.
+**/
+struct progressSnapshot{
+	uint64_t time;
+	uint64_t bytes;
+	uint64_t packets;
+	uint32_t sessions;
+
+	uint32_t numRows;
+	struct progressRow rows[PROGRESS_MAX_ROWS];
+};
+
+/**
+* Progress display running on its own thread
+*
+* The receive loop fills back and swaps it with latest under snapLock. The
+* display thread copies latest into front, renders it using prev for rates
+* and writes the result to out, the stdout the display was started with.
+*
+* Reports are printed between progressDisplay_pause() and
+* progressDisplay_resume(), one thread at a time under printLock. Meanwhile
+* stdout is pointed at a memory stream so printing never waits for the
+* terminal. The text is queued in pending under snapLock and written out by
+* the display thread, which is the only one that touches the terminal.
+**/
+struct progressDisplay{
+	enum progressMode mode;
+	bool tty;
+
+	struct periodicTask task;
+
+	pthread_mutex_t snapLock;
+	bool fresh;
+	struct progressSnapshot* back;
+	struct progressSnapshot* latest;
+
+	struct progressSnapshot* front;
+	struct progressSnapshot* prev;
+
+	char* pending;
+	size_t pendingLen;
+
+	FILE* out;
+	unsigned drawnLines;
+	char* text;
+	size_t textSize;
+
+	pthread_mutex_t printLock;
+	FILE* capture;
+	char* captureBuf;
+	size_t captureLen;
+
+	struct progressSnapshot buffers[4];
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+struct progressDisplay* progressDisplay_start(
+	enum progressMode mode, unsigned refreshMs
+);
+void progressDisplay_stop(struct progressDisplay* display);
+struct progressSnapshot* progressDisplay_begin(
+	struct progressDisplay* display
+);
+void progressDisplay_publish(struct progressDisplay* display);
+void progressDisplay_pause(struct progressDisplay* display);
+void progressDisplay_resume(struct progressDisplay* display);
+#endif //_PROGRESS_DISPLAY_H_
@@ -0,0 +1,67 @@
+#ifndef _SELF_PROFILE_H_
+#define _SELF_PROFILE_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+/*******************************************************************************
+*                                     ENUMS                                    *
+*******************************************************************************/
+//PROF_TASK_CLOCK is CPU time in ns, PROF_SYSCALLS needs the raw_syscalls
+//tracepoint
+enum selfProfileCounter {
+	PROF_CYCLES, PROF_INSTRUCTIONS, PROF_CACHE_MISSES, PROF_TASK_CLOCK,
+	PROF_CONTEXT_SWITCHES, PROF_SYSCALLS, PROF_COUNTERS
+};
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* Counter values at one point in time
+*
+* Counters which could not be opened stay zero.
+**/
+struct selfProfileSample{
+	uint64_t time;
+	uint64_t values[PROF_COUNTERS];
+};
+
+/**
+* perf_event_open() counters of the thread which opened them
+*
+* A counter whose fd is -1 is not available. Without the syscall tracepoint
+* the syscalls made by the receive loop are counted by the loop itself through
+* selfProfile_syscall(), which only the opening thread may call. With userOnly
+* every counter leaves out the kernel and context switches are not counted.
+**/
+struct selfProfile{
+	int fds[PROF_COUNTERS];
+	bool userOnly;
+	uint64_t ownSyscalls;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+struct selfProfile* selfProfile_open(void);
+void selfProfile_read(
+	const struct selfProfile* p, struct selfProfileSample* sample
+);
+void selfProfile_print(
+	const struct selfProfile* p, const struct selfProfileSample* from,
+	const struct selfProfileSample* to, uint64_t packets, const char* unit
+);
+void selfProfile_close(struct selfProfile* p);
+/*******************************************************************************
+*                               INLINE FUNCTIONS                               *
+*******************************************************************************/
+/**
+* Counts one syscall of the receive loop, p may be NULL
+**/
+static inline void selfProfile_syscall(struct selfProfile* p){
+	if(p){
+		__atomic_store_n(&p->ownSyscalls,p->ownSyscalls+1,__ATOMIC_RELAXED);
+	}
+}
+#endif //_SELF_PROFILE_H_
@@ -0,0 +1,65 @@
+#ifndef _SEQ_STATS_H_
+#define _SEQ_STATS_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* Sequence number accounting for a stream of numbered packets
+*
+* late counts packets which arrived at or below the highest sequence number
+* already seen, i.e. reordered or duplicated packets.
+**/
+struct seqStats{
+	uint64_t received;
+	uint64_t late;
+	uint32_t first;
+	uint32_t max;
+};
+/*******************************************************************************
+*                               INLINE FUNCTIONS                               *
+*******************************************************************************/
+/**
+* Accounts for a packet with the given sequence number
+**/
+static inline void seqStats_update(struct seqStats* s, uint32_t seqno){
+	if(!s->received){
+		s->first = seqno;
+		s->max = seqno;
+	}
+	else if(seqno > s->max){
+		s->max = seqno;
+	}
+	else{
+		s->late += 1;
+
+		if(seqno < s->first){
+			s->first = seqno;
+		}
+	}
+
+	s->received += 1;
+}
+/**
+* Returns the number of packets the sender must have sent
+**/
+static inline uint64_t seqStats_expected(const struct seqStats* s){
+	if(!s->received){
+		return 0;
+	}
+
+	return ((uint64_t)s->max) - s->first + 1;
+}
+/**
+* Returns the number of packets which never arrived
+**/
+static inline uint64_t seqStats_lost(const struct seqStats* s){
+	uint64_t expected = seqStats_expected(s);
+
+	return (expected > s->received) ? expected - s->received : 0;
+}
+#endif //_SEQ_STATS_H_
@@ -0,0 +1,68 @@
+#ifndef _SERVER_PROBES_H_
+#define _SERVER_PROBES_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#ifdef USDT_PROBES
+//every probe has a semaphore which tracers increment while they are attached
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#endif
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+/**
+* USDT probes of the testServer provider
+*
+* Built with "make USDT=1" the probes are compiled in as single nops that
+* bpftrace, perf probe or systemtap can attach to, for example
+*   bpftrace -e 'usdt:./bin/testServer:testServer:udp_receive
+*     { @len = hist(arg2); }'
+* Without it they compile to nothing. Times are CLOCK_MONOTONIC ns as given
+* by packetTrace_now() and sessions are the ids printed by the server.
+*
+* udp_receive(session, seq, len, time) - one packet of a UDP stream, seq is
+*   0xFFFFFFFF for packets too short to hold a sequence number
+* tcp_receive(session, read, len, time) - one read() of a TCP stream, read
+*   counts the reads of the session
+* stop(session, seq, tcp, time) - end of a client's stream, a stop packet for
+*   UDP with its sequence number or the connection being closed for TCP
+* reply(session, seq, len, time) - a ping pong reply was sent
+* session_start(session, port, tcp, time)
+* session_end(session, bytes, packets, time) - packets counts the reads of
+*   TCP sessions
+* report(session, bytes, ns, kibps) - the results of a session were printed,
+*   ns is the time between its first and last packet
+* echo_receive(fd, len, time) - the echo server read a line, len is zero
+*   when the client closed the connection
+* echo_reply(fd, len, time) - the echo server wrote it back
+*
+* Probes whose arguments cost something to compute, such as a clock read,
+* should be wrapped in if(SERVER_PROBE_ENABLED(name)) so that the arguments
+* are only computed while a tracer is attached.
+**/
+#define SERVER_PROBES(X) \
+	X(udp_receive) X(tcp_receive) X(stop) X(reply) X(session_start) \
+	X(session_end) X(report) X(echo_receive) X(echo_reply)
+
+#ifdef USDT_PROBES
+#define SERVER_PROBE3(name,a,b,c) DTRACE_PROBE3(testServer,name,a,b,c)
+#define SERVER_PROBE4(name,a,b,c,d) DTRACE_PROBE4(testServer,name,a,b,c,d)
+#define SERVER_PROBE_ENABLED(name) \
+	__builtin_expect(testServer_##name##_semaphore,0)
+#else
+#define SERVER_PROBE3(name,a,b,c) do{}while(0)
+#define SERVER_PROBE4(name,a,b,c,d) do{}while(0)
+#define SERVER_PROBE_ENABLED(name) 0
+#endif
+/*******************************************************************************
+*                                     DATA                                     *
+*******************************************************************************/
+#ifdef USDT_PROBES
+#define SERVER_PROBE_SEMAPHORE(name) \
+	extern volatile unsigned short testServer_##name##_semaphore;
+SERVER_PROBES(SERVER_PROBE_SEMAPHORE)
+#undef SERVER_PROBE_SEMAPHORE
+#endif
+#endif //_SERVER_PROBES_H_
@@ -4,8 +4,26 @@
 /*******************************************************************************
 *                                   INCLUDES                                   *
 *******************************************************************************/
+#include <stddef.h>
+
 #include <netinet/in.h>
 #include <sys/socket.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//maximum number of ports which a port list may expand to
+#define MAX_PORT_LIST (4096)
+/*******************************************************************************
+*                                     ENUMS                                    *
+*******************************************************************************/
+enum portTransport {PORT_DEFAULT, PORT_TCP, PORT_UDP};
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+struct portSpec{
+	in_port_t port;
+	enum portTransport transport;
+};
 
 /*******************************************************************************
 *                              FUNCTION PROTOTYPES                             *
@@ -14,4 +32,6 @@ int readSockLine(int sockd, char* buffer, int bufSize);
 void stripInPlace(char* str, int len);
 char* getStrAddrIPv6(struct sockaddr_in6* clientInfo);
 int strToPort(in_port_t* port,const char* str);
+int strToPortList(struct portSpec** ports, int* count, const char* str);
+void fmtNs(char* buf, size_t len, double ns);
 #endif //_SERVER_STR_STUFF_H_
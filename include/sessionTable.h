@@ -0,0 +1,108 @@
+#ifndef _SESSION_TABLE_H_
+#define _SESSION_TABLE_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <netinet/in.h>
+
+#include "seqStats.h"
+#include "txStream.h"
+#include "campaign.h"
+#include "selfProfile.h"
+#include "pktShape.h"
+#include "owdEstimator.h"
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* State of a single UDP client
+*
+* Sessions live in a fixed arena and never move while active so pointers to
+* them stay valid until the session is removed.
+**/
+struct udpSession{
+	struct sockaddr_in6 addr;
+	uint32_t id;
+	bool active;
+
+	uint64_t firstNs;
+	uint64_t lastNs;
+
+	uint64_t bytes;
+	uint64_t packets;
+	struct seqStats seq;
+
+	uint32_t startDrops;
+
+	//downlink stream to the client, NULL unless the server is transmitting
+	struct txStream* tx;
+
+	//bidirectional sessions only: the client has finished its own stream,
+	//and the time of and longest pause between its stream's packets
+	bool rxDone;
+	uint64_t lastDataNs;
+	uint64_t maxGapNs;
+
+	struct campaignMark mark;
+
+	//self profile counters when the session started
+	struct selfProfileSample profStart;
+
+	//size and burst histograms in the table's arena, NULL unless they were
+	//asked for
+	struct pktShape* shape;
+
+	//one-way delay of packets carrying a transmit time in the table's arena,
+	//NULL unless it was asked for
+	struct owdEstimator* owd;
+};
+
+/**
+* Open addressing index entry, hash is zero for an empty entry
+**/
+struct sessionIndex{
+	uint32_t hash;
+	uint32_t session;
+};
+
+/**
+* Sessions, their index and the optional per session state
+*
+* shapes and owds hold the histograms and the delay estimator of the session
+* in the same slot, each NULL unless the table was created with them.
+**/
+struct sessionTable{
+	uint32_t mask;
+	struct sessionIndex* index;
+
+	uint32_t maxSessions;
+	struct udpSession* sessions;
+	struct pktShape* shapes;
+	struct owdEstimator* owds;
+
+	uint32_t* freeList;
+	uint32_t freeCount;
+
+	void* arena;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+struct sessionTable* sessionTable_create(
+	uint32_t maxSessions, bool shapes, bool owds
+);
+void sessionTable_destroy(struct sessionTable* table);
+struct udpSession* sessionTable_find(
+	struct sessionTable* table, const struct sockaddr_in6* addr
+);
+struct udpSession* sessionTable_insert(
+	struct sessionTable* table, const struct sockaddr_in6* addr, uint32_t id
+);
+void sessionTable_remove(
+	struct sessionTable* table, struct udpSession* session
+);
+#endif //_SESSION_TABLE_H_
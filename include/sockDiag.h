@@ -0,0 +1,44 @@
+#ifndef _SOCK_DIAG_H_
+#define _SOCK_DIAG_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+#include "periodicTask.h"
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//amount of traffic the receive buffer should hold when sized from a rate
+#define RCVBUF_HEADROOM_MS 500
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+struct sockDiagSampler{
+	int sockfd;
+	ino_t inode;
+
+	struct periodicTask task;
+
+	uint64_t samples;
+
+	bool memInfoOk;
+	uint32_t rcvbuf;
+	uint32_t peakRmem;
+	uint32_t memDrops;
+
+	bool procOk;
+	uint32_t peakRxQueue;
+	uint32_t procDrops;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+struct sockDiagSampler* sockDiag_start(int sockfd, unsigned intervalMs);
+void sockDiag_stop(struct sockDiagSampler* sampler);
+int sockDiag_sizeRcvbuf(int sockfd, unsigned kibps);
+#endif //_SOCK_DIAG_H_
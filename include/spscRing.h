@@ -0,0 +1,124 @@
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+#define SPSC_CACHE_LINE (64)
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* Lock-free ring of slot indices for one producer and one consumer thread
+*
+* The ring only hands out indices, callers keep the slot data in their own
+* array of size entries. head and tail count up forever and are only masked
+* to find the slot. Each side keeps a cached copy of the other side's index
+* so the shared cache lines are only touched when the ring looks full or
+* empty.
+*
+* The statistics are owned by the side which updates them and must only be
+* read by the other thread once both have stopped.
+**/
+struct spscRing{
+	//producer side
+	uint64_t head __attribute__((aligned(SPSC_CACHE_LINE)));
+	uint64_t cachedTail;
+	uint64_t fullCount;
+
+	//consumer side
+	uint64_t tail __attribute__((aligned(SPSC_CACHE_LINE)));
+	uint64_t cachedHead;
+	uint64_t popCount;
+	uint64_t occupancySum;
+	uint64_t maxOccupancy;
+
+	uint64_t size __attribute__((aligned(SPSC_CACHE_LINE)));
+	uint64_t mask;
+};
+/*******************************************************************************
+*                               INLINE FUNCTIONS                               *
+*******************************************************************************/
+/**
+* Initializes an empty ring
+*
+* Args:
+* ring - the ring, must be aligned to SPSC_CACHE_LINE
+* size - number of slots, must be a power of two
+**/
+static inline void spscRing_init(struct spscRing* ring, uint64_t size){
+	memset(ring,0,sizeof(*ring));
+
+	ring->size = size;
+	ring->mask = size - 1;
+}
+/**
+* Returns true if the producer can not push another slot
+**/
+static inline bool spscRing_full(struct spscRing* ring){
+	if(ring->head - ring->cachedTail < ring->size){
+		return false;
+	}
+
+	ring->cachedTail = __atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE);
+
+	return ring->head - ring->cachedTail >= ring->size;
+}
+/**
+* Returns the slot the producer fills next, the ring must not be full
+**/
+static inline uint64_t spscRing_slot(const struct spscRing* ring){
+	return ring->head & ring->mask;
+}
+/**
+* Hands the slot returned by spscRing_slot() to the consumer
+**/
+static inline void spscRing_push(struct spscRing* ring){
+	__atomic_store_n(&ring->head,ring->head+1,__ATOMIC_RELEASE);
+}
+/**
+* Finds the next slot for the consumer
+*
+* Also samples the ring occupancy for the statistics.
+*
+* Args:
+* ring - the ring
+* slot - set to the slot to consume if there is one
+*
+* Returns:
+* False if the ring is empty.
+**/
+static inline bool spscRing_peek(struct spscRing* ring, uint64_t* slot){
+	if(ring->tail == ring->cachedHead){
+		ring->cachedHead = __atomic_load_n(&ring->head,__ATOMIC_ACQUIRE);
+
+		if(ring->tail == ring->cachedHead){
+			return false;
+		}
+	}
+
+	uint64_t occupancy = ring->cachedHead - ring->tail;
+
+	ring->occupancySum += occupancy;
+	if(occupancy > ring->maxOccupancy){
+		ring->maxOccupancy = occupancy;
+	}
+
+	*slot = ring->tail & ring->mask;
+
+	return true;
+}
+/**
+* Gives the slot returned by spscRing_peek() back to the producer
+**/
+static inline void spscRing_pop(struct spscRing* ring){
+	ring->popCount += 1;
+	__atomic_store_n(&ring->tail,ring->tail+1,__ATOMIC_RELEASE);
+}
+#endif //_SPSC_RING_H_
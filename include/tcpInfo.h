@@ -0,0 +1,118 @@
+#ifndef _TCP_INFO_H_
+#define _TCP_INFO_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "periodicTask.h"
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+struct tcpInfoSample{
+	uint64_t time; //ns since sampling started
+	uint32_t rtt; //us
+	uint32_t rttvar; //us
+	uint32_t rcvRtt; //us
+	uint32_t totalRetrans;
+	uint32_t rcvSpace;
+	uint64_t deliveryRate; //bytes per second
+	uint64_t bytesReceived;
+};
+
+/**
+* csv file shared by the samplers of all connections
+*
+* Every row starts with the session it belongs to. Rows come from the thread
+* of each group and from the final sample of every connection, so they are
+* written under lock.
+**/
+struct tcpInfoCsv{
+	FILE* f;
+	pthread_mutex_t lock;
+};
+
+/**
+* TCP_INFO sampler of one connection
+*
+* Samples are not kept, each one is written to csv as it is taken and folded
+* into the running summary so memory use stays the same however long the
+* connection lasts. The rtt of the latest sample is published in rtt for the
+* progress display.
+**/
+struct tcpInfoSampler{
+	int sockfd;
+	uint32_t session;
+	bool summary;
+	uint32_t rtt; //us
+	uint64_t startNs;
+
+	struct tcpInfoGroup* group;
+	struct tcpInfoSampler* prev;
+	struct tcpInfoSampler* next;
+
+	//running summary
+	size_t count;
+	struct tcpInfoSample first;
+	struct tcpInfoSample last;
+	uint32_t rttMin;
+	uint32_t rttMax;
+	uint32_t spaceMin;
+	uint32_t spaceMax;
+	uint64_t rateMax;
+	double rttSum;
+	double rttvarSum;
+	double rcvRttSum;
+	size_t rcvRttCount;
+};
+
+/**
+* Connections which are sampled together on one periodic task
+*
+* A single thread samples every connection of the group in turn, so the
+* number of threads does not grow with the number of connections. The list
+* of samplers is changed under lock.
+**/
+struct tcpInfoGroup{
+	struct tcpInfoCsv* csv;
+
+	pthread_mutex_t lock;
+	struct tcpInfoSampler* samplers;
+
+	struct periodicTask task;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+struct tcpInfoCsv* tcpInfo_openCsv(const char* path);
+void tcpInfo_closeCsv(struct tcpInfoCsv* csv);
+struct tcpInfoGroup* tcpInfo_startGroup(
+	unsigned intervalMs, struct tcpInfoCsv* csv
+);
+void tcpInfo_stopGroup(struct tcpInfoGroup* group);
+struct tcpInfoSampler* tcpInfo_start(
+	struct tcpInfoGroup* group, int sockfd, uint32_t session, bool summary
+);
+void tcpInfo_stop(struct tcpInfoSampler* sampler);
+int tcpInfo_query(int sockfd, struct tcpInfoSample* s);
+/*******************************************************************************
+*                               INLINE FUNCTIONS                               *
+*******************************************************************************/
+/**
+* Returns the rtt in us of the latest sample, zero if not known
+*
+* May be called from any thread. Does nothing if sampler is NULL.
+**/
+static inline uint32_t tcpInfo_rtt(struct tcpInfoSampler* sampler){
+	if(!sampler){
+		return 0;
+	}
+
+	return __atomic_load_n(&sampler->rtt,__ATOMIC_RELAXED);
+}
+#endif //_TCP_INFO_H_
@@ -0,0 +1,53 @@
+#ifndef _TCP_RECV_H_
+#define _TCP_RECV_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//most bytes moved by one tcpRecv_read() call, a multiple of the page size
+#define TCP_RECV_CHUNK (256*1024)
+/*******************************************************************************
+*                                     ENUMS                                    *
+*******************************************************************************/
+//TCP_RECV_DEFAULT is the server's plain small read() path
+enum tcpRecvMode {
+	TCP_RECV_DEFAULT, TCP_RECV_COPY, TCP_RECV_SPLICE, TCP_RECV_ZEROCOPY
+};
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* Receive path of a single TCP connection
+*
+* Only the byte count of the data is needed, so the splice path moves data
+* through a pipe into /dev/null and the zero copy path maps it into map
+* without ever touching it.
+**/
+struct tcpReceiver{
+	enum tcpRecvMode mode;
+	int fd;
+
+	uint8_t* buf;
+
+	int pipe[2];
+	int devNull;
+
+	void* map;
+	int copybufLen;
+
+	uint64_t calls;
+	uint64_t mapped;
+	uint64_t copied;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+struct tcpReceiver* tcpRecv_open(int fd, enum tcpRecvMode mode);
+int tcpRecv_read(struct tcpReceiver* r);
+void tcpRecv_close(struct tcpReceiver* r);
+#endif //_TCP_RECV_H_
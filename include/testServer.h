@@ -6,6 +6,11 @@
 *******************************************************************************/
 #include <stdbool.h>
 #include <netinet/in.h>
+
+#include "serverStrStuff.h"
+#include "progressDisplay.h"
+#include "txStream.h"
+#include "tcpRecv.h"
 /*******************************************************************************
 *                                    DEFINES                                   *
 *******************************************************************************/
@@ -14,6 +19,9 @@
 
 #define DEFAULT_PORT_NUM (0)
 #define DEFAULT_SERVER_MODE (ECHO_SERVER)
+#define DEFAULT_SESSIONS (1)
+#define DEFAULT_MAX_SESSIONS (1024)
+#define DEFAULT_PIPELINE_SLOTS (4096)
 /*******************************************************************************
 *                                     ENUMS                                    *
 *******************************************************************************/
@@ -24,9 +32,35 @@ enum serverMode {ECHO_SERVER, THROUGHPUT_SERVER};
 
 struct serverOpts{
 	enum serverMode mode;
-	in_port_t port;
+	struct portSpec* ports;
+	int numPorts;
 	bool tcp;
 	bool pingpong;
+	const char* tracePath;
+	unsigned tcpInfoMs;
+	const char* tcpInfoCsv;
+	unsigned sockDiagMs;
+	unsigned rcvbufRate;
+	bool gro;
+	unsigned sessions;
+	unsigned maxSessions;
+	unsigned idleTimeout;
+	enum progressMode progress;
+	unsigned refreshMs;
+	unsigned pipelineSlots;
+	bool tx;
+	bool bidir;
+	struct txConfig txConfig;
+	enum tcpRecvMode tcpRecv;
+	unsigned campaignRuns;
+	unsigned campaignDuration;
+	unsigned warmupMs;
+	unsigned warmupPackets;
+	bool selfProfile;
+	unsigned profileMs;
+	unsigned adaptivePps;
+	unsigned shapeGapUs;
+	bool owd;
 };
 
 #endif //_TEST_SERVER_H_
@@ -0,0 +1,66 @@
+#ifndef _THROUGHPUT_SERVER_H_
+#define _THROUGHPUT_SERVER_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <netinet/in.h>
+
+#include "testServer.h"
+#include "packetTrace.h"
+#include "sessionTable.h"
+#include "sockDiag.h"
+/*******************************************************************************
+*                                     ENUMS                                    *
+*******************************************************************************/
+//identifies what kind of object an epoll event belongs to
+enum sourceType {
+	SOURCE_UDP, SOURCE_TCP_LISTEN, SOURCE_TCP_CONN, SOURCE_SIGNAL,
+	SOURCE_TIMER
+};
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* A listening socket of the throughput server and its per-port statistics
+**/
+struct portListener{
+	enum sourceType type;
+
+	int fd;
+	in_port_t port;
+	bool tcp;
+
+	//UDP socket bound to the same port which downlink streams paced with
+	//SO_TXTIME send from, -1 if there is none
+	int txFd;
+
+	uint64_t sessions;
+	//written by the analysis thread of the pipeline and read by the self
+	//profile report of the receive thread, so UDP ports update it atomically
+	uint64_t packets;
+	uint64_t bytes;
+	uint32_t drops;
+	uint64_t rejected;
+
+	//bytes sent by downlink streams which have ended
+	uint64_t txBytes;
+
+	//kernel drop counter as last seen by the receive thread of the pipeline
+	uint32_t rxDrops;
+
+	struct sessionTable* table;
+	struct sockDiagSampler* diag;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+double throughputServer_calcThroughput(uint64_t n,uint64_t ns);
+int throughputServer_run(
+	struct portListener* ports, int numPorts,
+	const struct serverOpts* opts, struct packetTrace* trace, int sigfd
+);
+#endif //_THROUGHPUT_SERVER_H_
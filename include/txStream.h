@@ -0,0 +1,116 @@
+#ifndef _TX_STREAM_H_
+#define _TX_STREAM_H_
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <netinet/in.h>
+
+#include "seqStats.h"
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+#define TX_DEFAULT_DURATION (10)
+#define TX_UDP_DEFAULT_SIZE (64)
+#define TX_TCP_DEFAULT_SIZE (64*1024)
+
+//largest UDP payload over IPv6
+#define TX_UDP_MAX_SIZE (65527)
+
+//largest TCP write, only bounds the buffer a stream allocates
+#define TX_TCP_MAX_SIZE (16*1024*1024)
+
+//number of packets handed to sendmmsg() at once
+#define TX_BATCH (64)
+
+//number of send times kept for matching acknowledgements, must be a power
+//of two
+#define TX_TIME_SLOTS (1<<16)
+
+//how long to wait for late acknowledgements once sending has finished
+#define TX_ACK_GRACE_MS (500)
+
+//start of a datagram asking the server to start sending
+#define TX_START_SEQ {0xFF,0xFF,0xFF,0xFE}
+
+//start of a datagram acknowledging a received packet, followed by the little
+//endian sequence number of the packet
+#define TX_ACK_SEQ {0xFF,0xFF,0xFF,0xFD}
+#define TX_ACK_SIZE (8)
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* What to send
+*
+* A zero rateKibps sends as fast as possible and a zero size picks the default
+* size of the transport.
+**/
+struct txConfig{
+	unsigned rateKibps;
+	unsigned size;
+	unsigned durationS;
+	bool txtime;
+};
+
+/**
+* A stream of packets sent to one client on its own thread
+*
+* The fields up to the acknowledgement statistics belong to the transmit
+* thread and are only read by others once it has been joined, apart from
+* bytes which may be read at any time. The acknowledgement statistics belong
+* to the thread which calls txStream_ack().
+**/
+struct txStream{
+	int fd;
+	bool tcp;
+	struct sockaddr_in6 addr;
+	struct txConfig cfg;
+
+	pthread_t thread;
+	bool stop;
+	bool done;
+
+	uint64_t intervalNs;
+	bool txtime;
+	bool zerocopy;
+
+	uint64_t startNs;
+	uint64_t endNs;
+	uint64_t sent;
+	uint64_t bytes;
+	uint64_t calls;
+
+	uint64_t lateSum;
+	uint64_t lateMax;
+	uint64_t lateCount;
+
+	uint64_t zcCompleted;
+	uint64_t zcCopied;
+
+	uint8_t* data;
+	uint64_t* sendTimes;
+
+	//acknowledgement statistics
+	struct seqStats acks;
+	uint64_t rttCount;
+	uint64_t rttSum;
+	uint64_t rttMin;
+	uint64_t rttMax;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+struct txStream* txStream_start(
+	int fd, bool tcp, const struct sockaddr_in6* addr,
+	const struct txConfig* cfg
+);
+bool txStream_done(struct txStream* tx);
+uint64_t txStream_ack(struct txStream* tx, uint32_t seqno, uint64_t now);
+uint64_t txStream_bytes(struct txStream* tx);
+uint64_t txStream_stop(struct txStream* tx);
+#endif //_TX_STREAM_H_
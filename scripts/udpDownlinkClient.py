@@ -0,0 +1,62 @@
+#!/usr/bin/env python
+"""Receives a downlink stream from a UDP server running with --tx
+
+Asks the server to start streaming, acknowledges every packet so the server
+can account for lost packets and round trip times, and stops once the server
+sends its stop sequence.
+"""
+
+import socket
+import sys
+
+START_MSG='\xFF\xFF\xFF\xFE'
+ACK_SEQ='\xFF\xFF\xFF\xFD'
+STOP_SEQ='\xFF\xFF\xFF\xFF'
+
+#seconds to wait for the next packet before giving up
+TIMEOUT=5
+
+if __name__ == '__main__':
+	"""Program entry point
+	"""
+	if(len(sys.argv) != 3):
+		sys.stderr.write("Error: expected 2 arguments. Need ip addr and port")
+		exit(-1)
+
+
+	addr = sys.argv[1]
+
+	try:
+		port = int(sys.argv[2])
+	except ValueError as e:
+		sys.stderr.write("Error: port must be an integer!")
+		exit(-1)
+
+
+	try:
+		sock = socket.socket(socket.AF_INET6,socket.SOCK_DGRAM)
+		sock.settimeout(TIMEOUT)
+		sock.sendto(START_MSG,(addr,port))
+	except Exception as e:
+		sys.stderr.write("Error: unable to communicate on socket\n")
+		sys.stderr.write(str(e)+'\n')
+		exit(-1)
+
+	received = 0
+	received_bytes = 0
+
+	while True:
+		try:
+			msg, server = sock.recvfrom(65536)
+		except socket.timeout:
+			sys.stderr.write("Error: timed out waiting for the server\n")
+			break
+
+		if(msg[:4] == STOP_SEQ):
+			break
+
+		received += 1
+		received_bytes += len(msg)
+		sock.sendto(ACK_SEQ+msg[:4],server)
+
+	print "Received %d packets (%d bytes)" % (received,received_bytes)
@@ -1,11 +1,14 @@
 #!/usr/bin/env python
 """Sends a bunch of packets to a UDP server
 
-Sends some packets to an IPV6 UDP server. Includes a special stop sequence
-in its final packet so the server can tell when the connection should be closed.
+Sends some packets to an IPV6 UDP server. Each packet starts with a little
+endian sequence number so the server can account for lost packets. Includes a
+special stop sequence in its final packet so the server can tell when the
+connection should be closed.
 """
 
 import socket
+import struct
 import sys
 
 MESSAGE_COUNT = 1024
@@ -54,7 +57,7 @@ if __name__ == '__main__':
 	stopMsg = ''.join([chr(0xFF) for i in xrange(MESSAGE_LEN)])
 
 	for i in xrange(MESSAGE_COUNT-1):
-		sendOrDie(sock,msg,(addr,port))
+		sendOrDie(sock,struct.pack('<I',i)+msg[4:],(addr,port))
 
 	#send the stop sequence a few times to give a high chance that the server
 	#actually recieved it
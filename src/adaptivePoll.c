@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Adaptive switching between blocking and busy polling                         *
+*                                                                              *
+* Spinning on epoll_wait() with a zero timeout picks up packets as soon as     *
+* they arrive but keeps a core busy, which is only worth it while packets      *
+* arrive quickly. Between the bursts of duty cycled nodes the loop blocks.     *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "adaptivePoll.h"
+
+#include <stdio.h>
+#include <string.h>
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static void switchState(struct adaptivePoll* p, uint64_t now);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Starts the polling state off blocking
+*
+* Args:
+* p - the polling state
+* enterPps - packet rate in packets/s from which the loop spins, spinning
+* 	stops again below half of it
+* now - the current time in ns
+**/
+void adaptivePoll_init(struct adaptivePoll* p, uint64_t enterPps, uint64_t now){
+	memset(p,0,sizeof(*p));
+
+	p->enterPps = enterPps;
+	p->exitPps = enterPps/2;
+	p->stateStart = now;
+	p->windowStart = now;
+}
+/**
+* Accounts for the time spent in the current state and switches to the other
+**/
+static void switchState(struct adaptivePoll* p, uint64_t now){
+	p->stateNs[p->spinning] += now - p->stateStart;
+	p->periods[p->spinning] += 1;
+
+	p->spinning = !p->spinning;
+	p->stateStart = now;
+	p->quietWindows = 0;
+}
+/**
+* Accounts for one pass of the event loop and switches state at the end of a
+* window if the packet rate calls for it
+*
+* Args:
+* p - the polling state
+* events - number of events epoll_wait() returned
+* packets - number of packets (or TCP reads) handled for those events
+* now - the current time in ns
+**/
+void adaptivePoll_update(
+	struct adaptivePoll* p, int events, uint64_t packets, uint64_t now
+){
+	p->windowPackets += packets;
+
+	if(p->spinning){
+		p->spins += 1;
+		if(!events){
+			p->emptySpins += 1;
+		}
+	}
+
+	uint64_t elapsed = now - p->windowStart;
+
+	if(elapsed < ADAPTIVE_POLL_WINDOW_NS){
+		return;
+	}
+
+	uint64_t pps = p->windowPackets*1000000000ULL/elapsed;
+
+	if(!p->spinning && pps >= p->enterPps){
+		switchState(p,now);
+	}
+	else if(p->spinning && pps < p->exitPps){
+		p->quietWindows += 1;
+		if(p->quietWindows >= ADAPTIVE_POLL_EXIT_WINDOWS){
+			switchState(p,now);
+		}
+	}
+	else if(p->spinning){
+		p->quietWindows = 0;
+	}
+
+	p->windowStart = now;
+	p->windowPackets = 0;
+}
+/**
+* Prints the time spent blocking and spinning
+*
+* Args:
+* p - the polling state
+* now - the current time in ns, closes the current period
+**/
+void adaptivePoll_report(struct adaptivePoll* p, uint64_t now){
+	p->stateNs[p->spinning] += now - p->stateStart;
+	p->periods[p->spinning] += 1;
+	p->stateStart = now;
+
+	uint64_t total = p->stateNs[0] + p->stateNs[1];
+
+	printf(
+		"Adaptive polling spun for %.3lf s (%.1lf%%) in %llu periods\n",
+		p->stateNs[1]/1e9,total ? 100.0*p->stateNs[1]/total : 0.0,
+		(unsigned long long)p->periods[1]
+	);
+	printf(
+		"Adaptive polling blocked for %.3lf s in %llu periods\n",
+		p->stateNs[0]/1e9,(unsigned long long)p->periods[0]
+	);
+	if(p->spins){
+		printf(
+			"%llu of %llu spins found nothing to read (%.1lf%%)\n",
+			(unsigned long long)p->emptySpins,
+			(unsigned long long)p->spins,
+			100.0*p->emptySpins/p->spins
+		);
+	}
+}
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Collects the results of a campaign of consecutive sessions                   *
+*                                                                              *
+* Each session is measured from the end of its warm-up. Once the campaign is   *
+* over the runs are listed along with the mean, median, 95% confidence         *
+* interval and coefficient of variation of their throughput and loss.         *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "campaign.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+struct summary{
+	double mean;
+	double median;
+	double sd;
+	double ci; //half width of the 95% confidence interval
+};
+/*******************************************************************************
+*                                     DATA                                     *
+*******************************************************************************/
+//two sided 95% quantiles of Student's t distribution for 1 to 30 degrees of
+//freedom, beyond that the normal distribution is close enough
+static const double T95[] = {
+	12.706,4.303,3.182,2.776,2.571,2.447,2.365,2.306,2.262,2.228,
+	2.201,2.179,2.160,2.145,2.131,2.120,2.110,2.101,2.093,2.086,
+	2.080,2.074,2.069,2.064,2.060,2.056,2.052,2.048,2.045,2.042
+};
+#define T95_NORMAL (1.960)
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static int compareDouble(const void* a, const void* b);
+static void summarize(double* v, size_t n, struct summary* s);
+static void printSummary(const char* name, double* v, size_t n);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* qsort() comparison of doubles
+**/
+static int compareDouble(const void* a, const void* b){
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+/**
+* Computes the statistics of a set of values
+*
+* Args:
+* v - the values, sorted in place
+* n - number of values, at least one
+* s - loaded with the statistics
+**/
+static void summarize(double* v, size_t n, struct summary* s){
+	double sum = 0.0;
+
+	for(size_t i = 0; i < n; i++){
+		sum += v[i];
+	}
+	s->mean = sum/n;
+
+	qsort(v,n,sizeof(*v),compareDouble);
+	s->median = (n % 2) ? v[n/2] : (v[n/2-1] + v[n/2])/2.0;
+
+	double sq = 0.0;
+	for(size_t i = 0; i < n; i++){
+		sq += (v[i] - s->mean)*(v[i] - s->mean);
+	}
+
+	s->sd = 0.0;
+	s->ci = 0.0;
+
+	if(n > 1){
+		size_t df = n-1;
+		double t = (df <= sizeof(T95)/sizeof(*T95)) ?
+			T95[df-1] : T95_NORMAL;
+
+		s->sd = sqrt(sq/df);
+		s->ci = t*s->sd/sqrt(n);
+	}
+}
+/**
+* Prints the statistics of one quantity across the runs
+**/
+static void printSummary(const char* name, double* v, size_t n){
+	struct summary s;
+
+	summarize(v,n,&s);
+
+	printf(
+		"%s: mean %.3f, median %.3f, 95%% CI [%.3f, %.3f]\n",name,
+		s.mean,s.median,s.mean - s.ci,s.mean + s.ci
+	);
+
+	if(s.mean != 0.0){
+		printf(
+			"  standard deviation %.3f, coefficient of variation "
+			"%.2f%%\n",s.sd,100.0*s.sd/s.mean
+		);
+	}
+	else{
+		printf("  standard deviation %.3f\n",s.sd);
+	}
+}
+/**
+* Creates an empty campaign
+*
+* Args:
+* warmupMs - time at the start of every session which is left out
+* warmupPackets - packets (or TCP reads) at the start of every session which
+* 	are left out; when both are given both must have passed
+*
+* Returns:
+* The campaign or NULL on error (an error message will be printed).
+**/
+struct campaign* campaign_create(unsigned warmupMs, unsigned warmupPackets){
+	struct campaign* c = calloc(1,sizeof(*c));
+
+	if(!c){
+		perror("Error allocating campaign");
+		return NULL;
+	}
+
+	c->warmupNs = ((uint64_t)warmupMs)*1000000ULL;
+	c->warmupPackets = warmupPackets;
+
+	return c;
+}
+/**
+* Adds the result of a session which has ended to the campaign
+*
+* Args:
+* c - the campaign
+* session - id of the session
+* tcp - set true for a TCP session
+* m - mark taken by campaign_mark(), if it was never set the session ended
+* 	during its warm-up and is only counted as discarded
+* lastNs - time the last data of the session was received
+* bytes - bytes the session received in total
+* seq - sequence numbers of the session, NULL for TCP
+**/
+void campaign_addRun(
+	struct campaign* c, uint32_t session, bool tcp,
+	const struct campaignMark* m, uint64_t lastNs, uint64_t bytes,
+	const struct seqStats* seq
+){
+	if(!m->set){
+		c->discarded += 1;
+		return;
+	}
+
+	if(c->count == c->mem){
+		size_t mem = c->mem ? 2*c->mem : 64;
+		struct campaignRun* tmp = realloc(c->runs,mem*sizeof(*tmp));
+
+		if(!tmp){
+			perror("Error recording campaign run");
+			return;
+		}
+
+		c->runs = tmp;
+		c->mem = mem;
+	}
+
+	struct campaignRun* run = &c->runs[c->count];
+
+	memset(run,0,sizeof(*run));
+	run->session = session;
+	run->tcp = tcp;
+	run->bytes = bytes - m->bytes;
+	run->ns = lastNs - m->ns;
+	run->throughput = run->ns ?
+		(run->bytes/128.0)/(0.000000001*run->ns) : 0.0;
+
+	if(seq){
+		uint64_t expected = m->received ?
+			((uint64_t)seq->max) - m->max : seqStats_expected(seq);
+		uint64_t received = seq->received - m->received;
+
+		if(expected > received){
+			run->loss = 100.0*(expected - received)/expected;
+		}
+	}
+
+	__atomic_store_n(&c->count,c->count+1,__ATOMIC_RELAXED);
+}
+/**
+* Prints every run of the campaign and the statistics across them
+**/
+void campaign_report(const struct campaign* c){
+	printf(
+		"\nCampaign: %zu runs measured, %llu ended during the warm-up\n",
+		c->count,(unsigned long long)c->discarded
+	);
+
+	if(!c->count){
+		return;
+	}
+
+	printf(
+		"%5s %8s %5s %14s %10s %14s %8s\n","run","session","proto",
+		"bytes","time s","kib/s","loss%"
+	);
+
+	double* throughput = malloc(c->count*sizeof(*throughput));
+	double* loss = malloc(c->count*sizeof(*loss));
+
+	if(!throughput || !loss){
+		perror("Error allocating campaign summary");
+		free(throughput);
+		free(loss);
+		return;
+	}
+
+	for(size_t i = 0; i < c->count; i++){
+		const struct campaignRun* run = &c->runs[i];
+
+		printf(
+			"%5zu %8u %5s %14llu %10.3f %14.3f %8.3f\n",i,
+			run->session,run->tcp ? "tcp" : "udp",
+			(unsigned long long)run->bytes,run->ns/1000000000.0,
+			run->throughput,run->loss
+		);
+
+		throughput[i] = run->throughput;
+		loss[i] = run->loss;
+	}
+
+	printSummary("Throughput (kib/s)",throughput,c->count);
+	printSummary("Loss (%)",loss,c->count);
+
+	free(throughput);
+	free(loss);
+}
+/**
+* Frees a campaign
+**/
+void campaign_destroy(struct campaign* c){
+	if(!c){
+		return;
+	}
+
+	free(c->runs);
+	free(c);
+}
@@ -29,6 +29,9 @@
  */
 /******************************************************************************
 * Handles resource clean-up on abrupt exit (from signals)                     *
+*                                                                             *
+* Servers which can finish up by themselves block the shutdown signals and    *
+* receive them through a signalfd instead.                                    *
 ******************************************************************************/
 
 /******************************************************************************
@@ -39,14 +42,20 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <stdbool.h>
+
+#include <sys/signalfd.h>
 /******************************************************************************
 *                                    DATA                                     *
 ******************************************************************************/
+//signals which ask the program to finish up
+static const int SHUTDOWN_SIGNALS[] = {SIGINT, SIGTERM};
+
 static int* fdList;
-static int  fdListSize;
+static volatile sig_atomic_t fdListSize;
 static int  fdListMem;
 /******************************************************************************
 *                             FUNCTION PROTOTYPES                             *
@@ -57,21 +66,36 @@ static void sigHandler(int signum);
 ******************************************************************************/
 /**
 * Signal handler for handling exit
+*
+* Only uses async-signal-safe calls, the fd list is left for the OS to free.
 **/
 static void sigHandler(int signum){
 	for(int i = 0; i < fdListSize; i++){
 		close(fdList[i]);
 	}
-	free(fdList);
 
-	exit(-1);
+	_exit(-1);
 }
 /**
 * Add to list of file descriptors to clean up on exit
+*
+* Will call exit if memory can not be allocated.
 **/
 void cleanExit_add_fd(int fd){
+	sigset_t set;
+	sigset_t old;
+
+	//the handler must never see the list while it is being moved
+	sigfillset(&set);
+	sigprocmask(SIG_BLOCK,&set,&old);
+
 	if(fdListSize == fdListMem){
-		int* tmp = realloc(fdList,fdListMem+8);
+		int* tmp = realloc(fdList,(fdListMem+8)*sizeof(*fdList));
+
+		if(!tmp){
+			perror("Error growing clean-up list");
+			exit(-1);
+		}
 
 		fdListMem += 8;
 		fdList = tmp;
@@ -79,12 +103,51 @@ void cleanExit_add_fd(int fd){
 
 	fdList[fdListSize] = fd;
 	fdListSize += 1;
+
+	sigprocmask(SIG_SETMASK,&old,NULL);
 }
 /**
 * Start handling the given signal so that we can clean up resources
 **/
 void cleanExit_add_signal(int signum){
-	signal(signum,sigHandler);
+	struct sigaction sa;
+
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler = sigHandler;
+	sigfillset(&sa.sa_mask);
+
+	sigaction(signum,&sa,NULL);
+}
+/**
+* Blocks the shutdown signals (SIGINT and SIGTERM) and returns a signalfd
+* which becomes readable when one of them arrives
+*
+* Must be called before any threads are created so that every thread inherits
+* the blocked signals. Will call exit on fatal error.
+*
+* Returns:
+* A non-blocking signalfd for the shutdown signals
+**/
+int cleanExit_signalfd(void){
+	sigset_t set;
+
+	sigemptyset(&set);
+	for(unsigned i = 0; i < sizeof(SHUTDOWN_SIGNALS)/sizeof(int); i++){
+		sigaddset(&set,SHUTDOWN_SIGNALS[i]);
+	}
+
+	if(sigprocmask(SIG_BLOCK,&set,NULL)){
+		perror("Error blocking signals");
+		exit(-1);
+	}
+
+	int fd = signalfd(-1,&set,SFD_NONBLOCK|SFD_CLOEXEC);
+	if(fd < 0){
+		perror("Error creating signalfd");
+		exit(-1);
+	}
+
+	return fd;
 }
 /**
 * Forget all resources we want to handle. Signal handlers are left in place.
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* One-way delay estimation with unsynchronized clocks                          *
+*                                                                              *
+* Half of the round trip time says little about a link whose directions       *
+* differ. Clients which put their transmit time into every packet give the     *
+* delay of each direction on its own once the clock offset and drift are      *
+* taken out, in bounded memory per session.                                    *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "owdEstimator.h"
+#include "serverStrStuff.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static int bucketOf(uint64_t v);
+static uint64_t bucketTop(int bucket);
+static void fitBase(struct owdEstimator* e);
+static void closeWindow(struct owdEstimator* e);
+static uint64_t percentile(const struct owdEstimator* e, double p);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Returns the histogram bucket of a delay in ns
+**/
+static int bucketOf(uint64_t v){
+	if(v < OWD_SUB_BUCKETS){
+		return v;
+	}
+
+	int e = 63 - __builtin_clzll(v);
+
+	return OWD_SUB_BUCKETS + (e-3)*OWD_SUB_BUCKETS + ((v >> (e-3)) & 7);
+}
+/**
+* Returns the smallest delay above a histogram bucket
+**/
+static uint64_t bucketTop(int bucket){
+	if(bucket < OWD_SUB_BUCKETS){
+		return bucket + 1;
+	}
+
+	int e = (bucket - OWD_SUB_BUCKETS)/OWD_SUB_BUCKETS + 3;
+	uint64_t sub = (bucket - OWD_SUB_BUCKETS)%OWD_SUB_BUCKETS;
+
+	return (e < 63 || sub < 7) ? (OWD_SUB_BUCKETS+sub+1) << (e-3) : ~0ULL;
+}
+/**
+* Fits the base delay line to the window samples
+*
+* Windows with queueing in them lift their samples above the base delay, so
+* after a least squares fit to all samples the line is fitted again to the
+* samples on or below it, which pulls it towards the lower envelope.
+**/
+static void fitBase(struct owdEstimator* e){
+	e->drift = 0;
+	e->offset = e->samples[0].delay;
+	for(unsigned i = 1; i < e->numSamples; i++){
+		if(e->samples[i].delay < e->offset){
+			e->offset = e->samples[i].delay;
+		}
+	}
+
+	bool all = true;
+
+	for(int pass = 0; pass < OWD_FIT_PASSES; pass++){
+		double sumT = 0;
+		double sumD = 0;
+		double sumTT = 0;
+		double sumTD = 0;
+		double n = 0;
+
+		for(unsigned i = 0; i < e->numSamples; i++){
+			const struct owdSample* s = &e->samples[i];
+
+			if(!all && s->delay > e->offset + e->drift*s->t){
+				continue;
+			}
+
+			n += 1;
+			sumT += s->t;
+			sumD += s->delay;
+			sumTT += s->t*s->t;
+			sumTD += s->t*s->delay;
+		}
+
+		double det = n*sumTT - sumT*sumT;
+
+		if(n < 2 || det <= 0){
+			return;
+		}
+
+		e->drift = (n*sumTD - sumT*sumD)/det;
+		e->offset = (sumD - e->drift*sumT)/n;
+		all = false;
+	}
+}
+/**
+* Adds the lowest delay of the window which just ended to the samples
+**/
+static void closeWindow(struct owdEstimator* e){
+	e->samples[e->nextSample] = e->windowMin;
+	e->nextSample = (e->nextSample + 1) % OWD_WINDOWS;
+	if(e->numSamples < OWD_WINDOWS){
+		e->numSamples += 1;
+	}
+
+	fitBase(e);
+}
+/**
+* Returns the queueing delay below which a fraction p of the packets fell
+**/
+static uint64_t percentile(const struct owdEstimator* e, double p){
+	uint64_t target = (uint64_t)(p*e->packets);
+	uint64_t seen = 0;
+
+	for(int i = 0; i < OWD_BUCKETS; i++){
+		seen += e->hist[i];
+		if(seen > target){
+			uint64_t top = bucketTop(i);
+			return (top < e->maxDelay) ? top : e->maxDelay;
+		}
+	}
+
+	return e->maxDelay;
+}
+/**
+* Resets an estimator for a new session
+**/
+void owd_init(struct owdEstimator* e){
+	memset(e,0,sizeof(*e));
+}
+/**
+* Accounts for a packet carrying its transmit time
+*
+* The queueing delay of the packet is taken against the base delay line known
+* when it arrives. Until the first window has ended the lowest delay seen so
+* far stands in for it.
+*
+* Args:
+* e - the estimator, may be NULL
+* txNs - transmit time of the packet by the client's clock
+* rxNs - receive time of the packet
+**/
+void owd_add(struct owdEstimator* e, uint64_t txNs, uint64_t rxNs){
+	if(!e){
+		return;
+	}
+
+	int64_t raw = (int64_t)(rxNs - txNs);
+
+	if(!e->started){
+		e->started = true;
+		e->firstRx = rxNs;
+		e->firstRaw = raw;
+		e->windowStart = rxNs;
+		e->windowMin.delay = 0;
+	}
+
+	double t = rxNs - e->firstRx;
+	double d = raw - e->firstRaw;
+
+	if(rxNs - e->windowStart >= OWD_WINDOW_NS){
+		closeWindow(e);
+		e->windowStart = rxNs;
+		e->windowMin.t = t;
+		e->windowMin.delay = d;
+	}
+	else if(d < e->windowMin.delay){
+		e->windowMin.t = t;
+		e->windowMin.delay = d;
+	}
+
+	double base = e->numSamples ? e->offset + e->drift*t : e->windowMin.delay;
+	double q = d - base;
+
+	if(q < 0){
+		e->belowBase += 1;
+		q = 0;
+	}
+
+	uint64_t qNs = (uint64_t)q;
+
+	e->packets += 1;
+	e->hist[bucketOf(qNs)] += 1;
+	if(qNs > e->maxDelay){
+		e->maxDelay = qNs;
+	}
+
+	double s = t/1e9;
+
+	e->sumT += s;
+	e->sumD += q;
+	e->sumTT += s*s;
+	e->sumTD += s*q;
+	e->lastT = t;
+}
+/**
+* Prints the queueing delay percentiles, the clock estimate and the delay
+* trend
+**/
+void owd_print(const struct owdEstimator* e){
+	if(!e->packets){
+		printf("No packets carried a transmit timestamp\n");
+		return;
+	}
+
+	char p50[32];
+	char p90[32];
+	char p99[32];
+	char max[32];
+
+	fmtNs(p50,sizeof(p50),percentile(e,0.50));
+	fmtNs(p90,sizeof(p90),percentile(e,0.90));
+	fmtNs(p99,sizeof(p99),percentile(e,0.99));
+	fmtNs(max,sizeof(max),e->maxDelay);
+
+	printf(
+		"One-way delay above the base delay of %llu packets:\n",
+		(unsigned long long)e->packets
+	);
+	printf("  median %s, 90%% %s, 99%% %s, max %s\n",p50,p90,p99,max);
+
+	//the base delay can not be told apart from the clock offset
+	char base[32];
+	double offset = e->numSamples ?
+		e->offset + e->drift*e->lastT : e->windowMin.delay;
+
+	fmtNs(base,sizeof(base),e->firstRaw + offset);
+	printf("Base delay plus clock offset %s\n",base);
+	printf(
+		"Clock drift %.3lf ppm, fitted over the last %.1lf s\n",
+		e->drift*1e6,e->numSamples*(OWD_WINDOW_NS/1e9)
+	);
+
+	double n = e->packets;
+	double det = n*e->sumTT - e->sumT*e->sumT;
+
+	if(det > 0){
+		double trend = (n*e->sumTD - e->sumT*e->sumD)/det;
+		char rate[32];
+
+		fmtNs(rate,sizeof(rate),trend);
+		printf(
+			"Queueing delay trend %s per second (%s)\n",rate,
+			(trend > 0) ? "building up" : "draining or steady"
+		);
+	}
+
+	if(e->belowBase){
+		printf(
+			"%llu packets arrived faster than the estimated base delay\n",
+			(unsigned long long)e->belowBase
+		);
+	}
+}
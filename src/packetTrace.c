@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Records fixed size per-packet trace records into a memory mapped file        *
+*                                                                              *
+* The file is preallocated and mapped a window at a time. A small ring of      *
+* windows is kept mapped (and pre-faulted) ahead of the writer so recording a  *
+* packet is only a store to memory. Unmapping used windows, growing the file   *
+* and mapping the windows ahead is left to a helper thread so the writer only  *
+* has to wake it when a window is used up.                                     *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "packetTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+/*******************************************************************************
+*                                  ASSERTIONS                                  *
+*******************************************************************************/
+_Static_assert(
+	sizeof(struct traceHeader) == PACKET_TRACE_HEADER_SIZE,
+	"trace header size mismatch"
+);
+_Static_assert(
+	(PACKET_TRACE_WINDOW_SIZE % sizeof(struct traceRecord)) == 0,
+	"trace window must hold a whole number of records"
+);
+_Static_assert(
+	(PACKET_TRACE_PREALLOC_SIZE % PACKET_TRACE_WINDOW_SIZE) == 0,
+	"trace preallocation must be a whole number of windows"
+);
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static uint8_t* mapWindow(int fd, off_t off);
+static int ensureFileSize(struct packetTrace* trace, off_t size);
+static uint64_t readClockNs(clockid_t clk);
+static uint64_t recoverRecordCount(int fd, uint64_t maxCount);
+static void* windowThread(void* arg);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Reads the given clock in ns
+**/
+static uint64_t readClockNs(clockid_t clk){
+	struct timespec ts;
+
+	clock_gettime(clk,&ts);
+
+	return ((uint64_t)ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+/**
+* Maps one window of the trace file and pre-faults its pages
+*
+* Args:
+* fd - the trace file
+* off - offset of the window in the file
+*
+* Returns:
+* Pointer to the mapped window or NULL on error.
+**/
+static uint8_t* mapWindow(int fd, off_t off){
+	void* win = mmap(
+		NULL,PACKET_TRACE_WINDOW_SIZE,PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE,fd,off
+	);
+
+	if(win == MAP_FAILED){
+		perror("Error mapping trace file");
+		return NULL;
+	}
+
+	return win;
+}
+/**
+* Makes sure the trace file has space allocated up to the given size
+*
+* Space is allocated in steps of PACKET_TRACE_PREALLOC_SIZE.
+*
+* Returns:
+* Zero on success and non-zero on failure.
+**/
+static int ensureFileSize(struct packetTrace* trace, off_t size){
+	off_t newSize = trace->fileSize;
+
+	while(newSize < size){
+		newSize += PACKET_TRACE_PREALLOC_SIZE;
+	}
+
+	if(newSize == trace->fileSize){
+		return 0;
+	}
+
+	int rc = posix_fallocate(
+		trace->fd,trace->fileSize,newSize-trace->fileSize
+	);
+	if(rc){
+		fprintf(stderr,"Error preallocating trace file: %s\n",strerror(rc));
+		return -1;
+	}
+
+	trace->fileSize = newSize;
+
+	return 0;
+}
+/**
+* Keeps the ring of windows ahead of the writer mapped
+*
+* Each window the writer has finished is unmapped and its slot reused for the
+* window PACKET_TRACE_RING_WINDOWS further on, growing the file first if
+* needed. If that fails no further windows are mapped.
+*
+* Args:
+* arg - the trace
+*
+* Returns:
+* NULL.
+**/
+static void* windowThread(void* arg){
+	struct packetTrace* trace = arg;
+
+	pthread_mutex_lock(&trace->lock);
+
+	while(!trace->stop){
+		if(trace->failed ||
+			trace->mapped >= trace->retired + PACKET_TRACE_RING_WINDOWS){
+
+			pthread_cond_wait(&trace->cond,&trace->lock);
+			continue;
+		}
+
+		uint64_t n = trace->mapped;
+		int slot = n % PACKET_TRACE_RING_WINDOWS;
+		off_t off = ((off_t)n)*PACKET_TRACE_WINDOW_SIZE;
+
+		pthread_mutex_unlock(&trace->lock);
+
+		//the slot still holds window n-PACKET_TRACE_RING_WINDOWS, which the
+		//writer has finished with
+		if(trace->ring[slot]){
+			munmap(trace->ring[slot],PACKET_TRACE_WINDOW_SIZE);
+			trace->ring[slot] = NULL;
+		}
+
+		if(!ensureFileSize(trace,off+PACKET_TRACE_WINDOW_SIZE)){
+			trace->ring[slot] = mapWindow(trace->fd,off);
+		}
+
+		pthread_mutex_lock(&trace->lock);
+
+		if(trace->ring[slot]){
+			trace->mapped += 1;
+		}
+		else{
+			trace->failed = true;
+		}
+		pthread_cond_broadcast(&trace->cond);
+	}
+
+	pthread_mutex_unlock(&trace->lock);
+
+	return NULL;
+}
+/**
+* Creates a new trace file
+*
+* Any existing file at the given path is truncated.
+*
+* Args:
+* path - path of the trace file
+*
+* Returns:
+* The new trace or NULL on error (an error message will have been printed).
+**/
+struct packetTrace* packetTrace_open(const char* path){
+	struct packetTrace* trace = calloc(1,sizeof(*trace));
+	if(!trace){
+		perror("Error allocating trace");
+		return NULL;
+	}
+
+	trace->fd = open(path,O_RDWR|O_CREAT|O_TRUNC,0644);
+	if(trace->fd < 0){
+		perror("Error opening trace file");
+		free(trace);
+		return NULL;
+	}
+
+	struct traceHeader hdr;
+	memset(&hdr,0,sizeof(hdr));
+	memcpy(hdr.magic,PACKET_TRACE_MAGIC,sizeof(hdr.magic));
+	hdr.version = PACKET_TRACE_VERSION;
+	hdr.recordSize = sizeof(struct traceRecord);
+	hdr.startRealtime = readClockNs(CLOCK_REALTIME);
+	hdr.startMonotonic = readClockNs(CLOCK_MONOTONIC);
+
+	if(ensureFileSize(trace,PACKET_TRACE_PREALLOC_SIZE)){
+		goto fail;
+	}
+
+	if(pwrite(trace->fd,&hdr,sizeof(hdr),0) != sizeof(hdr)){
+		perror("Error writing trace header");
+		goto fail;
+	}
+
+	for(int i = 0; i < PACKET_TRACE_RING_WINDOWS; i++){
+		trace->ring[i] = mapWindow(
+			trace->fd,((off_t)i)*PACKET_TRACE_WINDOW_SIZE
+		);
+		if(!trace->ring[i]){
+			goto fail;
+		}
+	}
+
+	trace->retired = 0;
+	trace->mapped = PACKET_TRACE_RING_WINDOWS;
+	trace->next = (struct traceRecord*)
+		(trace->ring[0] + PACKET_TRACE_HEADER_SIZE);
+	trace->end = (struct traceRecord*)
+		(trace->ring[0] + PACKET_TRACE_WINDOW_SIZE);
+
+	pthread_mutex_init(&trace->lock,NULL);
+	pthread_cond_init(&trace->cond,NULL);
+
+	//the helper must never take the shutdown signals meant for the main
+	//thread, which may not have blocked them yet, so it starts with every
+	//signal blocked
+	sigset_t all;
+	sigset_t old;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK,&all,&old);
+	int rc = pthread_create(&trace->thread,NULL,windowThread,trace);
+	pthread_sigmask(SIG_SETMASK,&old,NULL);
+	if(rc){
+		fprintf(stderr,"Error starting trace thread: %s\n",strerror(rc));
+		pthread_cond_destroy(&trace->cond);
+		pthread_mutex_destroy(&trace->lock);
+		goto fail;
+	}
+
+	return trace;
+
+fail:
+	for(int i = 0; i < PACKET_TRACE_RING_WINDOWS; i++){
+		if(trace->ring[i]){
+			munmap(trace->ring[i],PACKET_TRACE_WINDOW_SIZE);
+		}
+	}
+	close(trace->fd);
+	free(trace);
+
+	return NULL;
+}
+/**
+* Moves the trace on to the next mapped window
+*
+* Hands the filled window to the helper thread, which unmaps it (the kernel
+* writes it back in the background) and maps and pre-faults the window
+* furthest ahead in its place. The next window has normally been mapped long
+* before, only if the helper thread has fallen a whole ring behind does this
+* wait for it. Called from packetTrace_record() when the current window is
+* full.
+*
+* Returns:
+* Zero on success and non-zero if no more records can be written.
+**/
+int packetTrace_advance(struct packetTrace* trace){
+	if(!trace->end){
+		return -1;
+	}
+
+	pthread_mutex_lock(&trace->lock);
+
+	trace->retired += 1;
+	pthread_cond_broadcast(&trace->cond);
+
+	while(trace->mapped <= trace->retired && !trace->failed){
+		pthread_cond_wait(&trace->cond,&trace->lock);
+	}
+
+	bool ready = trace->mapped > trace->retired;
+	int slot = trace->retired % PACKET_TRACE_RING_WINDOWS;
+
+	pthread_mutex_unlock(&trace->lock);
+
+	uint8_t* win = ready ? trace->ring[slot] : NULL;
+	if(!win){
+		fprintf(stderr,"Trace file is full, recording stopped\n");
+		trace->next = NULL;
+		trace->end = NULL;
+		return -1;
+	}
+
+	trace->next = (struct traceRecord*)win;
+	trace->end = (struct traceRecord*)(win + PACKET_TRACE_WINDOW_SIZE);
+
+	return 0;
+}
+/**
+* Finishes a trace
+*
+* Unmaps the file, trims the unused preallocated space and writes the final
+* record count to the header. The trace is freed.
+**/
+void packetTrace_close(struct packetTrace* trace){
+	if(!trace){
+		return;
+	}
+
+	pthread_mutex_lock(&trace->lock);
+	trace->stop = true;
+	pthread_cond_broadcast(&trace->cond);
+	pthread_mutex_unlock(&trace->lock);
+
+	pthread_join(trace->thread,NULL);
+	pthread_cond_destroy(&trace->cond);
+	pthread_mutex_destroy(&trace->lock);
+
+	for(int i = 0; i < PACKET_TRACE_RING_WINDOWS; i++){
+		if(trace->ring[i]){
+			munmap(trace->ring[i],PACKET_TRACE_WINDOW_SIZE);
+		}
+	}
+
+	off_t len = PACKET_TRACE_HEADER_SIZE +
+		((off_t)trace->count)*sizeof(struct traceRecord);
+
+	if(ftruncate(trace->fd,len)){
+		perror("Error truncating trace file");
+	}
+
+	struct traceHeader hdr;
+	if(pread(trace->fd,&hdr,sizeof(hdr),0) == sizeof(hdr)){
+		hdr.recordCount = trace->count;
+		hdr.clean = 1;
+
+		if(pwrite(trace->fd,&hdr,sizeof(hdr),0) != sizeof(hdr)){
+			perror("Error writing trace header");
+		}
+	}
+	else{
+		perror("Error reading trace header");
+	}
+
+	printf("Wrote %llu trace records\n",(unsigned long long)trace->count);
+
+	close(trace->fd);
+	free(trace);
+}
+/**
+* Finds the number of records in a trace which was not closed cleanly
+*
+* Records are written in order into a zero filled file so the written records
+* are exactly the prefix of records with a non-zero timestamp.
+*
+* Args:
+* fd - the trace file
+* maxCount - the number of record slots in the file
+*
+* Returns:
+* The number of records which were written.
+**/
+static uint64_t recoverRecordCount(int fd, uint64_t maxCount){
+	uint64_t lo = 0;
+	uint64_t hi = maxCount;
+
+	while(lo < hi){
+		uint64_t mid = lo + (hi-lo)/2;
+		struct traceRecord rec;
+		off_t off = PACKET_TRACE_HEADER_SIZE + ((off_t)mid)*sizeof(rec);
+
+		if(pread(fd,&rec,sizeof(rec),off) != sizeof(rec)){
+			hi = mid;
+		}
+		else if(rec.timestamp){
+			lo = mid+1;
+		}
+		else{
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+/**
+* Reads and checks the header of an existing trace file
+*
+* If the trace was not closed cleanly the number of records is recovered from
+* the file contents.
+*
+* Args:
+* fd - the trace file, opened for reading
+* hdr - filled with the file header
+* count - loaded with the number of records in the file
+*
+* Returns:
+* Zero on success and non-zero if the file is not a usable trace (an error
+* message will have been printed).
+**/
+int packetTrace_readHeader(int fd, struct traceHeader* hdr, uint64_t* count){
+	struct stat st;
+
+	if(fstat(fd,&st)){
+		perror("Error reading trace file size");
+		return -1;
+	}
+
+	if(pread(fd,hdr,sizeof(*hdr),0) != sizeof(*hdr)){
+		fprintf(stderr,"Trace file is too short\n");
+		return -1;
+	}
+
+	if(memcmp(hdr->magic,PACKET_TRACE_MAGIC,sizeof(hdr->magic))){
+		fprintf(stderr,"Not a trace file\n");
+		return -1;
+	}
+
+	if(hdr->version != PACKET_TRACE_VERSION ||
+		hdr->recordSize != sizeof(struct traceRecord)){
+
+		fprintf(
+			stderr,"Unsupported trace version %u (record size %u)\n",
+			hdr->version,hdr->recordSize
+		);
+		return -1;
+	}
+
+	uint64_t slots = (st.st_size - PACKET_TRACE_HEADER_SIZE) /
+		sizeof(struct traceRecord);
+
+	if(hdr->clean && hdr->recordCount <= slots){
+		*count = hdr->recordCount;
+	}
+	else{
+		*count = recoverRecordCount(fd,slots);
+	}
+
+	return 0;
+}
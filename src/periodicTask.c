@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Runs a function at a fixed rate on its own thread                            *
+*                                                                              *
+* Used for sampling and reporting work which must stay off of the receive      *
+* path. Calls are made on an absolute schedule so they don't drift.            *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "periodicTask.h"
+
+#include <stdio.h>
+#include <time.h>
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static void* taskThread(void* arg);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Task thread entry point
+*
+* The task lock is held while fn runs so periodicTask_stop() never returns
+* while a call is in progress.
+**/
+static void* taskThread(void* arg){
+	struct periodicTask* task = arg;
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC,&deadline);
+
+	pthread_mutex_lock(&task->lock);
+
+	while(!task->stop){
+		task->fn(task->arg);
+
+		uint64_t ns = deadline.tv_nsec + task->intervalNs;
+		deadline.tv_sec += ns/1000000000ULL;
+		deadline.tv_nsec = ns%1000000000ULL;
+
+		while(!task->stop){
+			int rc = pthread_cond_timedwait(
+				&task->cond,&task->lock,&deadline
+			);
+			if(rc){
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&task->lock);
+
+	return NULL;
+}
+/**
+* Starts calling fn(arg) every intervalMs milliseconds
+*
+* The first call is made immediately.
+*
+* Args:
+* task - task structure to initialize, must stay valid until stopped
+* intervalMs - time between calls in ms
+* fn - the function to call
+* arg - argument for fn
+*
+* Returns:
+* Zero on success and non-zero on error (an error message will be printed).
+**/
+int periodicTask_start(
+	struct periodicTask* task, unsigned intervalMs,
+	void (*fn)(void* arg), void* arg
+){
+	pthread_condattr_t attr;
+
+	task->fn = fn;
+	task->arg = arg;
+	task->intervalNs = ((uint64_t)intervalMs)*1000000ULL;
+	task->stop = false;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+	pthread_cond_init(&task->cond,&attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&task->lock,NULL);
+
+	if(pthread_create(&task->thread,NULL,taskThread,task)){
+		perror("Error starting periodic task");
+		pthread_cond_destroy(&task->cond);
+		pthread_mutex_destroy(&task->lock);
+		return -1;
+	}
+
+	return 0;
+}
+/**
+* Stops a running task and waits for its thread to exit
+**/
+void periodicTask_stop(struct periodicTask* task){
+	pthread_mutex_lock(&task->lock);
+	task->stop = true;
+	pthread_cond_signal(&task->cond);
+	pthread_mutex_unlock(&task->lock);
+
+	pthread_join(task->thread,NULL);
+
+	pthread_cond_destroy(&task->cond);
+	pthread_mutex_destroy(&task->lock);
+}
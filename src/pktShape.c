@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Packet size, burst length and idle gap histograms of UDP sessions            *
+*                                                                              *
+* Fragmentation below the IPv6 layer shows up as unexpected datagram sizes     *
+* and batching in the MAC layer as bursts of packets separated by idle gaps,   *
+* both of which bound the throughput of a constrained link.                    *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "pktShape.h"
+#include "serverStrStuff.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static uint64_t histTotal(const uint64_t* hist, int buckets);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Returns the number of samples in a histogram
+**/
+static uint64_t histTotal(const uint64_t* hist, int buckets){
+	uint64_t total = 0;
+
+	for(int i = 0; i < buckets; i++){
+		total += hist[i];
+	}
+
+	return total;
+}
+/**
+* Empties the histograms for a new session
+*
+* Args:
+* sh - the histograms
+* gapUs - packets at most this many us apart belong to the same burst
+**/
+void pktShape_init(struct pktShape* sh, unsigned gapUs){
+	memset(sh,0,sizeof(*sh));
+	sh->gapNs = ((uint64_t)gapUs)*1000ULL;
+}
+/**
+* Prints the non-empty buckets of every histogram
+*
+* The burst which is still open counts as a burst of its own.
+*
+* Args:
+* sh - the histograms
+* truncSize - size of the receive buffer, longer datagrams were truncated
+**/
+void pktShape_print(struct pktShape* sh, uint32_t truncSize){
+	if(sh->burstLen){
+		sh->burstHist[pktShape_log2(sh->burstLen)] += 1;
+		sh->burstLen = 0;
+	}
+
+	uint64_t total = histTotal(sh->sizeHist,SHAPE_SIZE_BUCKETS);
+
+	printf("Datagram sizes (%llu packets)\n",(unsigned long long)total);
+	for(int i = 0; i < SHAPE_SIZE_BUCKETS && total; i++){
+		if(!sh->sizeHist[i]){
+			continue;
+		}
+
+		if(i < SHAPE_SIZE_BUCKETS-1){
+			printf(
+				"  [%6d, %6d) bytes %12llu %6.2f%%\n",
+				i*SHAPE_SIZE_STEP,(i+1)*SHAPE_SIZE_STEP,
+				(unsigned long long)sh->sizeHist[i],
+				100.0*sh->sizeHist[i]/total
+			);
+		}
+		else{
+			printf(
+				"  [%6d,    ...) bytes %12llu %6.2f%%\n",
+				i*SHAPE_SIZE_STEP,(unsigned long long)sh->sizeHist[i],
+				100.0*sh->sizeHist[i]/total
+			);
+		}
+	}
+	if(sh->truncated){
+		printf(
+			"  %llu datagrams were longer than %u bytes and truncated\n",
+			(unsigned long long)sh->truncated,truncSize
+		);
+	}
+
+	char gap[32];
+	fmtNs(gap,sizeof(gap),sh->gapNs);
+
+	total = histTotal(sh->burstHist,SHAPE_LOG_BUCKETS);
+	printf(
+		"Burst lengths with gaps of at most %s (%llu bursts)\n",gap,
+		(unsigned long long)total
+	);
+	for(int i = 0; i < SHAPE_LOG_BUCKETS && total; i++){
+		if(!sh->burstHist[i]){
+			continue;
+		}
+
+		printf(
+			"  [%6llu, %6llu) packets %10llu %6.2f%%\n",1ULL << i,
+			(i < 63) ? 1ULL << (i+1) : ~0ULL,
+			(unsigned long long)sh->burstHist[i],
+			100.0*sh->burstHist[i]/total
+		);
+	}
+
+	total = histTotal(sh->idleHist,SHAPE_LOG_BUCKETS);
+	printf("Idle gaps (%llu gaps)\n",(unsigned long long)total);
+	for(int i = 0; i < SHAPE_LOG_BUCKETS && total; i++){
+		if(!sh->idleHist[i]){
+			continue;
+		}
+
+		char lo[32];
+		char hi[32];
+		fmtNs(lo,sizeof(lo),i ? (1ULL << i) : 0);
+		fmtNs(hi,sizeof(hi),(i < 63) ? (1ULL << (i+1)) : ~0ULL);
+
+		printf(
+			"  [%8s, %8s) %12llu %6.2f%%\n",lo,hi,
+			(unsigned long long)sh->idleHist[i],
+			100.0*sh->idleHist[i]/total
+		);
+	}
+}
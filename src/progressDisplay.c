@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Progress display of the throughput server                                    *
+*                                                                              *
+* The receive loop only hands over a snapshot of its counters once per refresh *
+* interval. Rates are worked out and drawn on a periodic task so writing to a  *
+* slow terminal never holds up reading from the sockets. Reports printed while *
+* the display runs are captured and written out by the display thread too.    *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "progressDisplay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//longest line drawn by the display including its newline
+#define PROGRESS_LINE_SIZE 128
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static void appendText(
+	struct progressDisplay* display, size_t* len, const char* fmt, ...
+);
+static double rateKibps(uint64_t bytes, uint64_t ns);
+static const struct progressRow* findRow(
+	const struct progressSnapshot* snap, uint32_t id
+);
+static size_t renderLine(struct progressDisplay* display);
+static size_t renderTable(struct progressDisplay* display);
+static void eraseDrawing(struct progressDisplay* display);
+static void writePending(struct progressDisplay* display, char* pending);
+static void refresh(void* arg);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Appends formatted text to the text buffer of the display
+*
+* Output which does not fit is cut off, the buffer is sized for the largest
+* drawing so this only happens if a line is longer than PROGRESS_LINE_SIZE.
+**/
+static void appendText(
+	struct progressDisplay* display, size_t* len, const char* fmt, ...
+){
+	va_list args;
+
+	if(*len >= display->textSize){
+		return;
+	}
+
+	va_start(args,fmt);
+	int n = vsnprintf(
+		display->text + *len,display->textSize - *len,fmt,args
+	);
+	va_end(args);
+
+	if(n > 0){
+		*len += n;
+		if(*len >= display->textSize){
+			*len = display->textSize - 1;
+		}
+	}
+}
+/**
+* Returns the rate in kib/s for the given number of bytes over ns
+*
+* Matches the kib/s of the session reports, 1 kib being 128 bytes.
+**/
+static double rateKibps(uint64_t bytes, uint64_t ns){
+	if(!ns){
+		return 0.0;
+	}
+
+	return (bytes/(1024.0/8.0))/(0.000000001*ns);
+}
+/**
+* Finds the row of the given session in a snapshot
+*
+* Returns:
+* The row or NULL if the session is not in the snapshot.
+**/
+static const struct progressRow* findRow(
+	const struct progressSnapshot* snap, uint32_t id
+){
+	for(uint32_t i = 0; i < snap->numRows; i++){
+		if(snap->rows[i].id == id){
+			return &snap->rows[i];
+		}
+	}
+
+	return NULL;
+}
+/**
+* Renders a single status line with the totals of the server
+*
+* Returns:
+* The number of lines rendered into the text buffer.
+**/
+static size_t renderLine(struct progressDisplay* display){
+	const struct progressSnapshot* cur = display->front;
+	const struct progressSnapshot* old = display->prev;
+	size_t len = 0;
+
+	double rate = 0.0;
+	if(old->time && cur->time > old->time && cur->bytes >= old->bytes){
+		rate = rateKibps(cur->bytes - old->bytes,cur->time - old->time);
+	}
+
+	appendText(
+		display,&len,"%u sessions  %llu bytes  %llu packets  "
+		"%.1f kib/s\n",cur->sessions,(unsigned long long)cur->bytes,
+		(unsigned long long)cur->packets,rate
+	);
+
+	return 1;
+}
+/**
+* Renders a table with the rate, loss and rtt of every session
+*
+* Returns:
+* The number of lines rendered into the text buffer.
+**/
+static size_t renderTable(struct progressDisplay* display){
+	const struct progressSnapshot* cur = display->front;
+	const struct progressSnapshot* old = display->prev;
+	size_t len = 0;
+	size_t lines = 0;
+
+	appendText(
+		display,&len,"%6s %5s %-3s %-22s %12s %10s %7s %7s\n","id",
+		"port","pro","client","bytes","kib/s","loss%","rtt ms"
+	);
+	lines += 1;
+
+	for(uint32_t i = 0; i < cur->numRows; i++){
+		const struct progressRow* r = &cur->rows[i];
+		const struct progressRow* o = findRow(old,r->id);
+
+		char addrStr[INET6_ADDRSTRLEN];
+		char lossStr[16] = "-";
+		char rttStr[16] = "-";
+		double rate = 0.0;
+
+		inet_ntop(AF_INET6,&r->addr,addrStr,sizeof(addrStr));
+
+		if(o && cur->time > old->time && r->bytes >= o->bytes){
+			rate = rateKibps(r->bytes - o->bytes,cur->time - old->time);
+		}
+		if(r->expected){
+			snprintf(
+				lossStr,sizeof(lossStr),"%.3f",
+				100.0*r->lost/r->expected
+			);
+		}
+		if(r->rtt){
+			snprintf(rttStr,sizeof(rttStr),"%.2f",r->rtt/1000.0);
+		}
+
+		appendText(
+			display,&len,"%6u %5u %-3s %-22.22s %12llu %10.1f %7s %7s\n",
+			r->id,r->port,r->tcp ? "tcp" : "udp",addrStr,
+			(unsigned long long)r->bytes,rate,lossStr,rttStr
+		);
+		lines += 1;
+	}
+
+	if(cur->sessions > cur->numRows){
+		appendText(
+			display,&len,"(%u more sessions not shown)\n",
+			cur->sessions - cur->numRows
+		);
+		lines += 1;
+	}
+
+	double rate = 0.0;
+	if(old->time && cur->time > old->time && cur->bytes >= old->bytes){
+		rate = rateKibps(cur->bytes - old->bytes,cur->time - old->time);
+	}
+
+	appendText(
+		display,&len,"total: %u sessions  %llu bytes  %llu packets  "
+		"%.1f kib/s\n",cur->sessions,(unsigned long long)cur->bytes,
+		(unsigned long long)cur->packets,rate
+	);
+	lines += 1;
+
+	return lines;
+}
+/**
+* Removes the last drawing from the terminal
+*
+* Only possible on a terminal, otherwise every drawing is simply left in the
+* output. Only called on the display thread or once it has stopped.
+**/
+static void eraseDrawing(struct progressDisplay* display){
+	if(display->tty && display->drawnLines){
+		fprintf(display->out,"\033[%uA\033[J",display->drawnLines);
+		fflush(display->out);
+	}
+
+	display->drawnLines = 0;
+}
+/**
+* Writes out and frees the reports taken from the queue
+*
+* Does nothing if pending is NULL.
+**/
+static void writePending(struct progressDisplay* display, char* pending){
+	if(!pending){
+		return;
+	}
+
+	eraseDrawing(display);
+	fputs(pending,display->out);
+	fflush(display->out);
+	free(pending);
+}
+/**
+* Draws the most recent snapshot, called periodically on the display thread
+**/
+static void refresh(void* arg){
+	struct progressDisplay* display = arg;
+
+	pthread_mutex_lock(&display->snapLock);
+
+	char* pending = display->pending;
+	display->pending = NULL;
+	display->pendingLen = 0;
+
+	bool fresh = display->fresh;
+	if(fresh){
+		struct progressSnapshot* tmp = display->prev;
+		display->prev = display->front;
+		display->front = tmp;
+
+		memcpy(display->front,display->latest,sizeof(*display->front));
+		display->fresh = false;
+	}
+
+	pthread_mutex_unlock(&display->snapLock);
+
+	writePending(display,pending);
+
+	if(!fresh){
+		return;
+	}
+
+	size_t lines;
+	if(display->mode == PROGRESS_TABLE){
+		lines = renderTable(display);
+	}
+	else{
+		lines = renderLine(display);
+	}
+
+	eraseDrawing(display);
+	fputs(display->text,display->out);
+	fflush(display->out);
+	display->drawnLines = lines;
+}
+/**
+* Starts the progress display
+*
+* Args:
+* mode - what to draw
+* refreshMs - time between redraws in ms, the receive loop should publish a
+* 	snapshot at the same rate
+*
+* Returns:
+* The running display or NULL if mode is PROGRESS_NONE or on error (an error
+* message will be printed). The other functions accept a NULL display.
+**/
+struct progressDisplay* progressDisplay_start(
+	enum progressMode mode, unsigned refreshMs
+){
+	if(mode == PROGRESS_NONE){
+		return NULL;
+	}
+
+	struct progressDisplay* display = calloc(1,sizeof(*display));
+
+	if(!display){
+		perror("Error allocating progress display");
+		return NULL;
+	}
+
+	display->mode = mode;
+	display->tty = isatty(STDOUT_FILENO);
+	display->out = stdout;
+
+	display->back = &display->buffers[0];
+	display->latest = &display->buffers[1];
+	display->front = &display->buffers[2];
+	display->prev = &display->buffers[3];
+
+	display->textSize = (PROGRESS_MAX_ROWS + 4)*PROGRESS_LINE_SIZE;
+	display->text = malloc(display->textSize);
+
+	if(!display->text){
+		perror("Error allocating progress display");
+		free(display);
+		return NULL;
+	}
+
+	pthread_mutex_init(&display->snapLock,NULL);
+	pthread_mutex_init(&display->printLock,NULL);
+
+	if(periodicTask_start(&display->task,refreshMs,refresh,display)){
+		pthread_mutex_destroy(&display->snapLock);
+		pthread_mutex_destroy(&display->printLock);
+		free(display->text);
+		free(display);
+		return NULL;
+	}
+
+	return display;
+}
+/**
+* Stops the display and removes its last drawing from the terminal
+*
+* Reports which the display thread has not written out yet are written first.
+**/
+void progressDisplay_stop(struct progressDisplay* display){
+	if(!display){
+		return;
+	}
+
+	periodicTask_stop(&display->task);
+
+	eraseDrawing(display);
+	writePending(display,display->pending);
+
+	pthread_mutex_destroy(&display->snapLock);
+	pthread_mutex_destroy(&display->printLock);
+	free(display->text);
+	free(display);
+}
+/**
+* Returns an empty snapshot for the receive loop to fill
+*
+* The snapshot belongs to the caller until progressDisplay_publish() is called.
+*
+* Returns:
+* The snapshot or NULL if display is NULL.
+**/
+struct progressSnapshot* progressDisplay_begin(
+	struct progressDisplay* display
+){
+	if(!display){
+		return NULL;
+	}
+
+	struct progressSnapshot* snap = display->back;
+
+	snap->time = 0;
+	snap->bytes = 0;
+	snap->packets = 0;
+	snap->sessions = 0;
+	snap->numRows = 0;
+
+	return snap;
+}
+/**
+* Hands the snapshot returned by progressDisplay_begin() to the display
+**/
+void progressDisplay_publish(struct progressDisplay* display){
+	if(!display){
+		return;
+	}
+
+	pthread_mutex_lock(&display->snapLock);
+
+	struct progressSnapshot* tmp = display->latest;
+	display->latest = display->back;
+	display->back = tmp;
+	display->fresh = true;
+
+	pthread_mutex_unlock(&display->snapLock);
+}
+/**
+* Starts capturing what is printed to stdout
+*
+* Used around printing anything else to stdout. The output is handed to the
+* display thread by progressDisplay_resume() so the caller never waits for the
+* terminal. A snapshot which has not been drawn yet is dropped as whatever is
+* being printed may already make it stale. If no memory stream can be opened
+* the output goes straight to the terminal.
+**/
+void progressDisplay_pause(struct progressDisplay* display){
+	if(!display){
+		return;
+	}
+
+	pthread_mutex_lock(&display->printLock);
+
+	pthread_mutex_lock(&display->snapLock);
+	display->fresh = false;
+	pthread_mutex_unlock(&display->snapLock);
+
+	display->captureBuf = NULL;
+	display->captureLen = 0;
+	display->capture = open_memstream(
+		&display->captureBuf,&display->captureLen
+	);
+	if(display->capture){
+		stdout = display->capture;
+	}
+}
+/**
+* Queues what was printed since progressDisplay_pause() for the display
+**/
+void progressDisplay_resume(struct progressDisplay* display){
+	if(!display){
+		return;
+	}
+
+	if(!display->capture){
+		fflush(stdout);
+		pthread_mutex_unlock(&display->printLock);
+		return;
+	}
+
+	stdout = display->out;
+	fclose(display->capture);
+	display->capture = NULL;
+
+	char* text = display->captureBuf;
+	size_t len = display->captureLen;
+
+	pthread_mutex_lock(&display->snapLock);
+
+	if(!display->pending){
+		display->pending = text;
+		display->pendingLen = len;
+		text = NULL;
+	}
+	else if(len){
+		char* tmp = realloc(display->pending,display->pendingLen+len+1);
+
+		if(tmp){
+			memcpy(tmp+display->pendingLen,text,len+1);
+			display->pending = tmp;
+			display->pendingLen += len;
+		}
+	}
+
+	pthread_mutex_unlock(&display->snapLock);
+
+	free(text);
+	pthread_mutex_unlock(&display->printLock);
+}
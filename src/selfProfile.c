@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Self profiling with perf_event_open() counters                               *
+*                                                                              *
+* Counts the cycles, instructions, cache misses, CPU time, context switches    *
+* and syscalls of the receive loop so that the cost of each packet can be      *
+* reported next to the throughput. A server which uses all of its CPU time is  *
+* the bottleneck of the test rather than the link.                             *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "selfProfile.h"
+#include "packetTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//the id of the tracepoint is found under either mount point of tracefs
+#define SYSCALL_TRACEPOINT_PATHS { \
+	"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id", \
+	"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id" \
+}
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+struct profEvent{
+	uint32_t type;
+	uint64_t config;
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static int openCounter(uint32_t type, uint64_t config, bool userOnly);
+static int openCounters(
+	struct selfProfile* p, const struct profEvent* events, bool userOnly,
+	int* err, int* hwErr, bool* denied
+);
+static void closeCounters(struct selfProfile* p);
+static uint64_t syscallTracepoint(void);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Opens a single counter of the calling thread on any CPU
+*
+* Args:
+* type - PERF_TYPE_* of the event
+* config - the event within type
+* userOnly - leave out what happens in the kernel
+*
+* Returns:
+* The counter fd or -1 on error with errno set.
+**/
+static int openCounter(uint32_t type, uint64_t config, bool userOnly){
+	struct perf_event_attr attr;
+
+	memset(&attr,0,sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+		PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_kernel = userOnly;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open,&attr,0,-1,-1,PERF_FLAG_FD_CLOEXEC);
+}
+/**
+* Opens every counter with the same exclusion of kernel events
+*
+* Context switches and syscalls only happen in the kernel, so they are not
+* opened when the kernel is left out.
+*
+* Args:
+* p - where the fds are stored, -1 for the counters which are not open
+* events - the event of each counter, a tracepoint without id is skipped
+* userOnly - leave out what happens in the kernel
+* err - set to the errno of the first counter which failed
+* hwErr - set to the errno of the first hardware counter which failed
+* denied - set to true if a counter other than the tracepoint was refused
+*
+* Returns:
+* The number of counters opened.
+**/
+static int openCounters(
+	struct selfProfile* p, const struct profEvent* events, bool userOnly,
+	int* err, int* hwErr, bool* denied
+){
+	int opened = 0;
+
+	*err = 0;
+	*hwErr = 0;
+	*denied = false;
+
+	for(int i = 0; i < PROF_COUNTERS; i++){
+		p->fds[i] = -1;
+
+		if(events[i].type == PERF_TYPE_TRACEPOINT && !events[i].config){
+			continue;
+		}
+		if(userOnly &&
+			(i == PROF_CONTEXT_SWITCHES || i == PROF_SYSCALLS)){
+
+			continue;
+		}
+
+		p->fds[i] = openCounter(events[i].type,events[i].config,userOnly);
+		if(p->fds[i] >= 0){
+			opened += 1;
+			continue;
+		}
+
+		if(events[i].type != PERF_TYPE_TRACEPOINT &&
+			(errno == EACCES || errno == EPERM)){
+
+			*denied = true;
+		}
+		if(!*err){
+			*err = errno;
+		}
+		if(events[i].type == PERF_TYPE_HARDWARE && !*hwErr){
+			*hwErr = errno;
+		}
+	}
+
+	return opened;
+}
+/**
+* Closes every open counter and marks it as not open
+**/
+static void closeCounters(struct selfProfile* p){
+	for(int i = 0; i < PROF_COUNTERS; i++){
+		if(p->fds[i] >= 0){
+			close(p->fds[i]);
+		}
+		p->fds[i] = -1;
+	}
+}
+/**
+* Looks up the tracepoint id of syscall entry
+*
+* Returns:
+* The id or zero if tracefs is not mounted or not readable.
+**/
+static uint64_t syscallTracepoint(void){
+	const char* paths[] = SYSCALL_TRACEPOINT_PATHS;
+
+	for(int i = 0; i < sizeof(paths)/sizeof(paths[0]); i++){
+		FILE* f = fopen(paths[i],"r");
+		unsigned long long id = 0;
+
+		if(!f){
+			continue;
+		}
+
+		if(fscanf(f,"%llu",&id) != 1){
+			id = 0;
+		}
+		fclose(f);
+
+		if(id){
+			return id;
+		}
+	}
+
+	return 0;
+}
+/**
+* Opens the counters of the calling thread
+*
+* Hardware counters are not available in many virtual machines, in which case
+* only the software counters are used. If the perf_event_paranoid setting
+* does not allow kernel events they are left out of every counter, so all of
+* them measure user space only. What is missing is printed to stdout.
+*
+* Returns:
+* The counters or NULL if none could be opened.
+**/
+struct selfProfile* selfProfile_open(void){
+	const struct profEvent events[PROF_COUNTERS] = {
+		[PROF_CYCLES] = {PERF_TYPE_HARDWARE,PERF_COUNT_HW_CPU_CYCLES},
+		[PROF_INSTRUCTIONS] =
+			{PERF_TYPE_HARDWARE,PERF_COUNT_HW_INSTRUCTIONS},
+		[PROF_CACHE_MISSES] =
+			{PERF_TYPE_HARDWARE,PERF_COUNT_HW_CACHE_MISSES},
+		[PROF_TASK_CLOCK] = {PERF_TYPE_SOFTWARE,PERF_COUNT_SW_TASK_CLOCK},
+		[PROF_CONTEXT_SWITCHES] =
+			{PERF_TYPE_SOFTWARE,PERF_COUNT_SW_CONTEXT_SWITCHES},
+		[PROF_SYSCALLS] = {PERF_TYPE_TRACEPOINT,syscallTracepoint()}
+	};
+
+	struct selfProfile* p = calloc(1,sizeof(*p));
+	int err;
+	int hwErr;
+	bool denied;
+
+	if(!p){
+		perror("Error allocating self profile");
+		return NULL;
+	}
+
+	int opened = openCounters(p,events,false,&err,&hwErr,&denied);
+
+	//mixing counters with and without the kernel would make the costs
+	//incomparable, so either all of them include it or none do
+	if(denied){
+		closeCounters(p);
+		p->userOnly = true;
+		opened = openCounters(p,events,true,&err,&hwErr,&denied);
+	}
+
+	if(!opened){
+		fprintf(stderr,"Error opening perf counters: %s\n",strerror(err));
+		free(p);
+		return NULL;
+	}
+
+	if(p->fds[PROF_CYCLES] < 0 && p->fds[PROF_INSTRUCTIONS] < 0 &&
+		p->fds[PROF_CACHE_MISSES] < 0){
+
+		printf(
+			"Hardware counters are not available (%s), profiling with "
+			"software counters only\n",strerror(hwErr)
+		);
+	}
+	if(p->userOnly){
+		printf(
+			"Kernel events are not allowed, profiling user space only "
+			"without context switches and counting the receive loop's "
+			"own syscalls\n"
+		);
+	}
+	else if(p->fds[PROF_SYSCALLS] < 0){
+		printf(
+			"The raw_syscalls tracepoint is not available, counting the "
+			"receive loop's own syscalls\n"
+		);
+	}
+
+	return p;
+}
+/**
+* Reads the current counter values
+*
+* Values are scaled up for the time a counter was not scheduled when the
+* kernel had to multiplex more counters than the CPU has.
+*
+* Args:
+* p - the counters
+* sample - filled with the values and the current time
+**/
+void selfProfile_read(
+	const struct selfProfile* p, struct selfProfileSample* sample
+){
+	sample->time = packetTrace_now();
+
+	for(int i = 0; i < PROF_COUNTERS; i++){
+		uint64_t v[3]; //value, time enabled, time running
+
+		sample->values[i] = 0;
+
+		if(p->fds[i] < 0){
+			continue;
+		}
+		if(read(p->fds[i],v,sizeof(v)) != sizeof(v) || !v[2]){
+			continue;
+		}
+
+		sample->values[i] = (v[1] == v[2]) ? v[0] :
+			(uint64_t)((double)v[0]*v[1]/v[2]);
+	}
+
+	if(p->fds[PROF_SYSCALLS] < 0){
+		sample->values[PROF_SYSCALLS] = __atomic_load_n(
+			&p->ownSyscalls,__ATOMIC_RELAXED
+		);
+	}
+}
+/**
+* Prints the cost of the packets handled between two samples
+*
+* Args:
+* p - the counters the samples were read from
+* from - the earlier sample
+* to - the later sample
+* packets - number of packets handled in between
+* unit - what a packet is called in the output, e.g. "packet" or "read"
+**/
+void selfProfile_print(
+	const struct selfProfile* p, const struct selfProfileSample* from,
+	const struct selfProfileSample* to, uint64_t packets, const char* unit
+){
+	const char* names[PROF_COUNTERS] = {
+		[PROF_CYCLES] = "cycles",
+		[PROF_INSTRUCTIONS] = "instructions",
+		[PROF_CACHE_MISSES] = "cache misses",
+		[PROF_TASK_CLOCK] = "ns of CPU time",
+		[PROF_CONTEXT_SWITCHES] = "context switches",
+		[PROF_SYSCALLS] = (p->fds[PROF_SYSCALLS] < 0) ?
+			"loop syscalls" : "syscalls"
+	};
+	uint64_t delta[PROF_COUNTERS];
+
+	for(int i = 0; i < PROF_COUNTERS; i++){
+		delta[i] = to->values[i] - from->values[i];
+	}
+
+	if(packets){
+		const char* sep = "";
+
+		printf(
+			"Server %scost per %s:",p->userOnly ? "user space " : "",unit
+		);
+		for(int i = 0; i < PROF_COUNTERS; i++){
+			if(i == PROF_CONTEXT_SWITCHES ||
+				(p->fds[i] < 0 && i != PROF_SYSCALLS)){
+
+				continue;
+			}
+			printf("%s %.2lf %s",sep,(double)delta[i]/packets,names[i]);
+			sep = ",";
+		}
+		printf("\n");
+	}
+
+	uint64_t wallNs = to->time - from->time;
+
+	printf(
+		"Server CPU time %.3lf s (%.1lf%% of %.3lf s)",
+		delta[PROF_TASK_CLOCK]/1e9,
+		wallNs ? 100.0*delta[PROF_TASK_CLOCK]/wallNs : 0.0,wallNs/1e9
+	);
+	if(p->fds[PROF_CONTEXT_SWITCHES] >= 0){
+		printf(
+			", %llu context switches",
+			(unsigned long long)delta[PROF_CONTEXT_SWITCHES]
+		);
+	}
+	printf("\n");
+}
+/**
+* Closes the counters, p may be NULL
+**/
+void selfProfile_close(struct selfProfile* p){
+	if(!p){
+		return;
+	}
+
+	closeCounters(p);
+	free(p);
+}
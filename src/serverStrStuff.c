@@ -212,3 +212,138 @@ int strToPort(in_port_t* port,const char* str){
 
 	return retVal;
 }
+/**
+* Converts a list of ports to an array of port specifications
+*
+* The list is a comma separated list of port numbers or inclusive port ranges
+* such as "3000-3015". Every element may end in "/tcp" or "/udp" to choose its
+* transport; elements without a suffix get PORT_DEFAULT.
+*
+* Returns -2 on system error (in which case errno will be set), -1 if the given
+* string is not a valid port list and zero otherwise.
+*
+* Args:
+* ports - set to a malloc'd array of the ports on success
+* count - set to the number of ports on success
+* str - string to convert
+*
+* Returns:
+* Zero on success and non-zero on error.
+**/
+int strToPortList(struct portSpec** ports, int* count, const char* str){
+
+	int len = strlen(str)+1;
+
+	char* tmpStr = malloc(len);
+	if(!tmpStr){
+		return -2;
+	}
+	memcpy(tmpStr,str,len);
+
+	struct portSpec* list = NULL;
+	int n = 0;
+	int retVal = 0;
+
+	char* save = NULL;
+	for(char* elem = strtok_r(tmpStr,",",&save); elem && !retVal;
+		elem = strtok_r(NULL,",",&save)){
+
+		enum portTransport transport = PORT_DEFAULT;
+
+		char* suffix = strchr(elem,'/');
+		if(suffix){
+			if(!strcmp(suffix,"/tcp")){
+				transport = PORT_TCP;
+			}
+			else if(!strcmp(suffix,"/udp")){
+				transport = PORT_UDP;
+			}
+			else{
+				retVal = -1;
+				break;
+			}
+			*suffix = '\0';
+		}
+
+		in_port_t first;
+		in_port_t last;
+
+		char* dash = strchr(elem,'-');
+		if(dash){
+			*dash = '\0';
+			if(strToPort(&first,elem) || strToPort(&last,dash+1)){
+				retVal = -1;
+				break;
+			}
+		}
+		else if(strToPort(&first,elem)){
+			retVal = -1;
+			break;
+		}
+		else{
+			last = first;
+		}
+
+		if(last < first || (n + last - first + 1) > MAX_PORT_LIST){
+			retVal = -1;
+			break;
+		}
+
+		struct portSpec* tmp = realloc(
+			list,(n + last - first + 1)*sizeof(*list)
+		);
+		if(!tmp){
+			retVal = -2;
+			break;
+		}
+		list = tmp;
+
+		for(unsigned p = first; p <= last; p++){
+			list[n].port = p;
+			list[n].transport = transport;
+			n += 1;
+		}
+	}
+
+	if(!n && !retVal){
+		retVal = -1;
+	}
+
+	if(retVal){
+		free(list);
+	}
+	else{
+		*ports = list;
+		*count = n;
+	}
+
+	free(tmpStr);
+
+	return retVal;
+}
+/**
+* Formats a duration in ns using a sensible unit
+*
+* Negative durations keep their sign and are scaled like positive ones.
+*
+* Args:
+* buf - buffer to write the string to
+* len - size of buf
+* ns - the duration in ns
+**/
+void fmtNs(char* buf, size_t len, double ns){
+	double mag = (ns < 0) ? -ns : ns;
+
+	if(mag < 1000.0){
+		snprintf(buf,len,"%.0lfns",ns);
+	}
+	else if(mag < 1000000.0){
+		snprintf(buf,len,"%.1lfus",ns/1000.0);
+	}
+	else if(mag < 1000000000.0){
+		snprintf(buf,len,"%.3lfms",ns/1000000.0);
+	}
+	else{
+		snprintf(buf,len,"%.3lfs",ns/1000000000.0);
+	}
+}
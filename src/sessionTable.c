@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Table of UDP client sessions keyed by source address                         *
+*                                                                              *
+* Sessions are stored in a fixed arena allocated once up front. A separate     *
+* linear probing index holding only a hash and a session number keeps lookups  *
+* within a few cache lines; the full address is only compared on a hash match. *
+* Removal uses backward shift deletion so no tombstones build up.              *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "sessionTable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static uint32_t hashAddr(const struct sockaddr_in6* addr);
+static bool sameAddr(const struct sockaddr_in6* a,const struct sockaddr_in6* b);
+static size_t arenaSize(
+	uint32_t indexSize, uint32_t maxSessions, bool shapes, bool owds
+);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Hashes the address, port and scope of a client
+*
+* Never returns zero since zero marks an empty index entry.
+**/
+static uint32_t hashAddr(const struct sockaddr_in6* addr){
+	uint64_t w[2];
+	uint64_t h;
+
+	memcpy(w,&addr->sin6_addr,sizeof(w));
+
+	h = w[0] ^ (w[1] * 0x9E3779B97F4A7C15ULL);
+	h ^= ((uint64_t)addr->sin6_port << 32) | addr->sin6_scope_id;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+
+	return ((uint32_t)h) | 1;
+}
+/**
+* Returns true if two client addresses are the same
+**/
+static bool sameAddr(const struct sockaddr_in6* a,const struct sockaddr_in6* b){
+	return a->sin6_port == b->sin6_port &&
+		a->sin6_scope_id == b->sin6_scope_id &&
+		!memcmp(&a->sin6_addr,&b->sin6_addr,sizeof(a->sin6_addr));
+}
+/**
+* Returns the number of bytes needed for a table's arena
+**/
+static size_t arenaSize(
+	uint32_t indexSize, uint32_t maxSessions, bool shapes, bool owds
+){
+	return ((size_t)indexSize)*sizeof(struct sessionIndex) +
+		((size_t)maxSessions)*sizeof(struct udpSession) +
+		(shapes ? ((size_t)maxSessions)*sizeof(struct pktShape) : 0) +
+		(owds ? ((size_t)maxSessions)*sizeof(struct owdEstimator) : 0) +
+		((size_t)maxSessions)*sizeof(uint32_t);
+}
+/**
+* Creates a session table
+*
+* All memory the table will ever use is allocated here, including the
+* optional state of every session slot, so that starting a session never
+* allocates.
+*
+* Args:
+* maxSessions - the maximum number of concurrent sessions
+* shapes - give every session packet size and burst histograms
+* owds - give every session a one-way delay estimator
+*
+* Returns:
+* The new table or NULL on error (an error message will be printed).
+**/
+struct sessionTable* sessionTable_create(
+	uint32_t maxSessions, bool shapes, bool owds
+){
+	struct sessionTable* table = calloc(1,sizeof(*table));
+	uint32_t indexSize = 16;
+
+	if(!table){
+		perror("Error allocating session table");
+		return NULL;
+	}
+
+	//keep the index at most half full so probe sequences stay short
+	while(indexSize < 2*maxSessions){
+		indexSize *= 2;
+	}
+
+	table->arena = mmap(
+		NULL,arenaSize(indexSize,maxSessions,shapes,owds),
+		PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE,-1,0
+	);
+	if(table->arena == MAP_FAILED){
+		perror("Error allocating session table");
+		free(table);
+		return NULL;
+	}
+
+	uint8_t* p = table->arena;
+
+	table->mask = indexSize-1;
+	table->index = (struct sessionIndex*)p;
+	p += ((size_t)indexSize)*sizeof(struct sessionIndex);
+
+	table->maxSessions = maxSessions;
+	table->sessions = (struct udpSession*)p;
+	p += ((size_t)maxSessions)*sizeof(struct udpSession);
+
+	if(shapes){
+		table->shapes = (struct pktShape*)p;
+		p += ((size_t)maxSessions)*sizeof(struct pktShape);
+	}
+	if(owds){
+		table->owds = (struct owdEstimator*)p;
+		p += ((size_t)maxSessions)*sizeof(struct owdEstimator);
+	}
+
+	//hand out low session numbers first
+	table->freeList = (uint32_t*)p;
+	for(uint32_t i = 0; i < maxSessions; i++){
+		table->freeList[i] = maxSessions-1-i;
+	}
+	table->freeCount = maxSessions;
+
+	return table;
+}
+/**
+* Frees a session table
+**/
+void sessionTable_destroy(struct sessionTable* table){
+	if(!table){
+		return;
+	}
+
+	munmap(
+		table->arena,
+		arenaSize(
+			table->mask+1,table->maxSessions,table->shapes != NULL,
+			table->owds != NULL
+		)
+	);
+	free(table);
+}
+/**
+* Finds the session of the given client
+*
+* Returns:
+* The session or NULL if the client has no active session.
+**/
+struct udpSession* sessionTable_find(
+	struct sessionTable* table, const struct sockaddr_in6* addr
+){
+	uint32_t hash = hashAddr(addr);
+
+	for(uint32_t i = hash & table->mask; table->index[i].hash;
+		i = (i+1) & table->mask){
+
+		if(table->index[i].hash != hash){
+			continue;
+		}
+
+		struct udpSession* s = &table->sessions[table->index[i].session];
+		if(sameAddr(&s->addr,addr)){
+			return s;
+		}
+	}
+
+	return NULL;
+}
+/**
+* Starts a new session for the given client
+*
+* The client must not already have an active session. The session is zeroed
+* apart from its address, id and active flag and points to the optional
+* state of its slot, which the caller has to initialize.
+*
+* Args:
+* table - the session table
+* addr - address of the client
+* id - identifier of the session, unique across every table of the server
+*
+* Returns:
+* The new session or NULL if the table is full.
+**/
+struct udpSession* sessionTable_insert(
+	struct sessionTable* table, const struct sockaddr_in6* addr, uint32_t id
+){
+	if(!table->freeCount){
+		return NULL;
+	}
+
+	uint32_t hash = hashAddr(addr);
+	uint32_t i = hash & table->mask;
+
+	while(table->index[i].hash){
+		i = (i+1) & table->mask;
+	}
+
+	table->freeCount -= 1;
+	uint32_t n = table->freeList[table->freeCount];
+
+	table->index[i].hash = hash;
+	table->index[i].session = n;
+
+	struct udpSession* s = &table->sessions[n];
+
+	memset(s,0,sizeof(*s));
+	s->addr = *addr;
+	s->id = id;
+	s->active = true;
+	s->shape = table->shapes ? &table->shapes[n] : NULL;
+	s->owd = table->owds ? &table->owds[n] : NULL;
+
+	return s;
+}
+/**
+* Ends a session and frees its slot
+**/
+void sessionTable_remove(
+	struct sessionTable* table, struct udpSession* session
+){
+	uint32_t n = session - table->sessions;
+	uint32_t i = hashAddr(&session->addr) & table->mask;
+
+	while(table->index[i].session != n || !table->index[i].hash){
+		i = (i+1) & table->mask;
+	}
+
+	//shift back any later entries of the probe sequence which could
+	//otherwise no longer be reached
+	uint32_t j = i;
+	while(1){
+		j = (j+1) & table->mask;
+
+		if(!table->index[j].hash){
+			break;
+		}
+
+		uint32_t home = table->index[j].hash & table->mask;
+
+		//entry j may only move into the hole at i if i lies on its
+		//probe sequence, i.e. cyclically between home and j
+		if(((j - home) & table->mask) >= ((j - i) & table->mask)){
+			table->index[i] = table->index[j];
+			i = j;
+		}
+	}
+
+	table->index[i].hash = 0;
+
+	session->active = false;
+	table->freeList[table->freeCount] = n;
+	table->freeCount += 1;
+}
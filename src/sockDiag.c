@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Socket memory diagnostics for the UDP throughput server                      *
+*                                                                              *
+* Periodically polls SO_MEMINFO and /proc/net/udp6 for the receive queue       *
+* occupancy and drop counters of a socket, and sizes receive buffers from an   *
+* expected traffic rate.                                                       *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "sockDiag.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/sock_diag.h>
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static void takeSample(void* arg);
+static void pollMemInfo(struct sockDiagSampler* sampler);
+static void pollProc(struct sockDiagSampler* sampler);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Reads the socket's memory counters with SO_MEMINFO
+**/
+static void pollMemInfo(struct sockDiagSampler* sampler){
+	uint32_t mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
+
+	memset(mem,0,sizeof(mem));
+
+	if(getsockopt(sampler->sockfd,SOL_SOCKET,SO_MEMINFO,mem,&len)){
+		return;
+	}
+
+	sampler->memInfoOk = true;
+	sampler->rcvbuf = mem[SK_MEMINFO_RCVBUF];
+	sampler->memDrops = mem[SK_MEMINFO_DROPS];
+
+	if(mem[SK_MEMINFO_RMEM_ALLOC] > sampler->peakRmem){
+		sampler->peakRmem = mem[SK_MEMINFO_RMEM_ALLOC];
+	}
+}
+/**
+* Finds the socket in /proc/net/udp6 and reads its queue and drop counters
+**/
+static void pollProc(struct sockDiagSampler* sampler){
+	char line[512];
+	FILE* f = fopen("/proc/net/udp6","r");
+
+	if(!f){
+		return;
+	}
+
+	while(fgets(line,sizeof(line),f)){
+		unsigned rxQueue;
+		unsigned long inode;
+		unsigned drops;
+
+		int n = sscanf(
+			line,"%*u: %*s %*s %*x %*x:%x %*x:%*x %*x %*u %*u %lu "
+			"%*u %*s %u",&rxQueue,&inode,&drops
+		);
+
+		if(n != 3 || inode != sampler->inode){
+			continue;
+		}
+
+		sampler->procOk = true;
+		sampler->procDrops = drops;
+		if(rxQueue > sampler->peakRxQueue){
+			sampler->peakRxQueue = rxQueue;
+		}
+		break;
+	}
+
+	fclose(f);
+}
+/**
+* Takes one sample of all diagnostics
+**/
+static void takeSample(void* arg){
+	struct sockDiagSampler* sampler = arg;
+
+	pollMemInfo(sampler);
+	pollProc(sampler);
+
+	sampler->samples += 1;
+}
+/**
+* Starts polling the diagnostics of a UDP socket
+*
+* Args:
+* sockfd - the socket to watch
+* intervalMs - time between samples in ms
+*
+* Returns:
+* The running sampler or NULL on error (an error message will be printed).
+**/
+struct sockDiagSampler* sockDiag_start(int sockfd, unsigned intervalMs){
+	struct sockDiagSampler* sampler = calloc(1,sizeof(*sampler));
+	struct stat st;
+
+	if(!sampler){
+		perror("Error allocating socket diagnostics");
+		return NULL;
+	}
+
+	sampler->sockfd = sockfd;
+	if(!fstat(sockfd,&st)){
+		sampler->inode = st.st_ino;
+	}
+
+	if(periodicTask_start(&sampler->task,intervalMs,takeSample,sampler)){
+		free(sampler);
+		return NULL;
+	}
+
+	return sampler;
+}
+/**
+* Stops polling, prints what was found and frees the sampler
+*
+* Does nothing if sampler is NULL.
+**/
+void sockDiag_stop(struct sockDiagSampler* sampler){
+	if(!sampler){
+		return;
+	}
+
+	periodicTask_stop(&sampler->task);
+	takeSample(sampler);
+
+	printf(
+		"Socket diagnostics (%llu samples):\n",
+		(unsigned long long)sampler->samples
+	);
+
+	if(sampler->memInfoOk){
+		printf(
+			"  SO_MEMINFO: peak queue %u of %u bytes (%.1f%%), "
+			"%u drops\n",sampler->peakRmem,sampler->rcvbuf,
+			sampler->rcvbuf ?
+				100.0*sampler->peakRmem/sampler->rcvbuf : 0.0,
+			sampler->memDrops
+		);
+	}
+	else{
+		printf("  SO_MEMINFO: not available\n");
+	}
+
+	if(sampler->procOk){
+		printf(
+			"  /proc/net/udp6: peak rx_queue %u bytes, %u drops\n",
+			sampler->peakRxQueue,sampler->procDrops
+		);
+	}
+	else{
+		printf("  /proc/net/udp6: socket not found\n");
+	}
+
+	free(sampler);
+}
+/**
+* Sizes the receive buffer of a socket to absorb bursts at the given rate
+*
+* Asks for RCVBUF_HEADROOM_MS worth of traffic. SO_RCVBUFFORCE is tried first
+* so root can exceed net.core.rmem_max, falling back to SO_RCVBUF. The size
+* the kernel actually granted is printed.
+*
+* Args:
+* sockfd - the socket to size
+* kibps - expected traffic rate in kib/s
+*
+* Returns:
+* Zero if the socket got at least the wanted size and non-zero otherwise.
+**/
+int sockDiag_sizeRcvbuf(int sockfd, unsigned kibps){
+	uint64_t want = ((uint64_t)kibps)*(1024/8)*RCVBUF_HEADROOM_MS/1000;
+	int size;
+	int got = 0;
+	socklen_t len = sizeof(got);
+
+	//the kernel doubles the size we set to allow for bookkeeping overhead
+	if(want > INT_MAX/2){
+		want = INT_MAX/2;
+	}
+	size = want;
+
+	if(setsockopt(sockfd,SOL_SOCKET,SO_RCVBUFFORCE,&size,sizeof(size))){
+		if(setsockopt(sockfd,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size))){
+			perror("Error setting receive buffer size");
+			return -1;
+		}
+	}
+
+	if(getsockopt(sockfd,SOL_SOCKET,SO_RCVBUF,&got,&len)){
+		perror("Error reading receive buffer size");
+		return -1;
+	}
+
+	printf(
+		"Receive buffer is %d bytes (wanted %llu for %u kib/s)\n",
+		got,(unsigned long long)want*2,kibps
+	);
+
+	if((uint64_t)got < want*2){
+		fprintf(
+			stderr,"Receive buffer was capped, raise "
+			"net.core.rmem_max or run as root\n"
+		);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Periodically samples TCP_INFO of connected sockets                           *
+*                                                                              *
+* Sampling happens on a periodic task shared by all connections so the receive *
+* loop is never delayed by it. Samples are optionally written out as csv as    *
+* they are taken and summarized once sampling stops.                           *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "tcpInfo.h"
+#include "packetTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/tcp.h>
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static void takeSample(struct tcpInfoSampler* sampler);
+static void sampleGroup(void* arg);
+static void printSummary(const struct tcpInfoSampler* sampler);
+static void writeCsv(
+	const struct tcpInfoSampler* sampler, const struct tcpInfoSample* s
+);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Reads TCP_INFO of a connected socket once
+*
+* Fields which the running kernel does not report are left as zero. The time
+* of the sample is not set.
+*
+* Args:
+* sockfd - connected TCP socket
+* s - sample to fill
+*
+* Returns:
+* Zero on success and non-zero on error.
+**/
+int tcpInfo_query(int sockfd, struct tcpInfoSample* s){
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	memset(&info,0,sizeof(info));
+
+	if(getsockopt(sockfd,IPPROTO_TCP,TCP_INFO,&info,&len)){
+		return -1;
+	}
+
+	s->rtt = info.tcpi_rtt;
+	s->rttvar = info.tcpi_rttvar;
+	s->rcvRtt = info.tcpi_rcv_rtt;
+	s->totalRetrans = info.tcpi_total_retrans;
+	s->rcvSpace = info.tcpi_rcv_space;
+	s->deliveryRate = info.tcpi_delivery_rate;
+	s->bytesReceived = info.tcpi_bytes_received;
+
+	return 0;
+}
+/**
+* Reads TCP_INFO from the socket, writes it out and adds it to the summary
+**/
+static void takeSample(struct tcpInfoSampler* sampler){
+	struct tcpInfoSample s;
+
+	if(tcpInfo_query(sampler->sockfd,&s)){
+		return;
+	}
+
+	s.time = packetTrace_now() - sampler->startNs;
+	__atomic_store_n(&sampler->rtt,s.rtt,__ATOMIC_RELAXED);
+
+	if(sampler->group->csv){
+		writeCsv(sampler,&s);
+	}
+
+	if(!sampler->count){
+		sampler->first = s;
+		sampler->rttMin = s.rtt;
+		sampler->rttMax = s.rtt;
+		sampler->spaceMin = s.rcvSpace;
+		sampler->spaceMax = s.rcvSpace;
+	}
+	sampler->last = s;
+	sampler->count += 1;
+
+	sampler->rttSum += s.rtt;
+	sampler->rttvarSum += s.rttvar;
+	if(s.rcvRtt){
+		sampler->rcvRttSum += s.rcvRtt;
+		sampler->rcvRttCount += 1;
+	}
+	if(s.rtt < sampler->rttMin){
+		sampler->rttMin = s.rtt;
+	}
+	if(s.rtt > sampler->rttMax){
+		sampler->rttMax = s.rtt;
+	}
+	if(s.rcvSpace < sampler->spaceMin){
+		sampler->spaceMin = s.rcvSpace;
+	}
+	if(s.rcvSpace > sampler->spaceMax){
+		sampler->spaceMax = s.rcvSpace;
+	}
+	if(s.deliveryRate > sampler->rateMax){
+		sampler->rateMax = s.deliveryRate;
+	}
+}
+/**
+* Takes one sample of every connection of a group
+**/
+static void sampleGroup(void* arg){
+	struct tcpInfoGroup* group = arg;
+
+	pthread_mutex_lock(&group->lock);
+	for(struct tcpInfoSampler* s = group->samplers; s; s = s->next){
+		takeSample(s);
+	}
+	pthread_mutex_unlock(&group->lock);
+}
+/**
+* Creates the csv file the samples of all connections are written to
+*
+* Returns:
+* The file or NULL on error (an error message will be printed).
+**/
+struct tcpInfoCsv* tcpInfo_openCsv(const char* path){
+	struct tcpInfoCsv* csv = calloc(1,sizeof(*csv));
+
+	if(!csv){
+		perror("Error allocating TCP_INFO csv file");
+		return NULL;
+	}
+
+	csv->f = fopen(path,"w");
+	if(!csv->f){
+		perror("Error opening TCP_INFO csv file");
+		free(csv);
+		return NULL;
+	}
+
+	pthread_mutex_init(&csv->lock,NULL);
+
+	fprintf(
+		csv->f,"session,time_s,rtt_us,rttvar_us,rcv_rtt_us,total_retrans,"
+		"rcv_space,delivery_rate,bytes_received\n"
+	);
+
+	return csv;
+}
+/**
+* Starts the thread which samples the connections of a group
+*
+* Args:
+* intervalMs - time between samples in ms
+* csv - file to write every sample to as it is taken (NULL for none)
+*
+* Returns:
+* The running group or NULL on error (an error message will be printed).
+**/
+struct tcpInfoGroup* tcpInfo_startGroup(
+	unsigned intervalMs, struct tcpInfoCsv* csv
+){
+	struct tcpInfoGroup* group = calloc(1,sizeof(*group));
+
+	if(!group){
+		perror("Error allocating TCP_INFO samplers");
+		return NULL;
+	}
+
+	group->csv = csv;
+	pthread_mutex_init(&group->lock,NULL);
+
+	if(periodicTask_start(&group->task,intervalMs,sampleGroup,group)){
+		pthread_mutex_destroy(&group->lock);
+		free(group);
+		return NULL;
+	}
+
+	return group;
+}
+/**
+* Stops the sampling thread of a group and frees it
+*
+* Every sampler of the group must have been stopped. Does nothing if group is
+* NULL.
+**/
+void tcpInfo_stopGroup(struct tcpInfoGroup* group){
+	if(!group){
+		return;
+	}
+
+	periodicTask_stop(&group->task);
+	pthread_mutex_destroy(&group->lock);
+	free(group);
+}
+/**
+* Closes the csv file once all samplers have stopped
+*
+* Does nothing if csv is NULL.
+**/
+void tcpInfo_closeCsv(struct tcpInfoCsv* csv){
+	if(!csv){
+		return;
+	}
+
+	fclose(csv->f);
+	pthread_mutex_destroy(&csv->lock);
+	free(csv);
+}
+/**
+* Starts sampling TCP_INFO of the given socket with the other connections of
+* a group
+*
+* Args:
+* group - the group whose thread takes the samples
+* sockfd - connected TCP socket to sample
+* session - session id the samples are written out with
+* summary - set true to print a summary when stopped, otherwise the sampler
+* 	only keeps the rtt up to date for the progress display
+*
+* Returns:
+* The sampler or NULL on error (an error message will be printed).
+**/
+struct tcpInfoSampler* tcpInfo_start(
+	struct tcpInfoGroup* group, int sockfd, uint32_t session, bool summary
+){
+	struct tcpInfoSampler* sampler = calloc(1,sizeof(*sampler));
+
+	if(!sampler){
+		perror("Error allocating TCP_INFO sampler");
+		return NULL;
+	}
+
+	sampler->sockfd = sockfd;
+	sampler->startNs = packetTrace_now();
+	sampler->session = session;
+	sampler->summary = summary;
+	sampler->group = group;
+
+	pthread_mutex_lock(&group->lock);
+	sampler->next = group->samplers;
+	if(sampler->next){
+		sampler->next->prev = sampler;
+	}
+	group->samplers = sampler;
+	pthread_mutex_unlock(&group->lock);
+
+	return sampler;
+}
+/**
+* Prints a summary of all samples to stdout
+**/
+static void printSummary(const struct tcpInfoSampler* sampler){
+	if(!sampler->count){
+		printf("No TCP_INFO samples were taken\n");
+		return;
+	}
+
+	const struct tcpInfoSample* first = &sampler->first;
+	const struct tcpInfoSample* last = &sampler->last;
+
+	printf("TCP_INFO summary (%zu samples):\n",sampler->count);
+	printf(
+		"  rtt min/avg/max: %.3lf/%.3lf/%.3lf ms (avg rttvar %.3lf ms)\n",
+		sampler->rttMin/1000.0,sampler->rttSum/sampler->count/1000.0,
+		sampler->rttMax/1000.0,sampler->rttvarSum/sampler->count/1000.0
+	);
+	if(sampler->rcvRttCount){
+		printf(
+			"  receiver rtt avg: %.3lf ms\n",
+			sampler->rcvRttSum/sampler->rcvRttCount/1000.0
+		);
+	}
+	printf(
+		"  retransmits: %u\n",last->totalRetrans - first->totalRetrans
+	);
+	printf(
+		"  rcv_space min/max: %u/%u bytes\n",
+		sampler->spaceMin,sampler->spaceMax
+	);
+	printf(
+		"  delivery rate last/max: %.3lf/%.3lf kib/s\n",
+		last->deliveryRate/(1024.0/8.0),sampler->rateMax/(1024.0/8.0)
+	);
+	printf(
+		"  bytes received: %llu\n",(unsigned long long)last->bytesReceived
+	);
+}
+/**
+* Appends one sample to the shared csv file
+**/
+static void writeCsv(
+	const struct tcpInfoSampler* sampler, const struct tcpInfoSample* s
+){
+	struct tcpInfoCsv* csv = sampler->group->csv;
+
+	pthread_mutex_lock(&csv->lock);
+	fprintf(
+		csv->f,"%u,%.3lf,%u,%u,%u,%u,%u,%llu,%llu\n",
+		sampler->session,s->time/1000000000.0,s->rtt,s->rttvar,s->rcvRtt,
+		s->totalRetrans,s->rcvSpace,(unsigned long long)s->deliveryRate,
+		(unsigned long long)s->bytesReceived
+	);
+	pthread_mutex_unlock(&csv->lock);
+}
+/**
+* Stops sampling, reports the results and frees the sampler
+*
+* A final sample is taken so the summary covers the whole connection. Must be
+* called before the sampled socket is closed. Does nothing if sampler is NULL.
+**/
+void tcpInfo_stop(struct tcpInfoSampler* sampler){
+	if(!sampler){
+		return;
+	}
+
+	struct tcpInfoGroup* group = sampler->group;
+
+	pthread_mutex_lock(&group->lock);
+	if(sampler->prev){
+		sampler->prev->next = sampler->next;
+	}
+	else{
+		group->samplers = sampler->next;
+	}
+	if(sampler->next){
+		sampler->next->prev = sampler->prev;
+	}
+	pthread_mutex_unlock(&group->lock);
+
+	if(sampler->summary){
+		takeSample(sampler);
+		printSummary(sampler);
+	}
+
+	free(sampler);
+}
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Alternative receive paths for TCP connections                                *
+*                                                                              *
+* Besides copying with read() the data can be spliced into /dev/null through   *
+* a pipe or mapped into user space with TCP_ZEROCOPY_RECEIVE. All of them      *
+* move up to TCP_RECV_CHUNK bytes per call so they can be compared directly.   *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "tcpRecv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static int openSplice(struct tcpReceiver* r);
+static int openZerocopy(struct tcpReceiver* r);
+static int readSplice(struct tcpReceiver* r);
+static int readZerocopy(struct tcpReceiver* r);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Creates the pipe and opens /dev/null for the splice path
+*
+* Returns:
+* Zero on success and non-zero on error.
+**/
+static int openSplice(struct tcpReceiver* r){
+	if(pipe2(r->pipe,O_CLOEXEC)){
+		r->pipe[0] = -1;
+		r->pipe[1] = -1;
+		return -1;
+	}
+
+	//a pipe holds 64 KiB by default, grow it to a whole chunk (failure
+	//only means smaller splices)
+	fcntl(r->pipe[1],F_SETPIPE_SZ,TCP_RECV_CHUNK);
+
+	r->devNull = open("/dev/null",O_WRONLY|O_CLOEXEC);
+
+	return r->devNull < 0;
+}
+/**
+* Maps the receive window of the socket for TCP_ZEROCOPY_RECEIVE
+*
+* Returns:
+* Zero on success and non-zero on error.
+**/
+static int openZerocopy(struct tcpReceiver* r){
+	r->map = mmap(NULL,TCP_RECV_CHUNK,PROT_READ,MAP_SHARED,r->fd,0);
+
+	if(r->map == MAP_FAILED){
+		r->map = NULL;
+		return -1;
+	}
+
+	r->copybufLen = sysconf(_SC_PAGESIZE) - 1;
+
+	return 0;
+}
+/**
+* Splices what is waiting on the socket into /dev/null
+*
+* Returns:
+* As read(): the number of bytes, zero at the end of the stream or negative
+* with errno set.
+**/
+static int readSplice(struct tcpReceiver* r){
+	ssize_t n = splice(
+		r->fd,NULL,r->pipe[1],NULL,TCP_RECV_CHUNK,
+		SPLICE_F_MOVE|SPLICE_F_NONBLOCK
+	);
+
+	if(n <= 0){
+		return n;
+	}
+
+	for(ssize_t left = n; left > 0;){
+		ssize_t rc = splice(
+			r->pipe[0],NULL,r->devNull,NULL,left,SPLICE_F_MOVE
+		);
+
+		if(rc <= 0){
+			perror("Error emptying splice pipe");
+			exit(-1);
+		}
+
+		left -= rc;
+	}
+
+	return n;
+}
+/**
+* Maps what is waiting on the socket with TCP_ZEROCOPY_RECEIVE
+*
+* Only whole pages of payload which are page aligned in the kernel's buffers
+* can be mapped. The kernel copies up to copybufLen bytes which can not be
+* mapped into the copy buffer, and everything when no more than that is
+* queued, so it is kept below a page. recv_skip_hint says how much more to
+* read() before mapping can continue. Mapping a range replaces the pages the
+* previous call mapped there, so nothing needs to be unmapped in between.
+*
+* Returns:
+* As read(): the number of bytes, zero at the end of the stream or negative
+* with errno set.
+**/
+static int readZerocopy(struct tcpReceiver* r){
+	struct tcp_zerocopy_receive zc;
+	socklen_t len = sizeof(zc);
+
+	memset(&zc,0,sizeof(zc));
+	zc.address = (uintptr_t)r->map;
+	zc.length = TCP_RECV_CHUNK;
+	zc.copybuf_address = (uintptr_t)r->buf;
+	zc.copybuf_len = r->copybufLen;
+
+	//on failure the read() below reports the state of the socket
+	if(getsockopt(r->fd,IPPROTO_TCP,TCP_ZEROCOPY_RECEIVE,&zc,&len)){
+		zc.length = 0;
+		zc.recv_skip_hint = 0;
+		zc.copybuf_len = 0;
+	}
+
+	//a kernel without copy buffer support leaves copybuf_len alone
+	if(len < offsetof(struct tcp_zerocopy_receive,copybuf_len) +
+		sizeof(zc.copybuf_len) || zc.copybuf_len < 0){
+
+		zc.copybuf_len = 0;
+	}
+
+	int n = zc.length + zc.copybuf_len;
+
+	r->mapped += zc.length;
+	r->copied += zc.copybuf_len;
+
+	//once nothing could be mapped copy a whole chunk rather than just up
+	//to the next mappable page
+	int want = TCP_RECV_CHUNK;
+	if(zc.length){
+		want = (zc.recv_skip_hint < want) ? zc.recv_skip_hint : want;
+	}
+
+	if(!want){
+		return n;
+	}
+
+	int rc = read(r->fd,r->buf,want);
+
+	if(rc > 0){
+		r->copied += rc;
+		return n + rc;
+	}
+
+	//the read() reports the end of the stream or EAGAIN when nothing else
+	//was received
+	return n ? n : rc;
+}
+/**
+* Sets up the receive path of a connection
+*
+* If the chosen path can not be set up an error is printed and the
+* connection falls back to copying with read().
+*
+* Args:
+* fd - the connected, non-blocking TCP socket
+* mode - receive path to use, TCP_RECV_DEFAULT is not handled here
+*
+* Returns:
+* The receiver or NULL on error (an error message will be printed).
+**/
+struct tcpReceiver* tcpRecv_open(int fd, enum tcpRecvMode mode){
+	struct tcpReceiver* r = calloc(1,sizeof(*r));
+
+	if(!r){
+		perror("Error allocating TCP receiver");
+		return NULL;
+	}
+
+	r->fd = fd;
+	r->mode = mode;
+	r->pipe[0] = -1;
+	r->pipe[1] = -1;
+	r->devNull = -1;
+
+	r->buf = malloc(TCP_RECV_CHUNK);
+	if(!r->buf){
+		perror("Error allocating TCP receiver");
+		free(r);
+		return NULL;
+	}
+
+	if(mode == TCP_RECV_SPLICE && openSplice(r)){
+		perror("Unable to set up splice, copying instead");
+		r->mode = TCP_RECV_COPY;
+	}
+
+	if(mode == TCP_RECV_ZEROCOPY && openZerocopy(r)){
+		perror("Unable to map socket for zero copy, copying instead");
+		r->mode = TCP_RECV_COPY;
+	}
+
+	return r;
+}
+/**
+* Receives what is waiting on the connection
+*
+* The data itself is not returned, only how much there was.
+*
+* Returns:
+* As read(): the number of bytes, zero at the end of the stream or negative
+* with errno set.
+**/
+int tcpRecv_read(struct tcpReceiver* r){
+	int n;
+
+	r->calls += 1;
+
+	switch(r->mode){
+	case TCP_RECV_SPLICE:
+		n = readSplice(r);
+		break;
+	case TCP_RECV_ZEROCOPY:
+		n = readZerocopy(r);
+		break;
+	default:
+		n = read(r->fd,r->buf,TCP_RECV_CHUNK);
+		if(n > 0){
+			r->copied += n;
+		}
+		break;
+	}
+
+	return n;
+}
+/**
+* Prints the statistics of the receive path and frees it
+**/
+void tcpRecv_close(struct tcpReceiver* r){
+	if(!r){
+		return;
+	}
+
+	uint64_t total = r->mapped + r->copied;
+
+	if(r->mode == TCP_RECV_ZEROCOPY){
+		printf(
+			"Zero copy receive: %llu of %llu bytes mapped (%.1f%%), "
+			"%llu calls\n",(unsigned long long)r->mapped,
+			(unsigned long long)total,
+			total ? 100.0*r->mapped/total : 0.0,
+			(unsigned long long)r->calls
+		);
+		munmap(r->map,TCP_RECV_CHUNK);
+	}
+	else{
+		printf(
+			"Received with %s in %llu calls\n",
+			(r->mode == TCP_RECV_SPLICE) ? "splice()" : "read()",
+			(unsigned long long)r->calls
+		);
+	}
+
+	if(r->pipe[0] >= 0){
+		close(r->pipe[0]);
+		close(r->pipe[1]);
+	}
+	if(r->devNull >= 0){
+		close(r->devNull);
+	}
+
+	free(r->buf);
+	free(r);
+}
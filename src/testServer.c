@@ -41,6 +41,10 @@
 #include "testServer.h"
 #include "serverStrStuff.h"
 #include "cleanExit.h"
+#include "packetTrace.h"
+#include "throughputServer.h"
+#include "serverProbes.h"
+#include "pktShape.h"
 
 #include <signal.h>
 #include <stdio.h>
@@ -51,7 +55,6 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <stdbool.h>
-#include <time.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -60,14 +63,38 @@
 
 #include <assert.h>
 /******************************************************************************
-*                                   DEFINES                                   *
+*                                     ENUMS                                   *
 ******************************************************************************/
-#define PRINT_PROGRESS_PERSTAR 64
-#define PRINT_PROGRESS_PERLINE 79
-
-#define THROUGHPUT_BUF_SIZE 2048
-
-#define UDP_REPLY_MIN_SIZE 4
+//getopt codes for options which only have a long form
+enum longOpt{
+	OPT_TRACE = 256,
+	OPT_TCPINFO,
+	OPT_TCPINFO_CSV,
+	OPT_SOCKDIAG,
+	OPT_RCVBUF_RATE,
+	OPT_GRO,
+	OPT_SESSIONS,
+	OPT_MAX_SESSIONS,
+	OPT_IDLE_TIMEOUT,
+	OPT_PROGRESS,
+	OPT_REFRESH,
+	OPT_PIPELINE,
+	OPT_TX,
+	OPT_TX_RATE,
+	OPT_TX_SIZE,
+	OPT_TX_DURATION,
+	OPT_TX_PACING,
+	OPT_BIDIR,
+	OPT_TCP_RECV,
+	OPT_CAMPAIGN,
+	OPT_CAMPAIGN_DURATION,
+	OPT_WARMUP,
+	OPT_WARMUP_PACKETS,
+	OPT_SELF_PROFILE,
+	OPT_ADAPTIVE_POLL,
+	OPT_SHAPE,
+	OPT_OWD
+};
 /******************************************************************************
 *                                     DATA                                    *
 ******************************************************************************/
@@ -81,9 +108,13 @@ static const char* HELP="Program for running a simple ipv6 server\n"
 "                 the keyword \"exit\" is read on its own line.\n"
 "-t,--throughput  Run a throughput server which measures throughput of some\n"
 "                 client which is streaming data. Closes the connection when\n"
-"                 a zero byte is read from the client.\n"
+"                 a zero byte is read from the client. SIGINT or SIGTERM\n"
+"                 stop the test early and still report the results so far.\n"
 "-d,--udp         Run server as a udp server. By default we run as tcp\n"
 "                 server. The echo server will not run in udp mode.\n"
+"                 The UDP server keeps a separate session for every client\n"
+"                 address and ends a session when it receives a packet\n"
+"                 containing 0xFFFFFFFF.\n"
 "-s,--tcp         Run server as a tcp server. This is the default. The echo\n"
 "                 server will always run as a tcp server\n"
 "-p,--pingpong    Run UDP throughput server in ping-pong mode. Causes the\n"
@@ -91,192 +122,160 @@ static const char* HELP="Program for running a simple ipv6 server\n"
 "                 recieved by the server. Does nothing if not in UDP\n"
 "                 throughput server mode. By default, replies are not sent.\n"
 "--port pnum      Run the server on the given port. By default, the OS will\n"
-"                 select an open port.\n";
-
-static const char* USAGE="[-h] [-e | -t] [-s | -d] [-p] [--port pnum]";
+"                 select an open port. The throughput server also accepts a\n"
+"                 comma separated list of ports and port ranges such as\n"
+"                 3000-3015,4000/tcp and serves them all at once. A /tcp or\n"
+"                 /udp suffix overrides the transport for that element.\n"
+"--trace=FILE     Record a fixed size binary record for every packet (or\n"
+"                 every read for TCP) received by the throughput server into\n"
+"                 FILE. The file is memory mapped so recording does not slow\n"
+"                 down the server.\n"
+"--tcpinfo=ms     Sample TCP_INFO of the connection every ms milliseconds\n"
+"                 during a TCP throughput test and print a summary (rtt,\n"
+"                 retransmits, receive window, delivery rate) at the end.\n"
+"--tcpinfo-csv=FILE\n"
+"                 Also write every TCP_INFO sample to FILE as csv, as it\n"
+"                 is taken. The first column is the session id.\n"
+"--sockdiag=ms    Poll SO_MEMINFO and /proc/net/udp6 every ms milliseconds\n"
+"                 during a UDP throughput test and report the peak socket\n"
+"                 queue use and drop counters at the end.\n"
+"--rcvbuf-rate=kibps\n"
+"                 Size the UDP receive buffer to hold 500 ms of traffic at\n"
+"                 the expected rate of kibps kib/s. Uses SO_RCVBUFFORCE when\n"
+"                 permitted so net.core.rmem_max can be exceeded.\n"
+"--gro            Enable UDP_GRO on the UDP socket so the kernel can hand\n"
+"                 over bursts of datagrams from the client in one read.\n"
+"--sessions=n     Stop the throughput server once n client sessions (UDP\n"
+"                 clients or TCP connections on any port) have ended. Zero\n"
+"                 runs until interrupted. Defaults to 1.\n"
+"--max-sessions=n\n"
+"                 Maximum number of concurrent UDP client sessions on each\n"
+"                 port. Packets from further clients are discarded.\n"
+"                 Defaults to 1024.\n"
+"--idle-timeout=s\n"
+"                 End UDP client sessions which have not sent anything for\n"
+"                 s seconds. By default sessions never time out.\n"
+"--progress=MODE  How the throughput server shows progress. MODE is none,\n"
+"                 line for a status line with the total rate or table for\n"
+"                 a table with the rate, loss and rtt of every session.\n"
+"                 Defaults to line when stdout is a terminal and none\n"
+"                 otherwise.\n"
+"--refresh=ms     Redraw the progress display every ms milliseconds.\n"
+"                 Defaults to 1000.\n"
+"--pipeline[=n]   Split the UDP throughput server into a receive thread\n"
+"                 which only reads datagrams into a ring of n slots and an\n"
+"                 analysis thread which accounts for them. n must be a\n"
+"                 power of two and defaults to 4096. Only for UDP ports.\n"
+"--tx             Run the throughput server in transmit mode: the server\n"
+"                 streams numbered packets to every client instead. TCP\n"
+"                 clients get a stream as soon as they connect and should\n"
+"                 read until the server closes its side. UDP clients send a\n"
+"                 packet starting with 0xFFFFFFFE to start the stream and\n"
+"                 acknowledge every packet with 0xFFFFFFFD followed by its\n"
+"                 sequence number, which gives the downlink loss and round\n"
+"                 trip time. The stream ends with packets of 0xFF.\n"
+"--tx-rate=kibps  Send at kibps kib/s. Zero sends as fast as possible.\n"
+"                 Defaults to 0.\n"
+"--tx-size=bytes  Size of each UDP packet or TCP write. Defaults to 64 for\n"
+"                 UDP and 65536 for TCP. At most 65527 for UDP and 16777216\n"
+"                 for TCP.\n"
+"--tx-duration=s  Send for s seconds. Defaults to 10.\n"
+"--tx-pacing=MODE How UDP packets are paced. MODE is timer to sleep on a\n"
+"                 timerfd between sendmmsg() batches or txtime to hand every\n"
+"                 packet to the kernel with its departure time (SO_TXTIME,\n"
+"                 which needs the fq or etf qdisc). Defaults to timer.\n"
+"--bidir          Run the throughput server in both directions at once.\n"
+"                 Every client's stream is received as usual while a\n"
+"                 downlink stream as with --tx is sent back to it from a\n"
+"                 separate thread. Throughput and loss are reported for\n"
+"                 each direction. Downlink acknowledgements are not\n"
+"                 counted as part of the client's stream.\n"
+"--tcp-recv=MODE  How the TCP throughput server receives data. MODE is copy\n"
+"                 to read(), splice to splice() into /dev/null through a\n"
+"                 pipe or zerocopy to map the data with\n"
+"                 TCP_ZEROCOPY_RECEIVE, copying what can not be mapped.\n"
+"                 Each moves up to 256 KiB per call so they can be\n"
+"                 compared. By default 2 KiB read()s are made.\n"
+"--campaign=n     Run a campaign of n sessions, each one measured after its\n"
+"                 warm-up, and finish with the results of every run and the\n"
+"                 mean, median, 95% confidence interval and coefficient of\n"
+"                 variation of throughput and loss across them. Sessions\n"
+"                 which end during their warm-up do not count towards n.\n"
+"                 Replaces --sessions.\n"
+"--campaign-duration=s\n"
+"                 Run a campaign for s seconds instead (or at most s\n"
+"                 seconds together with --campaign). Sessions still running\n"
+"                 when the time is up are left out.\n"
+"--warmup=ms      Leave the first ms milliseconds of every campaign session\n"
+"                 out of its run.\n"
+"--warmup-packets=n\n"
+"                 Leave the first n packets (or TCP reads) of every\n"
+"                 campaign session out of its run. With --warmup both must\n"
+"                 have passed.\n"
+"--self-profile[=ms]\n"
+"                 Count the cycles, instructions, cache misses, CPU time,\n"
+"                 context switches and syscalls of the receive loop with\n"
+"                 perf_event_open() and report their cost per packet (per\n"
+"                 read for TCP) as each session ends, every ms milliseconds\n"
+"                 if given and over the whole run. A CPU time close to 100%\n"
+"                 means the server rather than the link limits the test.\n"
+"                 Concurrent sessions share the cost of the loop. With\n"
+"                 --pipeline only the receive thread is counted.\n"
+"--adaptive-poll=pps\n"
+"                 Busy poll for packets while they arrive at pps packets\n"
+"                 per second (TCP reads per second) or more and block\n"
+"                 waiting for them once the rate has stayed below half of\n"
+"                 that for 50 ms. The time spent in each state is reported\n"
+"                 at the end. By default the server always blocks.\n"
+"--shape[=us]     Report histograms of the datagram sizes, burst lengths\n"
+"                 and idle gaps of every UDP session when it ends. Packets\n"
+"                 at most us microseconds apart belong to the same burst,\n"
+"                 longer gaps are idle gaps. Defaults to 1000 us.\n"
+"--owd            Estimate the one-way delay of UDP packets which carry\n"
+"                 their transmit time in ns (any clock, little endian)\n"
+"                 in the 8 bytes after the sequence number. The clock\n"
+"                 offset and drift are tracked from the lowest delay of\n"
+"                 every 100 ms and each session reports percentiles and\n"
+"                 the trend of the delay above that base.\n";
+
+static const char* USAGE="[-h] [-e | -t] [-s | -d] [-p] [--port pnum]\n"
+"       [--trace=FILE] [--tcpinfo=ms [--tcpinfo-csv=FILE]]\n"
+"       [--sockdiag=ms] [--rcvbuf-rate=kibps] [--gro] [--sessions=n]\n"
+"       [--max-sessions=n] [--idle-timeout=s]\n"
+"       [--progress=none|line|table] [--refresh=ms] [--pipeline[=n]]\n"
+"       [--tx [--tx-rate=kibps] [--tx-size=bytes] [--tx-duration=s]\n"
+"       [--tx-pacing=timer|txtime]] [--bidir]\n"
+"       [--tcp-recv=copy|splice|zerocopy]\n"
+"       [--campaign=n] [--campaign-duration=s] [--warmup=ms]\n"
+"       [--warmup-packets=n] [--self-profile[=ms]]\n"
+"       [--adaptive-poll=pps] [--shape[=us]] [--owd]";
 
 static const char* ARG_ERR="Try -h or --help to get help text";
 /******************************************************************************
 *                              FUNCTION PROTOTYPES                            *
 ******************************************************************************/
-static int listenAllIPv6(u_short* port,bool tcp);
+static int listenAllIPv6(u_short* port,bool tcp,bool reusePort);
 static int waitForConnectIPv6(int list_s,struct sockaddr_in6* clientInfo);
 static int echoServer(int conn_s);
-static int throughputServerTCP(int conn_s);
-static int throughputServerUDP(int sockfd,bool pingpong);
-static double calcThroughput(uint32_t n,struct timespec t0,struct timespec t1);
-static bool hasSequence(uint8_t* buf,int len,const uint8_t* seq,int seqLen);
-static void printProgress(bool done, unsigned byteCount,unsigned change);
-static uint32_t extract_packet_number(uint8_t* buf, int len,int* err);
-static int construct_reply(uint8_t* pkt,int len,uint8_t* reply);
 /******************************************************************************
 *                             FUNCTION DEFINITIONS                            *
 ******************************************************************************/
 /**
-* Prints out progress using stars to represent data packets
-*
-* Args:
-* done - set true once all input has been recieved
-* byteCount - the number of bytes recieved so far
-* change - the number of bytes which were just read in
-*
-* Returns:
-* void
-**/
-static void printProgress(bool done, unsigned byteCount,unsigned change){
-	unsigned lineMult = 1+PRINT_PROGRESS_PERSTAR*PRINT_PROGRESS_PERLINE;
-
-	if(done){
-		putchar('\n');
-		return;
-	}
-
-	if(!change){
-		return;
-	}
-
-	for(unsigned n = (byteCount+1-change); n <= byteCount; n++){
-		if(!(n%lineMult)){
-			putchar('\n');
-		}
-		if(!(n%PRINT_PROGRESS_PERSTAR)){
-			putchar('*');
-		}
-	}
-	fflush(stdout);
-}
-/**
-* Returns throughput in kib/s
-*
-* Calculates the throughput represented by the given byte count and start and
-* end times.
-*
-* Args:
-* bc - the byte count
-* t0 - the time at which byte transfer started
-* t1 - the time at which byte transfer stopped
-*
-* Returns:
-* The throughput in kib/s as a double
-**/
-static double calcThroughput(uint32_t n,struct timespec t0,struct timespec t1){
-	double kib = ((double)n)/(1024.0/8.0);
-	double secondsPassed = (double)(t1.tv_sec - t0.tv_sec);
-	double nanosPassed = (double)(t1.tv_nsec - t0.tv_nsec);
-
-
-	double throughput;
-	if( !secondsPassed && !nanosPassed){
-		throughput = 0.0;
-	}
-	else{
-		throughput = kib/(secondsPassed+(0.000000001*nanosPassed));
-	}
-
-	return throughput;
-}
-/**
-* Extracts the packet number from a packet buffer
-*
-* Args:
-* buf - buffer containing the packet
-* len - length of the packet buffer
-* err - pointer to integer; if not NULL, will be set non-zero on failure to
-* 	extract packet number (in which case 0xFFFFFFFF will be returned).
-*
-* Returns:
-* 	The number of the packet found in the buffer. On error will return
-* 	0xFFFFFFFF (but can also return this legitimatley, so *err needs to be
-* 	checked).
-**/
-static uint32_t extract_packet_number(uint8_t* buf, int len,int* err){
-	uint32_t result = 0;
-
-	if(len < 4) {
-		if(err) {
-			*err = 1;
-		}
-		return 0xFFFFFFFF;
-	}
-
-	result |= buf[0] << 0 ;
-	result |= buf[1] << 8 ;
-	result |= buf[2] << 16;
-	result |= buf[3] << 24;
-
-	return result;
-}
-/**
-* Search for a sequence of bytes within a byte buffer
-*
-* Args:
-* buf - buffer to search in
-* len - length of buffer we are searching in
-* seq - sequence of bytes we are searching for.
-* seqLen - length of sequence of bytes to search for.
-*
-* Returns:
-* True if the sub sequence is found within the buffer and false otherwise
-**/
-static bool hasSequence(uint8_t* buf,int len,const uint8_t* seq,int seqLen){
-	for(int i = len-seqLen; i>=0; i--){
-
-		for(int n = 0; n < seqLen; n++){
-			if(buf[i+n] != seq[n]){
-				break;
-			}
-			else if(n == (seqLen-1)){
-				return true;
-			}
-		}
-	}
-
-	return false;
-}
-/**
-* Constructs reply for the given packet
-*
-* Fills the reply buffer with the reply to be sent in response to the given
-* packet. The size of the reply packet in bytes is returned (zero returned on
-* error).
-*
-* Args:
-* pkt - the packet to reply to
-* len - length of the given packet
-* reply - space in which to construct the reply packet. Must be at least
-* 	UDP_REPLY_MIN_SIZE bytes long.
-*
-* Returns:
-* zero on error and the size of the reply packet on success.
-**/
-static int construct_reply(uint8_t* pkt,int len,uint8_t* reply){
-	int err = 0;
-	uint32_t seqno = extract_packet_number(pkt,len,&err);
-
-	if(err) {
-		return 0;
-	}
-
-	reply[0] = (seqno >> 0 )&0xFF;
-	reply[1] = (seqno >> 8 )&0xFF;
-	reply[2] = (seqno >> 16)&0xFF;
-	reply[3] = (seqno >> 24)&0xFF;
-
-	return 4;
-}
-/**
 * Create an IPV6 listening socket which listens on all interfaces
 *
-* Will call exit on fatal error.
+* Will call exit on fatal error. UDP sockets have SO_RXQ_OVFL enabled so the
+* number of datagrams dropped from the receive queue can be tracked.
 *
 * Args:
 * port - the port number to listen on (set zero to have the OS choose).
 * tcp - set true to open tcp connection and false for udp connection
+* reusePort - set true to let the throughput server bind a socket for
+* 	sending downlink streams to the same port (SO_REUSEPORT)
 *
 * Returns:
 * The listening socket
 **/
-static int listenAllIPv6(u_short* port, bool tcp){
+static int listenAllIPv6(u_short* port, bool tcp, bool reusePort){
 	int list_s;
 	int ret;
 
@@ -294,6 +293,14 @@ static int listenAllIPv6(u_short* port, bool tcp){
 	 	 exit(EXIT_FAILURE);
 	}
 
+	if(reusePort){
+	 	 int on = 1;
+	 	 if(setsockopt(list_s,SOL_SOCKET,SO_REUSEPORT,&on,sizeof(on))){
+	 	 	 perror("Error enabling SO_REUSEPORT");
+	 	 	 exit(-1);
+	 	 }
+	}
+
 	memset(&servaddr, 0, sizeof(servaddr));
 	servaddr.sin6_family = AF_INET6;
 	servaddr.sin6_addr = in6addr_any;
@@ -314,6 +321,12 @@ static int listenAllIPv6(u_short* port, bool tcp){
 	 	 	 exit(EXIT_FAILURE);
 	 	 }
 	 }
+	 else{
+	 	 int on = 1;
+	 	 if(setsockopt(list_s,SOL_SOCKET,SO_RXQ_OVFL,&on,sizeof(on))){
+	 	 	 perror("Unable to enable SO_RXQ_OVFL");
+	 	 }
+	 }
 
 	 struct sockaddr_in6 realAddr;
 	 socklen_t len = sizeof(realAddr);
@@ -395,6 +408,12 @@ static int echoServer(int conn_s){
 	 	 	exit(-1);
 	 	 }
 
+	 	 if(SERVER_PROBE_ENABLED(echo_receive)){
+	 	 	 SERVER_PROBE3(
+	 	 	 	 echo_receive,conn_s,bytesRead,packetTrace_now()
+	 	 	 );
+	 	 }
+
 	 	 if(bytesRead == 0){
 	 	 	 printf("Connection closed by client\n");
 	 	 	 break;
@@ -406,6 +425,11 @@ static int echoServer(int conn_s){
 	 	 	 fprintf(stderr, "Error reading from socket!\n");
 	 	 	 exit(-1);
 	 	 }
+	 	 if(SERVER_PROBE_ENABLED(echo_reply)){
+	 	 	 SERVER_PROBE3(
+	 	 	 	 echo_reply,conn_s,bytesRead,packetTrace_now()
+	 	 	 );
+	 	 }
 
 	 	 stripInPlace(buffer,bytesRead+1);
 	 	 printf("Echo Server: %s\n",buffer);
@@ -419,163 +443,6 @@ static int echoServer(int conn_s){
 	 return 0;
 }
 /**
-* Measures throughput from a given socket.
-*
-* Results are printed to stdout.
-*
-* Args:
-* sockfd - the socket to read from
-*
-* Returns:
-* zero
-**/
-static int throughputServerTCP(int sockfd){
-
-	uint8_t byte;
-	uint32_t bytesRead = 0;
-
-	struct timespec t0;
-	struct timespec t1;
-
-	int rc = read(sockfd,&byte,1);
-
-	//take first time measurement just after the first byte arrives
-	if (clock_gettime(CLOCK_MONOTONIC,&t0)){
-		perror("Error reading monotonic clock!");
-		exit(-1);
-	}
-
-	while ( 1 ) {
-
-		if(rc == 1){
-			bytesRead += 1;
-			printProgress(false,bytesRead,1);
-		}
-		else if(rc < 0){
-			perror("Error reading from socket!\n");
-	 	 	exit(-1);
-		}
-		else if (rc == 0){
-			break;
-		}
-
-		rc = read(sockfd,&byte,1);
-	}
-
-	if (clock_gettime(CLOCK_MONOTONIC,&t1)){
-		perror("Error reading monotonic clock!");
-		exit(-1);
-	}
-
-	printProgress(true,bytesRead,0);
-
-
-	double throughput = calcThroughput(bytesRead,t0,t1);
-
-	printf("Recieved %u bytes in total\n",bytesRead);
-	printf("Throughput was ~ %lf kib/s\n",throughput);
-
-	return 0;
-}
-/**
-* Implements a UDP throughput measurement server
-*
-* Connects with the first client who sends packets to this server. Outputs
-* results to stdout.
-*
-* Args:
-* sockfd - the socket to operate on
-* pingpong - if set true, send reply packets to sender
-*
-* Returns:
-* Zero
-**/
-static int throughputServerUDP(int sockfd, bool pingpong){
-
-	const uint8_t stopSeq[] = {0xFF,0xFF,0xFF,0xFF};
-
-	struct sockaddr_in6 clientAddr;
-	socklen_t addrlen = sizeof(clientAddr);
-
-	uint8_t buffer[THROUGHPUT_BUF_SIZE];
-	uint8_t reply[UDP_REPLY_MIN_SIZE];
-
-	struct timespec t0;
-	struct timespec t1;
-
-	uint32_t bytesRead = 0;
-
-	int rc = recvfrom(
-			sockfd,buffer,THROUGHPUT_BUF_SIZE,MSG_TRUNC,
-			&clientAddr,&addrlen
-		);
-
-	if(rc < 0){
-		perror("Error reading from socket!\n");
-		exit(-1);
-	}
-
-	bytesRead += rc;
-
-	//take first time measurement just after the first byte arrives
-	if (clock_gettime(CLOCK_MONOTONIC,&t0)){
-		perror("Error reading monotonic clock!");
-		exit(-1);
-	}
-
-	char* addrStr = getStrAddrIPv6(&clientAddr);
-	printf("Incoming connection from: %s\n",addrStr);
-	free(addrStr);
-
-	if(connect(sockfd,&clientAddr,sizeof(clientAddr))){
-		perror("Error connecting socket!\n");
-		exit(-1);
-	}
-
-	while ( 1 ) {
-		printProgress(false,bytesRead,rc);
-
-		if(pingpong && rc) {
-			int reply_len = construct_reply(buffer,rc,reply);
-
-			if(!reply_len){
-				fprintf(stderr,"Malformed packet!\n");
-			} else if(write(sockfd,reply,reply_len) != reply_len) {
-				perror("Error writing to socket\n");
-				exit(-1);
-			}
-		}
-		if(hasSequence(buffer,rc,stopSeq,sizeof(stopSeq))){
-			break;
-		}
-
-		rc = read(sockfd,&buffer,THROUGHPUT_BUF_SIZE);
-
-		if(rc < 0){
-			perror("Error reading from socket!\n");
-	 	 	exit(-1);
-		} else if (rc == 0){
-			break;
-		}
-
-		bytesRead += rc;
-	}
-
-	if (clock_gettime(CLOCK_MONOTONIC,&t1)){
-		perror("Error reading monotonic clock!");
-		exit(-1);
-	}
-
-	printProgress(true,bytesRead,0);
-
-	double throughput = calcThroughput(bytesRead,t0,t1);
-
-	printf("Recieved %u bytes in total\n",bytesRead);
-	printf("Throughput was ~ %lf kib/s\n",throughput);
-
-	return 0;
-}
-/**
 * Parses command line options
 *
 * Args:
@@ -587,13 +454,41 @@ static int throughputServerUDP(int sockfd, bool pingpong){
 **/
 struct serverOpts getServerOpts(int argc, char** argv){
 	enum serverMode mode = DEFAULT_SERVER_MODE;
-	in_port_t port = DEFAULT_PORT_NUM;
+	struct portSpec* ports = NULL;
+	int numPorts = 0;
 	bool tcp = true;
 	bool pingpong = false;
+	const char* tracePath = NULL;
+	unsigned tcpInfoMs = 0;
+	const char* tcpInfoCsv = NULL;
+	unsigned sockDiagMs = 0;
+	unsigned rcvbufRate = 0;
+	bool gro = false;
+	unsigned sessions = DEFAULT_SESSIONS;
+	unsigned maxSessions = DEFAULT_MAX_SESSIONS;
+	unsigned idleTimeout = 0;
+	enum progressMode progress =
+		isatty(STDOUT_FILENO) ? PROGRESS_LINE : PROGRESS_NONE;
+	unsigned refreshMs = DEFAULT_REFRESH_MS;
+	unsigned pipelineSlots = 0;
+	bool tx = false;
+	bool bidir = false;
+	enum tcpRecvMode tcpRecv = TCP_RECV_DEFAULT;
+	unsigned campaignRuns = 0;
+	unsigned campaignDuration = 0;
+	unsigned warmupMs = 0;
+	unsigned warmupPackets = 0;
+	bool selfProfile = false;
+	unsigned profileMs = 0;
+	unsigned adaptivePps = 0;
+	unsigned shapeGapUs = 0;
+	bool owd = false;
+	struct txConfig txConfig = {0,0,TX_DEFAULT_DURATION,false};
 
 	bool gotMode = false;
 	bool gotPort = false;
 	bool gotTransport = false;
+	bool gotSessions = false;
 
 	int lopt_ind = 0;
 	int c;
@@ -607,10 +502,38 @@ struct serverOpts getServerOpts(int argc, char** argv){
 		{"udp",0,NULL,'d'},
 		{"pingpong",0,NULL,'p'},
 		{"port",1,NULL,'r'},
+		{"trace",1,NULL,OPT_TRACE},
+		{"tcpinfo",1,NULL,OPT_TCPINFO},
+		{"tcpinfo-csv",1,NULL,OPT_TCPINFO_CSV},
+		{"sockdiag",1,NULL,OPT_SOCKDIAG},
+		{"rcvbuf-rate",1,NULL,OPT_RCVBUF_RATE},
+		{"gro",0,NULL,OPT_GRO},
+		{"sessions",1,NULL,OPT_SESSIONS},
+		{"max-sessions",1,NULL,OPT_MAX_SESSIONS},
+		{"idle-timeout",1,NULL,OPT_IDLE_TIMEOUT},
+		{"progress",1,NULL,OPT_PROGRESS},
+		{"refresh",1,NULL,OPT_REFRESH},
+		{"pipeline",2,NULL,OPT_PIPELINE},
+		{"tx",0,NULL,OPT_TX},
+		{"tx-rate",1,NULL,OPT_TX_RATE},
+		{"tx-size",1,NULL,OPT_TX_SIZE},
+		{"tx-duration",1,NULL,OPT_TX_DURATION},
+		{"tx-pacing",1,NULL,OPT_TX_PACING},
+		{"bidir",0,NULL,OPT_BIDIR},
+		{"tcp-recv",1,NULL,OPT_TCP_RECV},
+		{"campaign",1,NULL,OPT_CAMPAIGN},
+		{"campaign-duration",1,NULL,OPT_CAMPAIGN_DURATION},
+		{"warmup",1,NULL,OPT_WARMUP},
+		{"warmup-packets",1,NULL,OPT_WARMUP_PACKETS},
+		{"self-profile",2,NULL,OPT_SELF_PROFILE},
+		{"adaptive-poll",1,NULL,OPT_ADAPTIVE_POLL},
+		{"shape",2,NULL,OPT_SHAPE},
+		{"owd",0,NULL,OPT_OWD},
 		{NULL, 0, NULL, 0}
 	};
 
 	while( (c = getopt_long(argc, argv,shopts,lopts,&lopt_ind)) != -1 ){
+		char* endptr;
 
 		switch(c){
 		case 'h':
@@ -650,10 +573,10 @@ struct serverOpts getServerOpts(int argc, char** argv){
 				exit(-1);
 			}
 			gotPort = true;
-			 if(!!strToPort(&port,optarg)){
+			 if(!!strToPortList(&ports,&numPorts,optarg)){
 			 	fprintf(
 			 		stderr,
-					"\"%s\" is not a valid port number!\n",
+					"\"%s\" is not a valid port list!\n",
 					optarg
 				);
 				exit(-1);
@@ -662,13 +585,292 @@ struct serverOpts getServerOpts(int argc, char** argv){
 		case 'p':
 			pingpong = true;
 			break;
+		case OPT_TRACE:
+			tracePath = optarg;
+			break;
+		case OPT_TCPINFO:
+			tcpInfoMs = strtoul(optarg,&endptr,10);
+			if(*endptr || !tcpInfoMs){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid sample interval!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_TCPINFO_CSV:
+			tcpInfoCsv = optarg;
+			break;
+		case OPT_SOCKDIAG:
+			sockDiagMs = strtoul(optarg,&endptr,10);
+			if(*endptr || !sockDiagMs){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid poll interval!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_GRO:
+			gro = true;
+			break;
+		case OPT_SESSIONS:
+			gotSessions = true;
+			sessions = strtoul(optarg,&endptr,10);
+			if(*endptr){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid session count!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_MAX_SESSIONS:
+			maxSessions = strtoul(optarg,&endptr,10);
+			if(*endptr || !maxSessions || maxSessions > (1<<24)){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid session count!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_IDLE_TIMEOUT:
+			idleTimeout = strtoul(optarg,&endptr,10);
+			if(*endptr){
+				fprintf(
+					stderr,"\"%s\" is not a valid timeout!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_PROGRESS:
+			if(!strcmp(optarg,"none")){
+				progress = PROGRESS_NONE;
+			}
+			else if(!strcmp(optarg,"line")){
+				progress = PROGRESS_LINE;
+			}
+			else if(!strcmp(optarg,"table")){
+				progress = PROGRESS_TABLE;
+			}
+			else{
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid progress mode!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_REFRESH:
+			refreshMs = strtoul(optarg,&endptr,10);
+			if(*endptr || !refreshMs){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid refresh interval!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_PIPELINE:
+			pipelineSlots = DEFAULT_PIPELINE_SLOTS;
+			if(!optarg){
+				break;
+			}
+			pipelineSlots = strtoul(optarg,&endptr,10);
+			if(*endptr || pipelineSlots < 2 ||
+				pipelineSlots > (1<<20) ||
+				(pipelineSlots & (pipelineSlots-1))){
+
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid ring size!\n",optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_SELF_PROFILE:
+			selfProfile = true;
+			if(!optarg){
+				break;
+			}
+			profileMs = strtoul(optarg,&endptr,10);
+			if(*endptr || !profileMs){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid interval!\n",optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_ADAPTIVE_POLL:
+			adaptivePps = strtoul(optarg,&endptr,10);
+			if(*endptr || !adaptivePps){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid packet rate!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_SHAPE:
+			shapeGapUs = SHAPE_DEFAULT_GAP_US;
+			if(!optarg){
+				break;
+			}
+			shapeGapUs = strtoul(optarg,&endptr,10);
+			if(*endptr || !shapeGapUs){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid burst gap!\n",optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_OWD:
+			owd = true;
+			break;
+		case OPT_TX:
+			tx = true;
+			break;
+		case OPT_BIDIR:
+			tx = true;
+			bidir = true;
+			break;
+		case OPT_CAMPAIGN:
+			campaignRuns = strtoul(optarg,&endptr,10);
+			if(*endptr || !campaignRuns){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid run count!\n",optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_CAMPAIGN_DURATION:
+			campaignDuration = strtoul(optarg,&endptr,10);
+			if(*endptr || !campaignDuration){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid duration!\n",optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_WARMUP:
+			warmupMs = strtoul(optarg,&endptr,10);
+			if(*endptr){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid warm-up time!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_WARMUP_PACKETS:
+			warmupPackets = strtoul(optarg,&endptr,10);
+			if(*endptr){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid packet count!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_TCP_RECV:
+			if(!strcmp(optarg,"copy")){
+				tcpRecv = TCP_RECV_COPY;
+			}
+			else if(!strcmp(optarg,"splice")){
+				tcpRecv = TCP_RECV_SPLICE;
+			}
+			else if(!strcmp(optarg,"zerocopy")){
+				tcpRecv = TCP_RECV_ZEROCOPY;
+			}
+			else{
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid receive mode!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_TX_RATE:
+			txConfig.rateKibps = strtoul(optarg,&endptr,10);
+			if(*endptr || txConfig.rateKibps > (1<<24)){
+				fprintf(
+					stderr,"\"%s\" is not a valid rate!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_TX_SIZE:
+			txConfig.size = strtoul(optarg,&endptr,10);
+			if(*endptr || txConfig.size < 4 ||
+				txConfig.size > TX_TCP_MAX_SIZE){
+
+				fprintf(
+					stderr,"\"%s\" is not a valid size!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_TX_DURATION:
+			txConfig.durationS = strtoul(optarg,&endptr,10);
+			if(*endptr || !txConfig.durationS){
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid duration!\n",optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_TX_PACING:
+			if(!strcmp(optarg,"timer")){
+				txConfig.txtime = false;
+			}
+			else if(!strcmp(optarg,"txtime")){
+				txConfig.txtime = true;
+			}
+			else{
+				fprintf(
+					stderr,
+					"\"%s\" is not a valid pacing mode!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
+		case OPT_RCVBUF_RATE:
+			rcvbufRate = strtoul(optarg,&endptr,10);
+			if(*endptr || !rcvbufRate){
+				fprintf(
+					stderr,"\"%s\" is not a valid rate!\n",
+					optarg
+				);
+				exit(-1);
+			}
+			break;
 		case '?':
 			printf("%s %s\n",argv[0],USAGE);
 			printf("%s\n",ARG_ERR);
 			exit(-1);
 			break;
 		default:
-			printf("Got unexpected char '%c' from getopt!\n",c);
+			printf("Got unexpected code %d from getopt!\n",c);
 			exit(-1);
 		}
 	}
@@ -682,7 +884,86 @@ struct serverOpts getServerOpts(int argc, char** argv){
 		exit(-1);
 	}
 
-	struct serverOpts ret = {mode,port,tcp,pingpong};
+	if(tcpInfoCsv && !tcpInfoMs){
+		fprintf(stderr,"--tcpinfo-csv requires --tcpinfo!\n");
+		exit(-1);
+	}
+
+	if((warmupMs || warmupPackets) && !campaignRuns && !campaignDuration){
+		fprintf(
+			stderr,"--warmup and --warmup-packets require "
+			"--campaign or --campaign-duration!\n"
+		);
+		exit(-1);
+	}
+
+	if(campaignRuns && gotSessions){
+		fprintf(stderr,"--campaign replaces --sessions!\n");
+		exit(-1);
+	}
+
+	//a campaign ends after its runs, or when its time is up
+	if(campaignRuns){
+		sessions = campaignRuns;
+	}
+	else if(campaignDuration && !gotSessions){
+		sessions = 0;
+	}
+
+	if(!gotPort){
+		ports = malloc(sizeof(*ports));
+		if(!ports){
+			perror("Error allocating port list");
+			exit(-1);
+		}
+		ports[0].port = DEFAULT_PORT_NUM;
+		ports[0].transport = PORT_DEFAULT;
+		numPorts = 1;
+	}
+
+	for(int i = 0; i < numPorts && pipelineSlots; i++){
+		if(ports[i].transport == PORT_TCP ||
+			(ports[i].transport == PORT_DEFAULT && tcp)){
+
+			fprintf(stderr,"--pipeline only works with UDP ports!\n");
+			exit(-1);
+		}
+	}
+
+	//the size is checked against the transport of every port once the
+	//ports are known
+	for(int i = 0; i < numPorts && txConfig.size > TX_UDP_MAX_SIZE; i++){
+		if(ports[i].transport == PORT_UDP ||
+			(ports[i].transport == PORT_DEFAULT && !tcp)){
+
+			fprintf(
+				stderr,"--tx-size can be at most %d for UDP ports!\n",
+				TX_UDP_MAX_SIZE
+			);
+			exit(-1);
+		}
+	}
+
+	if(tx && pipelineSlots){
+		fprintf(
+			stderr,"--tx and --bidir can not be used with "
+			"--pipeline!\n"
+		);
+		exit(-1);
+	}
+
+	if(mode == ECHO_SERVER && numPorts > 1){
+		fprintf(stderr,"The echo server only runs on one port!\n");
+		exit(-1);
+	}
+
+	struct serverOpts ret = {
+		mode,ports,numPorts,tcp,pingpong,tracePath,tcpInfoMs,tcpInfoCsv,
+		sockDiagMs,rcvbufRate,gro,sessions,maxSessions,idleTimeout,
+		progress,refreshMs,pipelineSlots,tx,bidir,txConfig,
+		tcpRecv,campaignRuns,campaignDuration,warmupMs,warmupPackets,
+		selfProfile,profileMs,adaptivePps,shapeGapUs,owd
+	};
 	return ret;
 }
 
@@ -699,11 +980,20 @@ struct serverOpts getServerOpts(int argc, char** argv){
 int main(int argc, char** argv){
 
 	struct serverOpts opts = getServerOpts(argc,argv);
+	struct packetTrace* trace = NULL;
 
-	 u_short port = opts.port;
+	if(opts.tracePath && opts.mode == THROUGHPUT_SERVER){
+		trace = packetTrace_open(opts.tracePath);
+		if(!trace){
+			fprintf(stderr,"Unable to create trace file!\n");
+			exit(-1);
+		}
+	}
+
+	 u_short port = opts.ports[0].port;
 
 	 if(opts.mode == ECHO_SERVER){
-	 	 int list_s = listenAllIPv6(&port,true);
+	 	 int list_s = listenAllIPv6(&port,true,false);
 
 	 	 printf("Creating echo server on port %d\n",port);
 
@@ -734,58 +1024,68 @@ int main(int argc, char** argv){
 	 	 	 exit(EXIT_FAILURE);
 	 	 }
 	 }
-	 else if(opts.mode == THROUGHPUT_SERVER && opts.tcp){
-	 	 int list_s = listenAllIPv6(&port,true);
-	 	 printf("Creating throughput server on port %d\n",port);
-
-	 	 struct sockaddr_in6 clientInfo;
-	 	 int conn_s = waitForConnectIPv6(list_s,&clientInfo);
-
-	 	 char* addrStr = getStrAddrIPv6(&clientInfo);
-	 	 printf("Incoming connection from: %s\n",addrStr);
-	 	 free(addrStr);
-
-	 	 cleanExit_add_fd(list_s);
-	 	 cleanExit_add_fd(conn_s);
-	 	 cleanExit_add_signal(SIGINT);
-
-	 	 throughputServerTCP(conn_s);
-
-	 	 cleanExit_stop();
-
-	 	 /*  Close the connected socket  */
-	 	 if ( close(conn_s) < 0 ) {
-	 	 	 fprintf(stderr, "ECHOSERV: Error calling close()\n");
-	 	 	 exit(EXIT_FAILURE);
+	 else if(opts.mode == THROUGHPUT_SERVER){
+	 	 //SIGINT and SIGTERM end the test through the event loop so
+	 	 //the results so far are still reported
+	 	 int sigfd = cleanExit_signalfd();
+
+	 	 struct portListener* ports = calloc(
+	 	 	 opts.numPorts,sizeof(*ports)
+	 	 );
+	 	 if(!ports){
+	 	 	 perror("Error allocating listeners");
+	 	 	 exit(-1);
 	 	 }
 
-	 	 /*  Close the listening socket  */
-	 	 if ( close(list_s) < 0 ) {
-	 	 	 fprintf(stderr, "ECHOSERV: Error calling close()\n");
-	 	 	 exit(EXIT_FAILURE);
+	 	 bool anyUdp = false;
+
+	 	 for(int i = 0; i < opts.numPorts; i++){
+	 	 	 const struct portSpec* spec = &opts.ports[i];
+	 	 	 struct portListener* l = &ports[i];
+
+	 	 	 l->tcp = (spec->transport == PORT_DEFAULT) ?
+	 	 	 	 opts.tcp : (spec->transport == PORT_TCP);
+	 	 	 l->port = spec->port;
+	 	 	 l->fd = listenAllIPv6(
+	 	 	 	 &l->port,l->tcp,!l->tcp && opts.txConfig.txtime &&
+	 	 	 	 (opts.tx || opts.bidir)
+	 	 	 );
+
+	 	 	 if(l->tcp){
+	 	 	 	 printf(
+	 	 	 	 	 "Creating throughput server on port %d\n",
+	 	 	 	 	 l->port
+	 	 	 	 );
+	 	 	 }
+	 	 	 else{
+	 	 	 	 printf(
+	 	 	 	 	 "Creating UDP throughput server on port "
+	 	 	 	 	 "%d\n",l->port
+	 	 	 	 );
+	 	 	 	 anyUdp = true;
+	 	 	 }
 	 	 }
-	 }
-	 else if(opts.mode == THROUGHPUT_SERVER && !opts.tcp){
-	 	  int list_s = listenAllIPv6(&port,false);
-	 	  printf("Creating UDP throughput server on port %d\n",port);
-
-	 	 cleanExit_add_fd(list_s);
-	 	 cleanExit_add_signal(SIGINT);
-
-	 	  throughputServerUDP(list_s,opts.pingpong);
 
-	 	  cleanExit_stop();
+	 	 throughputServer_run(ports,opts.numPorts,&opts,trace,sigfd);
 
-	 	  //wait a bit just in case some packet retries are still
-	 	  //arriving
-	 	  sleep(1);
+	 	 //wait a bit just in case some packet retries are still
+	 	 //arriving
+	 	 if(anyUdp){
+	 	 	 sleep(1);
+	 	 }
 
-	 	  if ( close(list_s) < 0 ) {
-	 	 	 fprintf(stderr, "ECHOSERV: Error calling close()\n");
-	 	 	 exit(EXIT_FAILURE);
+	 	 for(int i = 0; i < opts.numPorts; i++){
+	 	 	 if ( close(ports[i].fd) < 0 ) {
+	 	 	 	 fprintf(stderr, "ECHOSERV: Error calling close()\n");
+	 	 	 	 exit(EXIT_FAILURE);
+	 	 	 }
 	 	 }
+
+	 	 close(sigfd);
+	 	 free(ports);
 	 }
 
+	 packetTrace_close(trace);
 
 	 return 0;
 }
@@ -0,0 +1,2215 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Throughput measurement servers                                               *
+*                                                                              *
+* Any number of UDP and TCP listening sockets are served from a single epoll   *
+* loop. UDP clients are told apart by source address through a session table   *
+* per port while every accepted TCP connection is its own session.             *
+*                                                                              *
+* In transmit mode the roles are swapped: every session streams numbered       *
+* packets to its client from a txStream thread while the loop only collects    *
+* the client's acknowledgements. In bidirectional mode the loop also receives  *
+* the client's own stream, so each direction has a thread of its own.          *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "throughputServer.h"
+#include "seqStats.h"
+#include "tcpInfo.h"
+#include "progressDisplay.h"
+#include "spscRing.h"
+#include "txStream.h"
+#include "tcpRecv.h"
+#include "campaign.h"
+#include "serverProbes.h"
+#include "selfProfile.h"
+#include "adaptivePoll.h"
+#include "pktShape.h"
+#include "owdEstimator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <linux/filter.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+#define THROUGHPUT_BUF_SIZE 2048
+
+#define UDP_REPLY_MIN_SIZE 4
+
+//large enough for the biggest datagram UDP_GRO can coalesce
+#define UDP_GRO_BUF_SIZE 65536
+
+//how often UDP sessions are checked for idle timeouts
+#define SESSION_SWEEP_MS 100
+
+//maximum number of events handled per epoll_wait() call
+#define EVENT_BATCH 64
+
+//maximum number of reads from one socket before serving the others
+#define READ_BUDGET 64
+
+//maximum number of reads from one socket while draining at shutdown
+#define DRAIN_BUDGET 65536
+
+//the analysis thread of the pipeline polls this many times before it starts
+//sleeping for PIPELINE_IDLE_NS between polls of an empty ring
+#define PIPELINE_IDLE_SPINS 1024
+#define PIPELINE_IDLE_NS 50000
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* An accepted TCP connection
+**/
+struct tcpSession{
+	enum sourceType type;
+
+	int fd;
+	struct portListener* port;
+	uint32_t id;
+	struct sockaddr_in6 addr;
+
+	uint64_t firstNs;
+	uint64_t lastNs;
+	uint64_t bytes;
+	uint32_t readCount;
+
+	struct tcpInfoSampler* sampler;
+	struct tcpReceiver* rx;
+	struct txStream* tx;
+	uint64_t maxGapNs;
+
+	struct campaignMark mark;
+	struct selfProfileSample profStart;
+
+	struct tcpSession* prev;
+	struct tcpSession* next;
+};
+
+/**
+* A datagram received by the receive thread of the pipeline
+**/
+struct pipeSlot{
+	struct portListener* port;
+	uint64_t timestamp;
+	struct sockaddr_in6 addr;
+	int len;
+	int segSize;
+	uint32_t drops;
+	uint8_t* data;
+};
+
+/**
+* Receive/analysis pipeline
+*
+* The receive thread only reads datagrams into preallocated slots and pushes
+* them onto the ring. The analysis thread owns every UDP session and does all
+* of the per packet work. When the ring is full the receive thread waits for
+* the analysis thread so the excess shows up as kernel drops.
+**/
+struct pipeline{
+	struct spscRing ring;
+
+	struct pipeSlot* slots;
+	void* arena;
+	size_t arenaSize;
+	int bufSize;
+
+	pthread_t thread;
+	bool closed;
+
+	uint64_t stallNs;
+
+	uint64_t lastSweep;
+	uint64_t nextSnapshot;
+};
+
+/**
+* State shared by every socket of the throughput server
+**/
+struct serverState{
+	const struct serverOpts* opts;
+	struct packetTrace* trace;
+
+	int epfd;
+	bool stopping;
+	bool closing;
+	uint32_t finished;
+	uint32_t nextSessionId;
+
+	struct tcpSession* tcpSessions;
+
+	enum sourceType signalSource;
+	int sigfd;
+
+	struct portListener* ports;
+	int numPorts;
+
+	//shared by the TCP_INFO samplers of all sessions, the group also samples
+	//the rtt shown in the table
+	struct tcpInfoCsv* tcpInfoCsv;
+	struct tcpInfoGroup* tcpInfo;
+
+	struct progressDisplay* display;
+	enum sourceType timerSource;
+	int timerfd;
+
+	struct pipeline* pipe;
+
+	//sessions which end once closing is set were cut short and are left
+	//out of the campaign
+	struct campaign* campaign;
+
+	//counters of the receive loop, the last interval report and the
+	//packet count at that time
+	struct selfProfile* profile;
+	struct selfProfileSample profStart;
+	struct selfProfileSample profLast;
+	uint64_t profLastPackets;
+
+	//only used with opts->adaptivePps
+	struct adaptivePoll poll;
+
+	uint8_t buffer[UDP_GRO_BUF_SIZE];
+};
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static uint32_t extract_packet_number(uint8_t* buf, int len,int* err);
+static bool hasSequence(uint8_t* buf,int len,const uint8_t* seq,int seqLen);
+static int construct_reply(uint8_t* pkt,int len,uint8_t* reply);
+static int recvPacket(
+	int sockfd,uint8_t* buf,int bufSize,struct sockaddr_in6* addr,
+	uint32_t* drops,int* segSize
+);
+static bool targetReached(const struct serverState* st);
+static int watchFd(struct serverState* st, int fd, void* source);
+static void setupUdpPort(struct portListener* l, const struct serverOpts* opts);
+static int openTxSocket(struct portListener* l);
+static struct txStream* startUdpStream(
+	struct serverState* st, struct portListener* l,
+	const struct sockaddr_in6* clientAddr
+);
+static void printSessionRx(
+	struct serverState* st,struct portListener* l,struct udpSession* s
+);
+static void endSession(
+	struct serverState* st,struct portListener* l,struct udpSession* s,
+	const char* why
+);
+static uint32_t sweepIdleSessions(
+	struct serverState* st,struct portListener* l,uint64_t now,
+	uint64_t idleNs
+);
+static void addFinished(struct serverState* st, uint32_t n);
+static struct udpSession* startSession(
+	struct serverState* st, struct portListener* l,
+	const struct sockaddr_in6* clientAddr, uint64_t now
+);
+static bool txControl(
+	struct serverState* st, struct udpSession* s, uint8_t* pkt, int len,
+	uint64_t now
+);
+static void processTxDatagram(
+	struct serverState* st, struct portListener* l, struct udpSession* s,
+	uint8_t* buffer, int copied, int segSize,
+	const struct sockaddr_in6* clientAddr, uint64_t now
+);
+static void processDatagram(
+	struct serverState* st, struct portListener* l, uint8_t* buffer, int rc,
+	int segSize, const struct sockaddr_in6* clientAddr, uint64_t now
+);
+static int throughputServerUDP(
+	struct serverState* st, struct portListener* l
+);
+static int pipelineReceiveUDP(
+	struct serverState* st, struct portListener* l
+);
+static void analysisPeriodic(struct serverState* st, uint64_t now);
+static void* analysisThread(void* arg);
+static void startPipeline(struct serverState* st);
+static void stopPipeline(struct serverState* st);
+static void acceptTCP(struct serverState* st, struct portListener* l);
+static void endTcpSession(
+	struct serverState* st, struct tcpSession* c, const char* why
+);
+static int throughputServerTCP(struct serverState* st, struct tcpSession* c);
+static uint32_t sweepTcpStreams(struct serverState* st);
+static void handleSignal(struct serverState* st);
+static int startDisplay(struct serverState* st);
+static void takeSnapshot(struct serverState* st);
+static void drainSockets(
+	struct serverState* st, struct portListener* ports, int numPorts
+);
+static void printPortSummary(struct portListener* ports, int numPorts);
+static void profileInterval(struct serverState* st);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Returns throughput in kib/s
+*
+* Calculates the throughput represented by the given byte count and elapsed
+* time. The tools use this too so that their figures match the server's.
+*
+* Args:
+* n - the byte count
+* ns - the time taken to transfer the bytes in ns
+*
+* Returns:
+* The throughput in kib/s as a double
+**/
+double throughputServer_calcThroughput(uint64_t n,uint64_t ns){
+	double kib = ((double)n)/(1024.0/8.0);
+
+	double throughput;
+	if(!ns){
+		throughput = 0.0;
+	}
+	else{
+		throughput = kib/(0.000000001*ns);
+	}
+
+	return throughput;
+}
+/**
+* Extracts the packet number from a packet buffer
+*
+* Args:
+* buf - buffer containing the packet
+* len - length of the packet buffer
+* err - pointer to integer; if not NULL, will be set non-zero on failure to
+* 	extract packet number (in which case 0xFFFFFFFF will be returned).
+*
+* Returns:
+* 	The number of the packet found in the buffer. On error will return
+* 	0xFFFFFFFF (but can also return this legitimatley, so *err needs to be
+* 	checked).
+**/
+static uint32_t extract_packet_number(uint8_t* buf, int len,int* err){
+	uint32_t result = 0;
+
+	if(len < 4) {
+		if(err) {
+			*err = 1;
+		}
+		return 0xFFFFFFFF;
+	}
+
+	result |= buf[0] << 0 ;
+	result |= buf[1] << 8 ;
+	result |= buf[2] << 16;
+	result |= buf[3] << 24;
+
+	return result;
+}
+/**
+* Search for a sequence of bytes within a byte buffer
+*
+* Args:
+* buf - buffer to search in
+* len - length of buffer we are searching in
+* seq - sequence of bytes we are searching for.
+* seqLen - length of sequence of bytes to search for.
+*
+* Returns:
+* True if the sub sequence is found within the buffer and false otherwise
+**/
+static bool hasSequence(uint8_t* buf,int len,const uint8_t* seq,int seqLen){
+	for(int i = len-seqLen; i>=0; i--){
+
+		for(int n = 0; n < seqLen; n++){
+			if(buf[i+n] != seq[n]){
+				break;
+			}
+			else if(n == (seqLen-1)){
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+/**
+* Constructs reply for the given packet
+*
+* Fills the reply buffer with the reply to be sent in response to the given
+* packet. The size of the reply packet in bytes is returned (zero returned on
+* error).
+*
+* Args:
+* pkt - the packet to reply to
+* len - length of the given packet
+* reply - space in which to construct the reply packet. Must be at least
+* 	UDP_REPLY_MIN_SIZE bytes long.
+*
+* Returns:
+* zero on error and the size of the reply packet on success.
+**/
+static int construct_reply(uint8_t* pkt,int len,uint8_t* reply){
+	int err = 0;
+	uint32_t seqno = extract_packet_number(pkt,len,&err);
+
+	if(err) {
+		return 0;
+	}
+
+	reply[0] = (seqno >> 0 )&0xFF;
+	reply[1] = (seqno >> 8 )&0xFF;
+	reply[2] = (seqno >> 16)&0xFF;
+	reply[3] = (seqno >> 24)&0xFF;
+
+	return 4;
+}
+/**
+* Receives a single datagram from a UDP socket
+*
+* The socket must have SO_RXQ_OVFL enabled for the drop counter to be
+* reported. The kernel only attaches the counter once it is non-zero, so
+* *drops is left alone when it is missing. Likewise *segSize is only loaded
+* when UDP_GRO is enabled and the kernel coalesced several datagrams.
+*
+* Args:
+* sockfd - the socket to read from
+* buf - buffer to read the datagram into
+* bufSize - size of buf in bytes
+* addr - loaded with the sender's address (ignored if NULL)
+* drops - loaded with the number of datagrams the kernel has dropped from the
+* 	socket's receive queue so far
+* segSize - loaded with the size of the coalesced datagrams
+*
+* Returns:
+* The real length of the datagram (which may be larger than the buffer) or a
+* negative number on error.
+**/
+static int recvPacket(
+	int sockfd,uint8_t* buf,int bufSize,struct sockaddr_in6* addr,
+	uint32_t* drops,int* segSize
+){
+	uint8_t control[CMSG_SPACE(sizeof(uint32_t))+CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {buf,bufSize};
+	struct msghdr msg;
+
+	memset(&msg,0,sizeof(msg));
+	msg.msg_name = addr;
+	msg.msg_namelen = addr ? sizeof(*addr) : 0;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	int rc = recvmsg(sockfd,&msg,MSG_TRUNC);
+	if(rc < 0){
+		return rc;
+	}
+
+	for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm;
+		cm = CMSG_NXTHDR(&msg,cm)){
+
+		if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL){
+			memcpy(drops,CMSG_DATA(cm),sizeof(*drops));
+		}
+		else if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO){
+			memcpy(segSize,CMSG_DATA(cm),sizeof(*segSize));
+		}
+	}
+
+	return rc;
+}
+/**
+* Returns true once the configured number of sessions has ended
+*
+* In a campaign only the sessions which were measured count, those which
+* ended during their warm-up give no sample.
+**/
+static bool targetReached(const struct serverState* st){
+	uint64_t finished = __atomic_load_n(&st->finished,__ATOMIC_RELAXED);
+
+	if(st->campaign){
+		finished = campaign_measured(st->campaign);
+	}
+
+	return st->opts->sessions && finished >= st->opts->sessions;
+}
+/**
+* Counts sessions which have ended
+*
+* The count is atomic as the receive thread checks it while the analysis
+* thread of the pipeline ends sessions.
+**/
+static void addFinished(struct serverState* st, uint32_t n){
+	__atomic_fetch_add(&st->finished,n,__ATOMIC_RELAXED);
+}
+/**
+* Adds a file descriptor to the server's epoll set
+*
+* Args:
+* st - server state
+* fd - the file descriptor to watch for input
+* source - object the events are delivered to, must start with its
+* 	enum sourceType
+*
+* Returns:
+* Zero on success and non-zero on error.
+**/
+static int watchFd(struct serverState* st, int fd, void* source){
+	struct epoll_event ev;
+
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = source;
+
+	return epoll_ctl(st->epfd,EPOLL_CTL_ADD,fd,&ev);
+}
+/**
+* Applies the UDP specific options to a UDP listening socket
+*
+* Will call exit on fatal error.
+**/
+static void setupUdpPort(struct portListener* l, const struct serverOpts* opts){
+	if(opts->gro){
+		int on = 1;
+		if(setsockopt(l->fd,SOL_UDP,UDP_GRO,&on,sizeof(on))){
+			perror("Unable to enable UDP_GRO");
+			exit(-1);
+		}
+	}
+
+	if(opts->rcvbufRate){
+		sockDiag_sizeRcvbuf(l->fd,opts->rcvbufRate);
+	}
+
+	l->table = sessionTable_create(
+		opts->maxSessions,opts->shapeGapUs != 0,opts->owd
+	);
+	if(!l->table){
+		exit(-1);
+	}
+
+	if(opts->sockDiagMs){
+		l->diag = sockDiag_start(l->fd,opts->sockDiagMs);
+	}
+
+	l->txFd = -1;
+	if(opts->txConfig.txtime && (opts->tx || opts->bidir)){
+		l->txFd = openTxSocket(l);
+	}
+}
+/**
+* Opens the socket downlink streams paced with SO_TXTIME send from
+*
+* SO_TXTIME can not be turned off again once enabled, so it is kept off the
+* listening socket used for replies. The sending socket is bound to the same
+* port (the listening socket was created with SO_REUSEPORT) so clients see the
+* stream come from the port they talk to. A reuseport program steers every
+* incoming datagram to the listening socket, the first one of the group.
+*
+* Returns:
+* The socket or -1 if it can not be set up (an error message will have been
+* printed).
+**/
+static int openTxSocket(struct portListener* l){
+	struct sock_filter code[] = {BPF_STMT(BPF_RET|BPF_K,0)};
+	struct sock_fprog prog = {1,code};
+	struct sockaddr_in6 addr;
+	int on = 1;
+
+	memset(&addr,0,sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_any;
+	addr.sin6_port = htons(l->port);
+
+	int fd = socket(AF_INET6,SOCK_DGRAM|SOCK_CLOEXEC,0);
+	if(fd < 0){
+		perror("Error creating downlink socket");
+		return -1;
+	}
+
+	if(setsockopt(fd,SOL_SOCKET,SO_REUSEPORT,&on,sizeof(on)) ||
+		bind(fd,(struct sockaddr*)&addr,sizeof(addr)) ||
+		setsockopt(
+			l->fd,SOL_SOCKET,SO_ATTACH_REUSEPORT_CBPF,&prog,sizeof(prog)
+		)){
+
+		perror("Unable to set up downlink socket, pacing with a timer");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+/**
+* Starts a UDP downlink stream to a client
+*
+* Streams paced with SO_TXTIME send from the port's downlink socket, without
+* one they are paced with a timer instead.
+*
+* Returns:
+* The running stream or NULL on error (an error message will be printed).
+**/
+static struct txStream* startUdpStream(
+	struct serverState* st, struct portListener* l,
+	const struct sockaddr_in6* clientAddr
+){
+	struct txConfig cfg = st->opts->txConfig;
+	int fd = l->fd;
+
+	if(cfg.txtime){
+		if(l->txFd >= 0){
+			fd = l->txFd;
+		}
+		else{
+			cfg.txtime = false;
+		}
+	}
+
+	return txStream_start(fd,false,clientAddr,&cfg);
+}
+/**
+* Prints what a UDP session received from its client
+*
+* The kernel drop counter belongs to the socket, so with several concurrent
+* sessions the drops reported for each one are those of the whole socket
+* during the session.
+**/
+static void printSessionRx(
+	struct serverState* st,struct portListener* l,struct udpSession* s
+){
+	uint32_t drops = l->drops;
+	double throughput = throughputServer_calcThroughput(
+		s->bytes,s->lastNs-s->firstNs
+	);
+
+	printf(
+		"Recieved %llu bytes in total\n",(unsigned long long)s->bytes
+	);
+	printf("Throughput was ~ %lf kib/s\n",throughput);
+	SERVER_PROBE4(
+		report,s->id,s->bytes,s->lastNs-s->firstNs,(uint64_t)throughput
+	);
+
+	//drops are only reported with later packets so the drop counter only
+	//covers datagrams which were queued before the last one we read
+	uint64_t lost = seqStats_lost(&s->seq);
+	uint64_t kernelDrops = drops - s->startDrops;
+
+	printf(
+		"Recieved %llu of %llu numbered packets (%llu reordered or "
+		"duplicated)\n",(unsigned long long)s->seq.received,
+		(unsigned long long)seqStats_expected(&s->seq),
+		(unsigned long long)s->seq.late
+	);
+	printf(
+		"Missing packets: %llu dropped by the kernel, %llu lost in the "
+		"network\n",(unsigned long long)kernelDrops,
+		(unsigned long long)((lost > kernelDrops) ? lost-kernelDrops : 0)
+	);
+	if(st->opts->gro && kernelDrops){
+		printf(
+			"Kernel drops count whole coalesced datagrams with UDP_GRO "
+			"so network loss is overstated\n"
+		);
+	}
+}
+/**
+* Prints the results of a UDP session and removes it from the session table
+*
+* A bidirectional session reports each direction separately.
+*
+* Args:
+* st - server state
+* l - the port the session belongs to
+* s - the session to end
+* why - reason the session ended
+**/
+static void endSession(
+	struct serverState* st,struct portListener* l,struct udpSession* s,
+	const char* why
+){
+	char addrStr[INET6_ADDRSTRLEN];
+
+	inet_ntop(AF_INET6,&s->addr.sin6_addr,addrStr,sizeof(addrStr));
+
+	progressDisplay_pause(st->display);
+	printf(
+		"Session %u from [%s]:%u %s\n",s->id,addrStr,
+		ntohs(s->addr.sin6_port),why
+	);
+
+	if(s->tx && st->opts->bidir){
+		printf("Uplink (client to server):\n");
+		printSessionRx(st,l,s);
+		printf(
+			"Longest pause between uplink packets: %.3f ms\n",
+			s->maxGapNs/1000000.0
+		);
+		printf("Downlink (server to client):\n");
+	}
+	else if(!s->tx){
+		printSessionRx(st,l,s);
+	}
+
+	if(s->shape && (!s->tx || st->opts->bidir)){
+		pktShape_print(
+			s->shape,st->opts->gro ?
+				UDP_GRO_BUF_SIZE : THROUGHPUT_BUF_SIZE
+		);
+	}
+
+	if(s->owd && (!s->tx || st->opts->bidir)){
+		owd_print(s->owd);
+	}
+
+	if(st->campaign && !st->closing && (!s->tx || st->opts->bidir)){
+		campaign_addRun(
+			st->campaign,s->id,false,&s->mark,s->lastNs,s->bytes,
+			&s->seq
+		);
+	}
+
+	if(st->profile){
+		struct selfProfileSample now;
+
+		selfProfile_read(st->profile,&now);
+		selfProfile_print(
+			st->profile,&s->profStart,&now,s->packets,"packet"
+		);
+	}
+
+	l->txBytes += txStream_stop(s->tx);
+	progressDisplay_resume(st->display);
+
+	if(SERVER_PROBE_ENABLED(session_end)){
+		SERVER_PROBE4(
+			session_end,s->id,s->bytes,s->packets,packetTrace_now()
+		);
+	}
+	sessionTable_remove(l->table,s);
+}
+/**
+* Ends every session which has been idle for too long and every downlink
+* session whose stream is done
+*
+* Downlink only sessions never time out as their clients only send
+* acknowledgements. Bidirectional sessions end once the client has finished
+* its stream as well.
+*
+* Args:
+* st - server state
+* l - the UDP port to sweep
+* now - the current time in ns
+* idleNs - sessions idle for this long are ended, zero to never time out
+*
+* Returns:
+* The number of sessions which were ended.
+**/
+static uint32_t sweepIdleSessions(
+	struct serverState* st,struct portListener* l,uint64_t now,
+	uint64_t idleNs
+){
+	struct sessionTable* table = l->table;
+	uint32_t ended = 0;
+
+	for(uint32_t i = 0; i < table->maxSessions; i++){
+		struct udpSession* s = &table->sessions[i];
+
+		if(!s->active){
+			continue;
+		}
+
+		if(s->tx && txStream_done(s->tx) &&
+			(s->rxDone || !st->opts->bidir)){
+
+			endSession(st,l,s,"finished");
+			ended += 1;
+		}
+		else if(idleNs && (!s->tx || st->opts->bidir) &&
+			now - s->lastNs >= idleNs){
+
+			endSession(st,l,s,"timed out");
+			ended += 1;
+		}
+	}
+
+	return ended;
+}
+/**
+* Starts a session for a new UDP client
+*
+* Returns:
+* The new session or NULL if the session table is full, in which case the
+* packet is counted as rejected.
+**/
+static struct udpSession* startSession(
+	struct serverState* st, struct portListener* l,
+	const struct sockaddr_in6* clientAddr, uint64_t now
+){
+	struct udpSession* s = sessionTable_insert(
+		l->table,clientAddr,st->nextSessionId
+	);
+	if(!s){
+		l->rejected += 1;
+		return NULL;
+	}
+
+	st->nextSessionId += 1;
+	l->sessions += 1;
+
+	s->firstNs = now;
+	s->lastNs = now;
+	s->startDrops = l->drops;
+
+	if(st->profile){
+		selfProfile_read(st->profile,&s->profStart);
+	}
+
+	if(s->shape){
+		pktShape_init(s->shape,st->opts->shapeGapUs);
+	}
+
+	if(s->owd){
+		owd_init(s->owd);
+	}
+
+	char addrStr[INET6_ADDRSTRLEN];
+	inet_ntop(AF_INET6,&clientAddr->sin6_addr,addrStr,sizeof(addrStr));
+	progressDisplay_pause(st->display);
+	printf("Incoming connection from: %s (session %u)\n",addrStr,s->id);
+	progressDisplay_resume(st->display);
+
+	SERVER_PROBE4(session_start,s->id,l->port,0,now);
+
+	return s;
+}
+/**
+* Handles the downlink control packets of a session with a downlink stream
+*
+* Start packets are ignored once the stream runs. Acknowledgements are
+* accounted for by the stream. Outside of bidirectional mode each one is
+* traced as a received packet preceded by a TRACE_FLAG_TX record with the
+* send time of the packet it acknowledges. In bidirectional mode the trace
+* only holds the client's stream as the sequence numbers would clash.
+*
+* Returns:
+* True if pkt was a control packet, false if it is something else.
+**/
+static bool txControl(
+	struct serverState* st, struct udpSession* s, uint8_t* pkt, int len,
+	uint64_t now
+){
+	const uint8_t startSeq[] = TX_START_SEQ;
+	const uint8_t ackSeq[] = TX_ACK_SEQ;
+
+	if(len >= sizeof(startSeq) && !memcmp(pkt,startSeq,sizeof(startSeq))){
+		return true;
+	}
+
+	if(len < TX_ACK_SIZE || memcmp(pkt,ackSeq,sizeof(ackSeq))){
+		return false;
+	}
+
+	uint32_t seqno = extract_packet_number(
+		pkt+sizeof(ackSeq),len-sizeof(ackSeq),NULL
+	);
+	uint64_t sentAt = txStream_ack(s->tx,seqno,now);
+
+	if(st->trace && !st->opts->bidir){
+		if(sentAt){
+			packetTrace_record(
+				st->trace,sentAt,seqno,s->tx->cfg.size,s->id,
+				TRACE_FLAG_TX,0
+			);
+		}
+		packetTrace_record(st->trace,now,seqno,len,s->id,0,0);
+	}
+
+	return true;
+}
+/**
+* Accounts for a single datagram received on a UDP port in transmit mode
+*
+* A client asks for a downlink stream with a packet starting with
+* TX_START_SEQ and then acknowledges every packet it receives with
+* TX_ACK_SEQ followed by the packet's sequence number, which gives the
+* downlink loss and round trip time. A packet containing the stop sequence
+* ends the stream early. Anything else is ignored.
+*
+* Bidirectional sessions whose client has finished its own stream end up
+* here as well; they ignore further stop sequences.
+*
+* Args:
+* st - server state
+* l - the port the datagram was received on
+* s - the session of the sender, NULL if it has none
+* buffer - the datagram
+* copied - number of bytes of the datagram in buffer
+* segSize - size of the coalesced datagrams in buffer
+* clientAddr - address of the sender
+* now - time the datagram was received
+**/
+static void processTxDatagram(
+	struct serverState* st, struct portListener* l, struct udpSession* s,
+	uint8_t* buffer, int copied, int segSize,
+	const struct sockaddr_in6* clientAddr, uint64_t now
+){
+	const uint8_t startSeq[] = TX_START_SEQ;
+	const uint8_t stopSeq[] = {0xFF,0xFF,0xFF,0xFF};
+
+	if(!s){
+		if(segSize < sizeof(startSeq) ||
+			memcmp(buffer,startSeq,sizeof(startSeq))){
+
+			return;
+		}
+
+		s = startSession(st,l,clientAddr,now);
+		if(!s){
+			return;
+		}
+
+		s->tx = startUdpStream(st,l,clientAddr);
+		if(!s->tx){
+			sessionTable_remove(l->table,s);
+		}
+		return;
+	}
+
+	s->lastNs = now;
+
+	int off = 0;
+	do{
+		uint8_t* pkt = buffer + off;
+		int pktLen = copied - off;
+
+		if(pktLen > segSize){
+			pktLen = segSize;
+		}
+		off += segSize;
+
+		s->packets += 1;
+		__atomic_store_n(&l->packets,l->packets+1,__ATOMIC_RELAXED);
+
+		if(txControl(st,s,pkt,pktLen,now) || s->rxDone){
+			continue;
+		}
+
+		if(!pktLen || hasSequence(pkt,pktLen,stopSeq,sizeof(stopSeq))){
+			endSession(st,l,s,"finished");
+			addFinished(st,1);
+			return;
+		}
+	}while(segSize && off < copied);
+}
+/**
+* Accounts for a single datagram received on a UDP port
+*
+* Every client address gets its own session which ends when the client sends
+* a packet containing the stop sequence (or an empty datagram) or when it has
+* been idle for longer than the idle timeout. Results are printed to stdout
+* as each session ends. Packets are expected to start with a sequence number
+* so that datagrams dropped by the kernel can be told apart from network loss.
+*
+* With UDP_GRO enabled, coalesced datagrams are split back into the original
+* packets for sequence accounting, replies and tracing while bytes are counted
+* once per read. Size and burst histograms see every packet of the client's
+* stream with its real length. With opts->owd the transmit time following the
+* sequence number of each packet feeds the session's one-way delay estimate.
+*
+* In bidirectional mode every session also gets a downlink stream and the
+* client's acknowledgements are filtered out of its own stream. The session
+* outlives the client's stop sequence until the downlink stream is done.
+*
+* Args:
+* st - server state
+* l - the port the datagram was received on
+* buffer - the datagram
+* rc - length of the datagram as returned by recvPacket()
+* segSize - GRO segment size returned by recvPacket()
+* clientAddr - address of the sender
+* now - time the datagram was received
+**/
+static void processDatagram(
+	struct serverState* st, struct portListener* l, uint8_t* buffer, int rc,
+	int segSize, const struct sockaddr_in6* clientAddr, uint64_t now
+){
+	const uint8_t stopSeq[] = {0xFF,0xFF,0xFF,0xFF};
+	const struct serverOpts* opts = st->opts;
+
+	uint8_t reply[UDP_REPLY_MIN_SIZE];
+	int bufSize = opts->gro ? UDP_GRO_BUF_SIZE : THROUGHPUT_BUF_SIZE;
+
+	//with MSG_TRUNC rc is the real datagram length which may be
+	//larger than what was copied into the buffer
+	uint32_t truncFlag = 0;
+	int copied = rc;
+	if(copied > bufSize){
+		copied = bufSize;
+		truncFlag = TRACE_FLAG_TRUNC;
+	}
+
+	//a datagram which was not coalesced is a single segment
+	if(segSize <= 0 || segSize > copied){
+		segSize = copied;
+	}
+
+	struct udpSession* s = sessionTable_find(l->table,clientAddr);
+
+	if(opts->tx && (!opts->bidir || (s && s->rxDone))){
+		processTxDatagram(st,l,s,buffer,copied,segSize,clientAddr,now);
+		return;
+	}
+
+	if(!s){
+		//clients repeat the stop sequence, the extra copies must
+		//not start new sessions
+		if(!rc || hasSequence(buffer,segSize,stopSeq,sizeof(stopSeq))){
+			return;
+		}
+
+		s = startSession(st,l,clientAddr,now);
+		if(!s){
+			return;
+		}
+
+		if(opts->bidir){
+			s->tx = startUdpStream(st,l,clientAddr);
+		}
+	}
+
+	if(st->campaign){
+		campaign_mark(
+			st->campaign,&s->mark,s->firstNs,s->packets,now,s->bytes,
+			&s->seq
+		);
+	}
+
+	s->lastNs = now;
+	s->bytes += rc;
+	l->bytes += rc;
+
+	bool stop = !rc;
+
+	//walk the segments of the datagram, an empty datagram is still
+	//handled once
+	int off = 0;
+	do{
+		uint8_t* pkt = buffer + off;
+		int pktLen = copied - off;
+		uint32_t traceFlags = truncFlag;
+
+		if(pktLen > segSize){
+			pktLen = segSize;
+		}
+
+		//acknowledgements are not part of the client's stream
+		if(s->tx && txControl(st,s,pkt,pktLen,now)){
+			s->bytes -= pktLen;
+			l->bytes -= pktLen;
+			off += segSize;
+			continue;
+		}
+
+		if(s->lastDataNs && now - s->lastDataNs > s->maxGapNs){
+			s->maxGapNs = now - s->lastDataNs;
+		}
+		s->lastDataNs = now;
+
+		s->packets += 1;
+		__atomic_store_n(&l->packets,l->packets+1,__ATOMIC_RELAXED);
+
+		bool last = off+pktLen == copied;
+
+		pktShape_add(
+			s->shape,last ? rc-off : pktLen,last && truncFlag,now
+		);
+
+		stop = stop || hasSequence(pkt,pktLen,stopSeq,sizeof(stopSeq));
+
+		int err = 0;
+		uint32_t seqno = extract_packet_number(pkt,pktLen,&err);
+
+		if(s->owd && !stop && pktLen >= OWD_MIN_LEN){
+			uint64_t txNs = 0;
+
+			for(int i = 7; i >= 0; i--){
+				txNs = (txNs << 8) | pkt[OWD_TS_OFFSET+i];
+			}
+			owd_add(s->owd,txNs,now);
+		}
+
+		if(stop){
+			SERVER_PROBE4(stop,s->id,seqno,0,now);
+		}
+		else{
+			SERVER_PROBE4(udp_receive,s->id,seqno,pktLen,now);
+		}
+
+		if(opts->pingpong && pktLen) {
+			int reply_len = construct_reply(pkt,pktLen,reply);
+
+			if(!reply_len){
+				fprintf(stderr,"Malformed packet!\n");
+			} else if(sendto(
+				l->fd,reply,reply_len,0,
+				(const struct sockaddr*)clientAddr,
+				sizeof(*clientAddr)) != reply_len) {
+
+				perror("Error writing to socket\n");
+				exit(-1);
+			} else {
+				traceFlags |= TRACE_FLAG_REPLY;
+				SERVER_PROBE4(reply,s->id,seqno,reply_len,now);
+			}
+		}
+
+		if(!err && !stop){
+			seqStats_update(&s->seq,seqno);
+		}
+
+		if(st->trace){
+			if(err){
+				traceFlags |= TRACE_FLAG_NOSEQ;
+			}
+			if(stop){
+				traceFlags |= TRACE_FLAG_STOP;
+			}
+
+			packetTrace_record(
+				st->trace,now,seqno,last ? rc-off : pktLen,
+				s->id,traceFlags,0
+			);
+		}
+
+		off += segSize;
+	}while(!stop && segSize && off < copied);
+
+	if(stop && s->tx && !txStream_done(s->tx)){
+		//sweepIdleSessions() ends the session with the downlink stream
+		s->rxDone = true;
+	}
+	else if(stop){
+		endSession(st,l,s,"finished");
+		addFinished(st,1);
+	}
+}
+/**
+* Reads the datagrams waiting on a UDP port
+*
+* Each datagram is accounted for right away with processDatagram() unless the
+* pipeline is running, in which case it is handed to the analysis thread.
+*
+* At most READ_BUDGET datagrams are read so other sockets get a turn.
+*
+* Args:
+* st - server state
+* l - the readable UDP port
+*
+* Returns:
+* The number of datagrams read, READ_BUDGET if more may be waiting
+**/
+static int throughputServerUDP(
+	struct serverState* st, struct portListener* l
+){
+	if(st->pipe){
+		return pipelineReceiveUDP(st,l);
+	}
+
+	struct sockaddr_in6 clientAddr;
+
+	uint8_t* buffer = st->buffer;
+	int bufSize = st->opts->gro ? UDP_GRO_BUF_SIZE : THROUGHPUT_BUF_SIZE;
+
+	int n;
+
+	for(n = 0; n < READ_BUDGET && !targetReached(st); n++){
+		int segSize = 0;
+
+		selfProfile_syscall(st->profile);
+		int rc = recvPacket(
+			l->fd,buffer,bufSize,&clientAddr,&l->drops,&segSize
+		);
+		uint64_t now = packetTrace_now();
+
+		if(rc < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR){
+
+				break;
+			}
+			perror("Error reading from socket!\n");
+			exit(-1);
+		}
+
+		processDatagram(st,l,buffer,rc,segSize,&clientAddr,now);
+	}
+
+	return n;
+}
+/**
+* Reads the datagrams waiting on a UDP port into slots of the pipeline
+*
+* Waits for the analysis thread whenever the ring is full. At most READ_BUDGET
+* datagrams are read so other sockets get a turn.
+*
+* Args:
+* st - server state
+* l - the readable UDP port
+*
+* Returns:
+* The number of datagrams read, READ_BUDGET if more may be waiting
+**/
+static int pipelineReceiveUDP(
+	struct serverState* st, struct portListener* l
+){
+	struct pipeline* pipe = st->pipe;
+	struct spscRing* ring = &pipe->ring;
+
+	int n;
+
+	for(n = 0; n < READ_BUDGET && !targetReached(st); n++){
+		if(spscRing_full(ring)){
+			uint64_t start = packetTrace_now();
+
+			ring->fullCount += 1;
+			while(spscRing_full(ring)){
+				sched_yield();
+			}
+
+			pipe->stallNs += packetTrace_now() - start;
+		}
+
+		struct pipeSlot* slot = &pipe->slots[spscRing_slot(ring)];
+
+		slot->segSize = 0;
+		selfProfile_syscall(st->profile);
+		int rc = recvPacket(
+			l->fd,slot->data,pipe->bufSize,&slot->addr,&l->rxDrops,
+			&slot->segSize
+		);
+
+		if(rc < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR){
+
+				break;
+			}
+			perror("Error reading from socket!\n");
+			exit(-1);
+		}
+
+		slot->timestamp = packetTrace_now();
+		slot->port = l;
+		slot->len = rc;
+		slot->drops = l->rxDrops;
+
+		spscRing_push(ring);
+	}
+
+	return n;
+}
+/**
+* Runs the timed work of the analysis thread: idle session sweeps and
+* progress snapshots
+**/
+static void analysisPeriodic(struct serverState* st, uint64_t now){
+	struct pipeline* pipe = st->pipe;
+	uint64_t idleNs = ((uint64_t)st->opts->idleTimeout)*1000000000ULL;
+
+	if(idleNs && now - pipe->lastSweep >= SESSION_SWEEP_MS*1000000ULL){
+		for(int p = 0; p < st->numPorts; p++){
+			addFinished(
+				st,sweepIdleSessions(st,&st->ports[p],now,idleNs)
+			);
+		}
+		pipe->lastSweep = now;
+	}
+
+	if(st->display && now >= pipe->nextSnapshot){
+		takeSnapshot(st);
+		pipe->nextSnapshot = now + st->opts->refreshMs*1000000ULL;
+	}
+}
+/**
+* Analysis thread entry point
+*
+* Consumes datagrams from the ring until the receive thread closes the
+* pipeline and the ring is empty.
+**/
+static void* analysisThread(void* arg){
+	struct serverState* st = arg;
+	struct pipeline* pipe = st->pipe;
+	struct spscRing* ring = &pipe->ring;
+
+	unsigned idle = 0;
+	unsigned count = 0;
+
+	while(1){
+		uint64_t i;
+
+		if(!spscRing_peek(ring,&i)){
+			if(__atomic_load_n(&pipe->closed,__ATOMIC_ACQUIRE)){
+				if(!spscRing_peek(ring,&i)){
+					break;
+				}
+			}
+			else{
+				analysisPeriodic(st,packetTrace_now());
+
+				if(++idle >= PIPELINE_IDLE_SPINS){
+					struct timespec ts = {0,PIPELINE_IDLE_NS};
+					nanosleep(&ts,NULL);
+				}
+				continue;
+			}
+		}
+
+		struct pipeSlot* slot = &pipe->slots[i];
+		struct portListener* l = slot->port;
+
+		idle = 0;
+
+		l->drops = slot->drops;
+		processDatagram(
+			st,l,slot->data,slot->len,slot->segSize,&slot->addr,
+			slot->timestamp
+		);
+
+		spscRing_pop(ring);
+
+		if(!(++count % READ_BUDGET)){
+			analysisPeriodic(st,packetTrace_now());
+		}
+	}
+
+	return NULL;
+}
+/**
+* Allocates the pipeline and its slots
+*
+* The analysis thread is started separately with pthread_create() once the
+* rest of the server is set up. Will call exit on fatal error.
+**/
+static void startPipeline(struct serverState* st){
+	struct pipeline* pipe;
+	uint64_t slots = st->opts->pipelineSlots;
+
+	if(posix_memalign((void**)&pipe,SPSC_CACHE_LINE,sizeof(*pipe))){
+		fprintf(stderr,"Error allocating pipeline\n");
+		exit(-1);
+	}
+
+	memset(pipe,0,sizeof(*pipe));
+	spscRing_init(&pipe->ring,slots);
+
+	pipe->bufSize = st->opts->gro ? UDP_GRO_BUF_SIZE : THROUGHPUT_BUF_SIZE;
+	pipe->arenaSize = slots*(sizeof(struct pipeSlot) + pipe->bufSize);
+
+	//populate up front so the receive thread never takes a page fault
+	pipe->arena = mmap(
+		NULL,pipe->arenaSize,PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE,-1,0
+	);
+	if(pipe->arena == MAP_FAILED){
+		perror("Error allocating pipeline slots");
+		exit(-1);
+	}
+
+	pipe->slots = pipe->arena;
+	uint8_t* data = (uint8_t*)(pipe->slots + slots);
+
+	for(uint64_t i = 0; i < slots; i++){
+		pipe->slots[i].data = data + i*pipe->bufSize;
+	}
+
+	pipe->lastSweep = packetTrace_now();
+
+	st->pipe = pipe;
+}
+/**
+* Lets the analysis thread finish what is left in the ring, waits for it and
+* prints the ring statistics
+**/
+static void stopPipeline(struct serverState* st){
+	struct pipeline* pipe = st->pipe;
+	struct spscRing* ring = &pipe->ring;
+
+	__atomic_store_n(&pipe->closed,true,__ATOMIC_RELEASE);
+	pthread_join(pipe->thread,NULL);
+
+	progressDisplay_pause(st->display);
+	printf(
+		"Pipeline: %llu datagrams through a ring of %llu slots\n",
+		(unsigned long long)ring->popCount,
+		(unsigned long long)ring->size
+	);
+	printf(
+		"  occupancy mean/max: %.1f/%llu slots\n",
+		ring->popCount ? ((double)ring->occupancySum)/ring->popCount : 0.0,
+		(unsigned long long)ring->maxOccupancy
+	);
+	printf(
+		"  ring full %llu times, receive thread stalled for %.3f ms\n",
+		(unsigned long long)ring->fullCount,pipe->stallNs/1000000.0
+	);
+	progressDisplay_resume(st->display);
+
+	munmap(pipe->arena,pipe->arenaSize);
+	free(pipe);
+	st->pipe = NULL;
+}
+/**
+* Accepts a pending connection on a TCP port and starts its session
+**/
+static void acceptTCP(struct serverState* st, struct portListener* l){
+	struct sockaddr_in6 clientAddr;
+	socklen_t len = sizeof(clientAddr);
+
+	int fd = accept4(
+		l->fd,(struct sockaddr*)&clientAddr,&len,SOCK_NONBLOCK
+	);
+	if(fd < 0){
+		if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+			perror("Error calling accept()");
+		}
+		return;
+	}
+
+	struct tcpSession* c = calloc(1,sizeof(*c));
+	if(!c){
+		perror("Error allocating connection");
+		close(fd);
+		return;
+	}
+
+	c->type = SOURCE_TCP_CONN;
+	c->fd = fd;
+	c->port = l;
+	c->id = st->nextSessionId;
+	c->addr = clientAddr;
+	if(st->profile){
+		selfProfile_read(st->profile,&c->profStart);
+	}
+	st->nextSessionId += 1;
+	l->sessions += 1;
+
+	if(watchFd(st,fd,c)){
+		perror("Error watching connection");
+		close(fd);
+		free(c);
+		return;
+	}
+
+	c->next = st->tcpSessions;
+	if(c->next){
+		c->next->prev = c;
+	}
+	st->tcpSessions = c;
+
+	char addrStr[INET6_ADDRSTRLEN];
+	inet_ntop(AF_INET6,&clientAddr.sin6_addr,addrStr,sizeof(addrStr));
+	progressDisplay_pause(st->display);
+	printf("Incoming connection from: %s (session %u)\n",addrStr,c->id);
+	progressDisplay_resume(st->display);
+
+	if(SERVER_PROBE_ENABLED(session_start)){
+		SERVER_PROBE4(session_start,c->id,l->port,1,packetTrace_now());
+	}
+
+	if(st->tcpInfo){
+		c->sampler = tcpInfo_start(
+			st->tcpInfo,fd,c->id,st->opts->tcpInfoMs != 0
+		);
+	}
+
+	if(st->opts->tcpRecv != TCP_RECV_DEFAULT){
+		c->rx = tcpRecv_open(fd,st->opts->tcpRecv);
+	}
+
+	if(st->opts->tx){
+		c->tx = txStream_start(fd,true,&clientAddr,&st->opts->txConfig);
+	}
+}
+/**
+* Prints the results of a TCP session, closes its connection and frees it
+**/
+static void endTcpSession(
+	struct serverState* st, struct tcpSession* c, const char* why
+){
+	progressDisplay_pause(st->display);
+	printf("Session %u on port %u %s\n",c->id,c->port->port,why);
+
+	if(c->tx && st->opts->bidir){
+		printf("Uplink (client to server):\n");
+	}
+
+	if(!c->tx || st->opts->bidir){
+		double throughput = throughputServer_calcThroughput(
+			c->bytes,c->lastNs-c->firstNs
+		);
+
+		printf(
+			"Recieved %llu bytes in total\n",
+			(unsigned long long)c->bytes
+		);
+		printf("Throughput was ~ %lf kib/s\n",throughput);
+		SERVER_PROBE4(
+			report,c->id,c->bytes,c->lastNs-c->firstNs,
+			(uint64_t)throughput
+		);
+	}
+
+	if(c->tx && st->opts->bidir){
+		printf(
+			"Longest pause between uplink reads: %.3f ms\n",
+			c->maxGapNs/1000000.0
+		);
+		printf("Downlink (server to client):\n");
+	}
+
+	if(st->campaign && !st->closing && (!c->tx || st->opts->bidir)){
+		campaign_addRun(
+			st->campaign,c->id,true,&c->mark,c->lastNs,c->bytes,NULL
+		);
+	}
+
+	if(st->profile){
+		struct selfProfileSample now;
+
+		selfProfile_read(st->profile,&now);
+		selfProfile_print(
+			st->profile,&c->profStart,&now,c->readCount,"read"
+		);
+	}
+
+	c->port->txBytes += txStream_stop(c->tx);
+
+	tcpRecv_close(c->rx);
+	tcpInfo_stop(c->sampler);
+	progressDisplay_resume(st->display);
+
+	if(SERVER_PROBE_ENABLED(session_end)){
+		SERVER_PROBE4(
+			session_end,c->id,c->bytes,c->readCount,packetTrace_now()
+		);
+	}
+
+	epoll_ctl(st->epfd,EPOLL_CTL_DEL,c->fd,NULL);
+	if(close(c->fd) < 0){
+		perror("Error calling close()");
+	}
+
+	if(c->prev){
+		c->prev->next = c->next;
+	}
+	else{
+		st->tcpSessions = c->next;
+	}
+	if(c->next){
+		c->next->prev = c->prev;
+	}
+
+	free(c);
+}
+/**
+* Reads the data waiting on a TCP connection
+*
+* The session ends when the client closes the connection. At most READ_BUDGET
+* reads are made so other sockets get a turn. Connections with a tcpReceiver
+* take its receive path instead of read().
+*
+* Args:
+* st - server state
+* c - the readable connection, freed if the client closed the connection
+*
+* Returns:
+* The number of reads made, READ_BUDGET if more data may be waiting
+**/
+static int throughputServerTCP(struct serverState* st, struct tcpSession* c){
+
+	uint8_t* buffer = st->buffer;
+	int n;
+
+	for(n = 0; n < READ_BUDGET; n++){
+		selfProfile_syscall(st->profile);
+		int rc = c->rx ? tcpRecv_read(c->rx) :
+			read(c->fd,buffer,THROUGHPUT_BUF_SIZE);
+		uint64_t now = packetTrace_now();
+
+		if(rc > 0){
+			//take first time measurement just after the first byte
+			//arrives
+			if(!c->readCount){
+				c->firstNs = now;
+			}
+			else if(now - c->lastNs > c->maxGapNs){
+				c->maxGapNs = now - c->lastNs;
+			}
+
+			if(st->campaign){
+				campaign_mark(
+					st->campaign,&c->mark,c->firstNs,
+					c->readCount,now,c->bytes,NULL
+				);
+			}
+
+			packetTrace_record(
+				st->trace,now,c->readCount,rc,c->id,
+				TRACE_FLAG_TCP,c->bytes
+			);
+			SERVER_PROBE4(tcp_receive,c->id,c->readCount,rc,now);
+
+			c->lastNs = now;
+			c->readCount += 1;
+			c->bytes += rc;
+			c->port->packets += 1;
+			c->port->bytes += rc;
+		}
+		else if(rc < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR){
+
+				break;
+			}
+			perror("Error reading from socket!\n");
+	 	 	exit(-1);
+		}
+		else if (rc == 0){
+			c->lastNs = now;
+			SERVER_PROBE4(stop,c->id,c->readCount,1,now);
+
+			//a downlink stream carries on after the client shut
+			//down its side, sweepTcpStreams() ends the session
+			if(c->tx && !txStream_done(c->tx)){
+				epoll_ctl(st->epfd,EPOLL_CTL_DEL,c->fd,NULL);
+				break;
+			}
+
+			endTcpSession(st,c,"finished");
+			addFinished(st,1);
+			break;
+		}
+	}
+
+	return n;
+}
+/**
+* Ends every TCP session whose downlink stream is done
+*
+* Returns:
+* The number of sessions which were ended.
+**/
+static uint32_t sweepTcpStreams(struct serverState* st){
+	struct tcpSession* c = st->tcpSessions;
+	uint32_t ended = 0;
+
+	while(c){
+		struct tcpSession* next = c->next;
+
+		if(c->tx && txStream_done(c->tx)){
+			endTcpSession(st,c,"finished");
+			ended += 1;
+		}
+
+		c = next;
+	}
+
+	return ended;
+}
+/**
+* Reads a shutdown signal from the signalfd and stops the event loop
+**/
+static void handleSignal(struct serverState* st){
+	struct signalfd_siginfo info;
+
+	if(read(st->sigfd,&info,sizeof(info)) != sizeof(info)){
+		return;
+	}
+
+	progressDisplay_pause(st->display);
+	printf(
+		"Caught %s, reading what is already queued and finishing up\n",
+		strsignal(info.ssi_signo)
+	);
+	progressDisplay_resume(st->display);
+
+	st->stopping = true;
+}
+/**
+* Starts the progress display and the timer which feeds it with snapshots
+*
+* With the pipeline running the analysis thread takes the snapshots itself so
+* no timer is needed.
+*
+* Returns:
+* Zero on success and non-zero on error.
+**/
+static int startDisplay(struct serverState* st){
+	const struct serverOpts* opts = st->opts;
+
+	st->timerfd = -1;
+
+	st->display = progressDisplay_start(opts->progress,opts->refreshMs);
+	if(!st->display || st->pipe){
+		return 0;
+	}
+
+	struct itimerspec its;
+
+	memset(&its,0,sizeof(its));
+	its.it_interval.tv_sec = opts->refreshMs/1000;
+	its.it_interval.tv_nsec = (opts->refreshMs%1000)*1000000L;
+	its.it_value = its.it_interval;
+
+	st->timerSource = SOURCE_TIMER;
+	st->timerfd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC);
+
+	if(st->timerfd < 0 || timerfd_settime(st->timerfd,0,&its,NULL) ||
+		watchFd(st,st->timerfd,&st->timerSource)){
+
+		return -1;
+	}
+
+	return 0;
+}
+/**
+* Copies the counters of every port and session into a snapshot for the
+* progress display
+*
+* Runs on the thread which owns the sessions (the receive thread, or the
+* analysis thread when the pipeline runs) once per refresh interval so the
+* display never reads counters which are being updated.
+**/
+static void takeSnapshot(struct serverState* st){
+	uint64_t expirations;
+
+	if(st->timerfd >= 0 &&
+		read(st->timerfd,&expirations,sizeof(expirations)) < 0){
+
+		return;
+	}
+
+	struct progressSnapshot* snap = progressDisplay_begin(st->display);
+	if(!snap){
+		return;
+	}
+
+	snap->time = packetTrace_now();
+
+	for(int p = 0; p < st->numPorts; p++){
+		struct portListener* l = &st->ports[p];
+
+		snap->bytes += l->bytes + l->txBytes;
+		snap->packets += l->packets;
+
+		if(l->tcp){
+			continue;
+		}
+
+		for(uint32_t i = 0; i < l->table->maxSessions; i++){
+			const struct udpSession* s = &l->table->sessions[i];
+
+			if(!s->active){
+				continue;
+			}
+
+			snap->sessions += 1;
+			snap->bytes += txStream_bytes(s->tx);
+
+			if(snap->numRows == PROGRESS_MAX_ROWS){
+				continue;
+			}
+
+			struct progressRow* row = &snap->rows[snap->numRows];
+			snap->numRows += 1;
+
+			row->id = s->id;
+			row->port = l->port;
+			row->tcp = false;
+			row->addr = s->addr.sin6_addr;
+			row->bytes = s->tx ? txStream_bytes(s->tx) : s->bytes;
+			row->expected = seqStats_expected(&s->seq);
+			row->lost = seqStats_lost(&s->seq);
+			row->rtt = 0;
+		}
+	}
+
+	for(struct tcpSession* c = st->tcpSessions; c; c = c->next){
+		snap->sessions += 1;
+		snap->bytes += txStream_bytes(c->tx);
+
+		if(snap->numRows == PROGRESS_MAX_ROWS){
+			continue;
+		}
+
+		struct progressRow* row = &snap->rows[snap->numRows];
+
+		snap->numRows += 1;
+
+		row->id = c->id;
+		row->port = c->port->port;
+		row->tcp = true;
+		row->addr = c->addr.sin6_addr;
+		row->bytes = c->tx ? txStream_bytes(c->tx) : c->bytes;
+		row->expected = 0;
+		row->lost = 0;
+		row->rtt = tcpInfo_rtt(c->sampler);
+	}
+
+	progressDisplay_publish(st->display);
+}
+/**
+* Reads whatever is already queued on every socket after a shutdown signal
+*
+* No new connections are accepted. Each socket is read until it is empty or
+* DRAIN_BUDGET reads were made so a client which keeps sending can not stall
+* the shutdown.
+**/
+static void drainSockets(
+	struct serverState* st, struct portListener* ports, int numPorts
+){
+	for(int p = 0; p < numPorts; p++){
+		if(ports[p].tcp){
+			continue;
+		}
+		for(int n = 0; n < DRAIN_BUDGET/READ_BUDGET; n++){
+			if(throughputServerUDP(st,&ports[p]) < READ_BUDGET){
+				break;
+			}
+		}
+	}
+
+	struct tcpSession* c = st->tcpSessions;
+	while(c){
+		struct tcpSession* next = c->next;
+
+		for(int n = 0; n < DRAIN_BUDGET/READ_BUDGET; n++){
+			//a short read count means either the socket is empty or
+			//the session ended and c was freed
+			if(throughputServerTCP(st,c) < READ_BUDGET){
+				break;
+			}
+		}
+
+		c = next;
+	}
+}
+/**
+* Prints the statistics of every port
+**/
+static void printPortSummary(struct portListener* ports, int numPorts){
+	printf("\nPort summary:\n");
+	printf(
+		"%6s %5s %9s %12s %14s %12s %10s\n","port","proto","sessions",
+		"packets","bytes","kern drops","discarded"
+	);
+
+	for(int i = 0; i < numPorts; i++){
+		struct portListener* l = &ports[i];
+
+		printf(
+			"%6u %5s %9llu %12llu %14llu %12u %10llu\n",l->port,
+			l->tcp ? "tcp" : "udp",(unsigned long long)l->sessions,
+			(unsigned long long)l->packets,
+			(unsigned long long)l->bytes,l->drops,
+			(unsigned long long)l->rejected
+		);
+	}
+}
+/**
+* Prints the self profile of the receive loop since the last interval
+*
+* Packets are counted over every port. TCP reads count as packets.
+**/
+static void profileInterval(struct serverState* st){
+	struct selfProfileSample now;
+	uint64_t packets = 0;
+
+	//with the pipeline the packets are counted on the analysis thread
+	for(int p = 0; p < st->numPorts; p++){
+		packets += __atomic_load_n(&st->ports[p].packets,__ATOMIC_RELAXED);
+	}
+
+	selfProfile_read(st->profile,&now);
+
+	progressDisplay_pause(st->display);
+	printf(
+		"Last %.3lf s: %llu packets\n",(now.time-st->profLast.time)/1e9,
+		(unsigned long long)(packets-st->profLastPackets)
+	);
+	selfProfile_print(
+		st->profile,&st->profLast,&now,packets-st->profLastPackets,
+		"packet"
+	);
+	progressDisplay_resume(st->display);
+
+	st->profLast = now;
+	st->profLastPackets = packets;
+}
+/**
+* Runs the throughput server on the given listening sockets
+*
+* Returns once the number of sessions given by opts->sessions have ended or
+* a shutdown signal arrives on sigfd. After a signal the data already queued
+* on every socket is still read. Sessions which are still running at that
+* point are reported and ended. Will call exit on fatal error.
+*
+* A campaign (opts->campaignRuns or opts->campaignDuration) also stops once
+* its time is up and finishes with statistics across its sessions.
+*
+* With opts->selfProfile the receive loop's perf counters are reported as
+* each session ends, every opts->profileMs and at the end of the run.
+*
+* With opts->adaptivePps the loop spins on epoll_wait() while packets arrive
+* at least that fast and blocks otherwise, see struct adaptivePoll.
+*
+* If opts->pipelineSlots is set every port must be a UDP port; the sockets
+* are then read on the calling thread while the datagrams are accounted for
+* on a separate analysis thread.
+*
+* Args:
+* ports - the listening sockets to serve, created with listenAllIPv6()
+* numPorts - number of listening sockets
+* opts - server options
+* trace - trace to record each packet into (NULL to disable tracing)
+* sigfd - signalfd from cleanExit_signalfd() (-1 to ignore signals)
+*
+* Returns:
+* Zero
+**/
+int throughputServer_run(
+	struct portListener* ports, int numPorts,
+	const struct serverOpts* opts, struct packetTrace* trace, int sigfd
+){
+	struct serverState* st = calloc(1,sizeof(*st));
+	struct epoll_event events[EVENT_BATCH];
+
+	if(!st){
+		perror("Error allocating server state");
+		exit(-1);
+	}
+
+	st->opts = opts;
+	st->trace = trace;
+	st->ports = ports;
+	st->numPorts = numPorts;
+
+	st->epfd = epoll_create1(0);
+	if(st->epfd < 0){
+		perror("Error creating epoll instance");
+		exit(-1);
+	}
+
+	st->signalSource = SOURCE_SIGNAL;
+	st->sigfd = sigfd;
+	if(sigfd >= 0 && watchFd(st,sigfd,&st->signalSource)){
+		perror("Error watching signalfd");
+		exit(-1);
+	}
+
+	for(int i = 0; i < numPorts; i++){
+		struct portListener* l = &ports[i];
+
+		l->type = l->tcp ? SOURCE_TCP_LISTEN : SOURCE_UDP;
+
+		if(!l->tcp){
+			setupUdpPort(l,opts);
+		}
+
+		int flags = fcntl(l->fd,F_GETFL);
+		if(flags < 0 || fcntl(l->fd,F_SETFL,flags|O_NONBLOCK) ||
+			watchFd(st,l->fd,l)){
+
+			perror("Error watching listening socket");
+			exit(-1);
+		}
+	}
+
+	if(opts->pipelineSlots){
+		startPipeline(st);
+	}
+
+	if(startDisplay(st)){
+		perror("Error starting progress display");
+		exit(-1);
+	}
+
+	if(opts->campaignRuns || opts->campaignDuration){
+		st->campaign = campaign_create(opts->warmupMs,opts->warmupPackets);
+		if(!st->campaign){
+			exit(-1);
+		}
+	}
+
+	if(opts->tcpInfoCsv){
+		st->tcpInfoCsv = tcpInfo_openCsv(opts->tcpInfoCsv);
+		if(!st->tcpInfoCsv){
+			exit(-1);
+		}
+	}
+
+	//the table shows the rtt of every connection, which is sampled off the
+	//receive thread together with --tcpinfo or else at the refresh interval
+	if(opts->tcpInfoMs){
+		st->tcpInfo = tcpInfo_startGroup(opts->tcpInfoMs,st->tcpInfoCsv);
+		if(!st->tcpInfo){
+			exit(-1);
+		}
+	}
+	else if(st->display && opts->progress == PROGRESS_TABLE){
+		st->tcpInfo = tcpInfo_startGroup(opts->refreshMs,NULL);
+		if(!st->tcpInfo){
+			exit(-1);
+		}
+	}
+
+	if(opts->selfProfile){
+		st->profile = selfProfile_open();
+		if(!st->profile){
+			exit(-1);
+		}
+		selfProfile_read(st->profile,&st->profStart);
+		st->profLast = st->profStart;
+	}
+
+	if(st->pipe && pthread_create(&st->pipe->thread,NULL,analysisThread,st)){
+		perror("Error starting analysis thread");
+		exit(-1);
+	}
+
+	uint64_t idleNs = ((uint64_t)opts->idleTimeout)*1000000000ULL;
+	uint64_t lastSweep = packetTrace_now();
+	uint64_t campaignEnd = lastSweep +
+		((uint64_t)opts->campaignDuration)*1000000000ULL;
+
+	//wake up regularly to time out sessions, to end finished downlink
+	//streams and to end a timed campaign even if nothing arrives, with the
+	//pipeline running sessions end on the analysis thread so the loop must
+	//also notice when enough have ended, self profile intervals are
+	//reported from here as well
+	int timeout = (idleNs || st->pipe || opts->tx || opts->campaignDuration ||
+		opts->profileMs) ? SESSION_SWEEP_MS : -1;
+
+	if(opts->adaptivePps){
+		adaptivePoll_init(&st->poll,opts->adaptivePps,packetTrace_now());
+	}
+
+	while(!targetReached(st) && !st->stopping){
+		int wait = opts->adaptivePps ?
+			adaptivePoll_timeout(&st->poll,timeout) : timeout;
+		uint64_t handled = 0;
+
+		selfProfile_syscall(st->profile);
+		int n = epoll_wait(st->epfd,events,EVENT_BATCH,wait);
+
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("Error waiting for events");
+			exit(-1);
+		}
+
+		for(int i = 0; i < n && !targetReached(st) && !st->stopping; i++){
+			enum sourceType* type = events[i].data.ptr;
+
+			switch(*type){
+			case SOURCE_UDP:
+				handled += throughputServerUDP(
+					st,(struct portListener*)type
+				);
+				break;
+			case SOURCE_TCP_LISTEN:
+				acceptTCP(st,(struct portListener*)type);
+				break;
+			case SOURCE_TCP_CONN:
+				handled += throughputServerTCP(
+					st,(struct tcpSession*)type
+				);
+				break;
+			case SOURCE_SIGNAL:
+				handleSignal(st);
+				break;
+			case SOURCE_TIMER:
+				takeSnapshot(st);
+				break;
+			}
+		}
+
+		uint64_t now = packetTrace_now();
+
+		if(opts->adaptivePps){
+			adaptivePoll_update(&st->poll,n,handled,now);
+		}
+
+		if((idleNs || opts->tx) && !st->pipe &&
+			now - lastSweep >= SESSION_SWEEP_MS*1000000ULL){
+
+			for(int p = 0; p < numPorts; p++){
+				if(ports[p].tcp){
+					continue;
+				}
+				addFinished(
+					st,sweepIdleSessions(st,&ports[p],now,idleNs)
+				);
+			}
+			addFinished(st,sweepTcpStreams(st));
+			lastSweep = now;
+		}
+
+		if(opts->profileMs &&
+			now - st->profLast.time >= opts->profileMs*1000000ULL){
+
+			profileInterval(st);
+		}
+
+		if(opts->campaignDuration && now >= campaignEnd){
+			progressDisplay_pause(st->display);
+			printf(
+				"Campaign time is up, reading what is already "
+				"queued and finishing up\n"
+			);
+			progressDisplay_resume(st->display);
+			st->stopping = true;
+		}
+	}
+
+	if(opts->adaptivePps){
+		progressDisplay_pause(st->display);
+		adaptivePoll_report(&st->poll,packetTrace_now());
+		progressDisplay_resume(st->display);
+	}
+
+	if(st->stopping){
+		drainSockets(st,ports,numPorts);
+	}
+
+	if(st->pipe){
+		stopPipeline(st);
+	}
+
+	progressDisplay_stop(st->display);
+	st->display = NULL;
+	if(st->timerfd >= 0){
+		close(st->timerfd);
+	}
+
+	st->closing = true;
+
+	while(st->tcpSessions){
+		endTcpSession(st,st->tcpSessions,"was still running");
+	}
+
+	tcpInfo_stopGroup(st->tcpInfo);
+	tcpInfo_closeCsv(st->tcpInfoCsv);
+
+	for(int p = 0; p < numPorts; p++){
+		struct portListener* l = &ports[p];
+
+		if(l->tcp){
+			continue;
+		}
+
+		for(uint32_t i = 0; i < l->table->maxSessions; i++){
+			if(l->table->sessions[i].active){
+				endSession(
+					st,l,&l->table->sessions[i],
+					"was still running"
+				);
+			}
+		}
+
+		if(l->rejected){
+			printf(
+				"Discarded %llu packets on port %u because the "
+				"session table was full\n",
+				(unsigned long long)l->rejected,l->port
+			);
+		}
+
+		sockDiag_stop(l->diag);
+		l->diag = NULL;
+		sessionTable_destroy(l->table);
+		if(l->txFd >= 0){
+			close(l->txFd);
+			l->txFd = -1;
+		}
+		l->table = NULL;
+	}
+
+	if(numPorts > 1){
+		printPortSummary(ports,numPorts);
+	}
+
+	if(st->campaign){
+		campaign_report(st->campaign);
+		campaign_destroy(st->campaign);
+	}
+
+	if(st->profile){
+		struct selfProfileSample end;
+		uint64_t packets = 0;
+
+		for(int p = 0; p < numPorts; p++){
+			packets += ports[p].packets;
+		}
+
+		selfProfile_read(st->profile,&end);
+		printf("Over the whole run:\n");
+		selfProfile_print(st->profile,&st->profStart,&end,packets,"packet");
+		selfProfile_close(st->profile);
+	}
+
+	close(st->epfd);
+	free(st);
+
+	return 0;
+}
@@ -0,0 +1,687 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Sends a stream of numbered packets to a client for downlink tests            *
+*                                                                              *
+* Every stream runs on its own thread. UDP packets are sent in sendmmsg()      *
+* batches paced either by a timerfd or by handing each packet's departure time *
+* to the kernel with SO_TXTIME. TCP streams are written as fast as the         *
+* connection allows (or at SO_MAX_PACING_RATE) using MSG_ZEROCOPY.            *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "txStream.h"
+#include "packetTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//with SO_TXTIME packets are handed to the kernel this far ahead of their
+//departure time
+#define TX_LOOKAHEAD_NS (2000000ULL)
+
+//longest the transmit thread sleeps before checking whether it must stop
+#define TX_MAX_SLEEP_NS (100000000ULL)
+
+//number of times the stop sequence is sent at the end of a UDP stream
+#define TX_STOP_REPEAT (8)
+
+//zero copy completions are collected after this many sends
+#define TX_ZC_DRAIN_EVERY (64)
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static bool stopRequested(struct txStream* tx);
+static void waitWritable(int fd);
+static void sleepUntil(int tfd, uint64_t deadline);
+static unsigned sendBatch(struct txStream* tx, uint64_t seq, unsigned n);
+static void sendUdp(struct txStream* tx);
+static void drainCompletions(struct txStream* tx);
+static void sendTcp(struct txStream* tx);
+static void* txThread(void* arg);
+static void printReport(const struct txStream* tx);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Returns true once txStream_stop() was called
+**/
+static bool stopRequested(struct txStream* tx){
+	return __atomic_load_n(&tx->stop,__ATOMIC_ACQUIRE);
+}
+/**
+* Waits (up to TX_MAX_SLEEP_NS) for a non-blocking socket to take more data
+**/
+static void waitWritable(int fd){
+	struct pollfd pfd = {fd,POLLOUT,0};
+
+	poll(&pfd,1,TX_MAX_SLEEP_NS/1000000ULL);
+}
+/**
+* Sleeps until the given CLOCK_MONOTONIC time using a timerfd
+**/
+static void sleepUntil(int tfd, uint64_t deadline){
+	struct itimerspec its;
+	uint64_t expirations;
+
+	memset(&its,0,sizeof(its));
+	its.it_value.tv_sec = deadline/1000000000ULL;
+	its.it_value.tv_nsec = deadline%1000000000ULL;
+
+	if(timerfd_settime(tfd,TFD_TIMER_ABSTIME,&its,NULL)){
+		return;
+	}
+
+	if(read(tfd,&expirations,sizeof(expirations)) < 0){
+		return;
+	}
+}
+/**
+* Sends the next n packets of a UDP stream with one sendmmsg() call
+*
+* Args:
+* tx - the stream
+* seq - sequence number of the first packet
+* n - number of packets, at most TX_BATCH
+*
+* Returns:
+* The number of packets which were sent.
+**/
+static unsigned sendBatch(struct txStream* tx, uint64_t seq, unsigned n){
+	struct mmsghdr msgs[TX_BATCH];
+	struct iovec iov[TX_BATCH];
+	uint8_t ctrl[TX_BATCH][CMSG_SPACE(sizeof(uint64_t))];
+
+	uint64_t now = packetTrace_now();
+
+	memset(msgs,0,n*sizeof(*msgs));
+
+	for(unsigned i = 0; i < n; i++){
+		uint8_t* buf = tx->data + i*tx->cfg.size;
+		uint32_t seqno = seq + i;
+		uint64_t departure = now;
+
+		buf[0] = (seqno >> 0 )&0xFF;
+		buf[1] = (seqno >> 8 )&0xFF;
+		buf[2] = (seqno >> 16)&0xFF;
+		buf[3] = (seqno >> 24)&0xFF;
+
+		iov[i].iov_base = buf;
+		iov[i].iov_len = tx->cfg.size;
+
+		msgs[i].msg_hdr.msg_name = &tx->addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(tx->addr);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+
+		if(tx->txtime){
+			departure = tx->startNs + (seq+i)*tx->intervalNs;
+
+			msgs[i].msg_hdr.msg_control = ctrl[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+
+			struct cmsghdr* cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+			cm->cmsg_level = SOL_SOCKET;
+			cm->cmsg_type = SCM_TXTIME;
+			cm->cmsg_len = CMSG_LEN(sizeof(departure));
+			memcpy(CMSG_DATA(cm),&departure,sizeof(departure));
+		}
+
+		__atomic_store_n(
+			&tx->sendTimes[seqno & (TX_TIME_SLOTS-1)],departure,
+			__ATOMIC_RELAXED
+		);
+	}
+
+	int rc = sendmmsg(tx->fd,msgs,n,0);
+
+	if(rc < 0){
+		if(errno == EAGAIN || errno == EWOULDBLOCK){
+			waitWritable(tx->fd);
+		}
+		else if(errno != EINTR && errno != ENOBUFS){
+			perror("Error sending downlink packets");
+			__atomic_store_n(&tx->stop,true,__ATOMIC_RELEASE);
+		}
+		return 0;
+	}
+
+	tx->calls += 1;
+	tx->sent += rc;
+	__atomic_store_n(
+		&tx->bytes,tx->bytes + ((uint64_t)rc)*tx->cfg.size,
+		__ATOMIC_RELAXED
+	);
+
+	return rc;
+}
+/**
+* Sends the numbered packets of a UDP stream until the duration has passed
+*
+* Packet i is due at startNs + i*intervalNs. With a timerfd the thread sleeps
+* until the next packet is due and then sends everything which is due in one
+* batch; the lateness of each batch is recorded. With SO_TXTIME every packet
+* carries its departure time and is handed over up to TX_LOOKAHEAD_NS early
+* so the kernel can release it on time.
+**/
+static void sendUdp(struct txStream* tx){
+	uint64_t end = tx->startNs + tx->cfg.durationS*1000000000ULL;
+	uint64_t total = tx->intervalNs ?
+		(end - tx->startNs + tx->intervalNs - 1)/tx->intervalNs :
+		UINT64_MAX;
+	uint64_t seq = 0;
+
+	int tfd = timerfd_create(CLOCK_MONOTONIC,TFD_CLOEXEC);
+	if(tfd < 0){
+		perror("Error creating pacing timer");
+		return;
+	}
+
+	while(!stopRequested(tx)){
+		uint64_t now = packetTrace_now();
+
+		if(now >= end || seq >= total){
+			break;
+		}
+
+		uint64_t n = TX_BATCH;
+
+		if(tx->intervalNs){
+			uint64_t horizon = tx->txtime ? now + TX_LOOKAHEAD_NS : now;
+			uint64_t due = (horizon - tx->startNs)/tx->intervalNs + 1;
+
+			if(due > total){
+				due = total;
+			}
+
+			n = (due > seq) ? due - seq : 0;
+			if(n > TX_BATCH){
+				n = TX_BATCH;
+			}
+		}
+
+		if(n){
+			if(tx->intervalNs && !tx->txtime){
+				uint64_t late = now - (tx->startNs + seq*tx->intervalNs);
+
+				tx->lateSum += late;
+				tx->lateCount += 1;
+				if(late > tx->lateMax){
+					tx->lateMax = late;
+				}
+			}
+
+			seq += sendBatch(tx,seq,n);
+			continue;
+		}
+
+		uint64_t next = tx->startNs + seq*tx->intervalNs;
+		if(tx->txtime){
+			next -= TX_LOOKAHEAD_NS/2;
+		}
+		if(next > now + TX_MAX_SLEEP_NS){
+			next = now + TX_MAX_SLEEP_NS;
+		}
+		if(next > end){
+			next = end;
+		}
+
+		sleepUntil(tfd,next);
+	}
+
+	tx->endNs = packetTrace_now();
+
+	close(tfd);
+
+	//the stop sequence is sent right away without a departure time
+	memset(tx->data,0xFF,tx->cfg.size);
+
+	for(int i = 0; i < TX_STOP_REPEAT; i++){
+		if(sendto(
+			tx->fd,tx->data,tx->cfg.size,0,
+			(struct sockaddr*)&tx->addr,sizeof(tx->addr)) < 0){
+
+			waitWritable(tx->fd);
+		}
+	}
+}
+/**
+* Collects the MSG_ZEROCOPY completion notifications of a TCP stream
+*
+* The notifications must be read or the socket runs out of option memory and
+* further zero copy sends fail with ENOBUFS.
+**/
+static void drainCompletions(struct txStream* tx){
+	uint8_t ctrl[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+
+	while(1){
+		struct msghdr msg;
+
+		memset(&msg,0,sizeof(msg));
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+
+		if(recvmsg(tx->fd,&msg,MSG_ERRQUEUE) < 0){
+			return;
+		}
+
+		struct cmsghdr* cm;
+		for(cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg,cm)){
+			struct sock_extended_err ee;
+
+			if(!((cm->cmsg_level == SOL_IP &&
+				cm->cmsg_type == IP_RECVERR) ||
+				(cm->cmsg_level == SOL_IPV6 &&
+				cm->cmsg_type == IPV6_RECVERR))){
+
+				continue;
+			}
+
+			memcpy(&ee,CMSG_DATA(cm),sizeof(ee));
+
+			if(ee.ee_errno || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY){
+				continue;
+			}
+
+			uint64_t count = ((uint64_t)ee.ee_data) - ee.ee_info + 1;
+
+			tx->zcCompleted += count;
+			if(ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED){
+				tx->zcCopied += count;
+			}
+		}
+	}
+}
+/**
+* Writes to a TCP connection until the duration has passed
+*
+* With a rate the writes are paced with a timerfd so the socket buffer does
+* not soak up data faster than the rate, while SO_MAX_PACING_RATE spreads the
+* segments of each write out on the wire.
+*
+* The payload buffer is never modified, so it can be handed to the next zero
+* copy send before the kernel has finished with the previous one.
+**/
+static void sendTcp(struct txStream* tx){
+	uint64_t end = tx->startNs + tx->cfg.durationS*1000000000ULL;
+	int flags = MSG_NOSIGNAL;
+	int tfd = -1;
+
+	if(tx->cfg.rateKibps){
+		unsigned rate = tx->cfg.rateKibps*128;
+
+		if(setsockopt(
+			tx->fd,SOL_SOCKET,SO_MAX_PACING_RATE,&rate,sizeof(rate))){
+
+			perror("Unable to set SO_MAX_PACING_RATE");
+		}
+
+		tfd = timerfd_create(CLOCK_MONOTONIC,TFD_CLOEXEC);
+		if(tfd < 0){
+			perror("Error creating pacing timer");
+		}
+	}
+
+	int on = 1;
+	if(!setsockopt(tx->fd,SOL_SOCKET,SO_ZEROCOPY,&on,sizeof(on))){
+		tx->zerocopy = true;
+		flags |= MSG_ZEROCOPY;
+	}
+
+	while(!stopRequested(tx)){
+		uint64_t now = packetTrace_now();
+
+		if(now >= end){
+			break;
+		}
+
+		if(tfd >= 0){
+			uint64_t due = tx->startNs +
+				tx->bytes*tx->intervalNs/tx->cfg.size;
+
+			if(due > now){
+				if(due > now + TX_MAX_SLEEP_NS){
+					due = now + TX_MAX_SLEEP_NS;
+				}
+				sleepUntil(tfd,(due > end) ? end : due);
+				continue;
+			}
+		}
+
+		int rc = send(tx->fd,tx->data,tx->cfg.size,flags);
+
+		if(rc < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == ENOBUFS){
+
+				if(tx->zerocopy){
+					drainCompletions(tx);
+				}
+				waitWritable(tx->fd);
+				continue;
+			}
+			if(errno == EINTR){
+				continue;
+			}
+			if(errno != EPIPE && errno != ECONNRESET){
+				perror("Error sending downlink data");
+			}
+			break;
+		}
+
+		tx->calls += 1;
+		tx->sent += 1;
+		__atomic_store_n(&tx->bytes,tx->bytes + rc,__ATOMIC_RELAXED);
+
+		if(tx->zerocopy && !(tx->calls % TX_ZC_DRAIN_EVERY)){
+			drainCompletions(tx);
+		}
+	}
+
+	tx->endNs = packetTrace_now();
+
+	if(tfd >= 0){
+		close(tfd);
+	}
+
+	shutdown(tx->fd,SHUT_WR);
+}
+/**
+* Transmit thread entry point
+*
+* Sends the stream, then waits TX_ACK_GRACE_MS for late acknowledgements
+* before reporting that it is done.
+**/
+static void* txThread(void* arg){
+	struct txStream* tx = arg;
+
+	tx->startNs = packetTrace_now();
+
+	if(tx->tcp){
+		sendTcp(tx);
+	}
+	else{
+		sendUdp(tx);
+	}
+
+	uint64_t grace = packetTrace_now() + TX_ACK_GRACE_MS*1000000ULL;
+
+	while(!stopRequested(tx) && packetTrace_now() < grace){
+		if(tx->zerocopy){
+			drainCompletions(tx);
+		}
+
+		struct timespec ts = {0,10000000};
+		nanosleep(&ts,NULL);
+	}
+
+	__atomic_store_n(&tx->done,true,__ATOMIC_RELEASE);
+
+	return NULL;
+}
+/**
+* Starts sending a stream to a client
+*
+* Args:
+* fd - socket to send on, a connected TCP socket or a UDP socket
+* tcp - set true if fd is a TCP socket
+* addr - address of the client, used for UDP
+* cfg - what to send
+*
+* Returns:
+* The running stream or NULL on error (an error message will be printed).
+**/
+struct txStream* txStream_start(
+	int fd, bool tcp, const struct sockaddr_in6* addr,
+	const struct txConfig* cfg
+){
+	struct txStream* tx = calloc(1,sizeof(*tx));
+
+	if(!tx){
+		perror("Error allocating downlink stream");
+		return NULL;
+	}
+
+	tx->fd = fd;
+	tx->tcp = tcp;
+	tx->addr = *addr;
+	tx->cfg = *cfg;
+	tx->rttMin = UINT64_MAX;
+
+	if(!tx->cfg.size){
+		tx->cfg.size = tcp ? TX_TCP_DEFAULT_SIZE : TX_UDP_DEFAULT_SIZE;
+	}
+
+	if(tx->cfg.rateKibps){
+		tx->intervalNs = ((uint64_t)tx->cfg.size)*1000000000ULL/
+			(tx->cfg.rateKibps*128ULL);
+	}
+
+	if(!tcp && tx->cfg.txtime && tx->intervalNs){
+		struct sock_txtime txtime;
+
+		memset(&txtime,0,sizeof(txtime));
+		txtime.clockid = CLOCK_MONOTONIC;
+
+		if(setsockopt(fd,SOL_SOCKET,SO_TXTIME,&txtime,sizeof(txtime))){
+			perror("Unable to enable SO_TXTIME, pacing with a timer");
+		}
+		else{
+			tx->txtime = true;
+		}
+	}
+
+	tx->data = calloc(tcp ? 1 : TX_BATCH,tx->cfg.size);
+	tx->sendTimes = calloc(TX_TIME_SLOTS,sizeof(*tx->sendTimes));
+
+	if(!tx->data || !tx->sendTimes){
+		perror("Error allocating downlink stream");
+		free(tx->data);
+		free(tx->sendTimes);
+		free(tx);
+		return NULL;
+	}
+
+	if(pthread_create(&tx->thread,NULL,txThread,tx)){
+		perror("Error starting downlink stream");
+		free(tx->data);
+		free(tx->sendTimes);
+		free(tx);
+		return NULL;
+	}
+
+	return tx;
+}
+/**
+* Returns true once the stream has been sent and the acknowledgement grace
+* period is over
+**/
+bool txStream_done(struct txStream* tx){
+	return __atomic_load_n(&tx->done,__ATOMIC_ACQUIRE);
+}
+/**
+* Accounts for an acknowledgement of a packet of the stream
+*
+* Send times are kept for the last TX_TIME_SLOTS packets, older packets are
+* counted but give no round trip time.
+*
+* Args:
+* tx - the stream
+* seqno - sequence number which was acknowledged
+* now - time the acknowledgement was received
+*
+* Returns:
+* The time the packet was sent or zero if it is not known.
+**/
+uint64_t txStream_ack(struct txStream* tx, uint32_t seqno, uint64_t now){
+	uint64_t sentAt = __atomic_exchange_n(
+		&tx->sendTimes[seqno & (TX_TIME_SLOTS-1)],0,__ATOMIC_RELAXED
+	);
+
+	seqStats_update(&tx->acks,seqno);
+
+	if(!sentAt || sentAt > now){
+		return 0;
+	}
+
+	uint64_t rtt = now - sentAt;
+
+	tx->rttCount += 1;
+	tx->rttSum += rtt;
+	if(rtt < tx->rttMin){
+		tx->rttMin = rtt;
+	}
+	if(rtt > tx->rttMax){
+		tx->rttMax = rtt;
+	}
+
+	return sentAt;
+}
+/**
+* Prints the results of a stream
+**/
+static void printReport(const struct txStream* tx){
+	uint64_t ns = tx->endNs - tx->startNs;
+	double throughput = ns ? (tx->bytes/128.0)/(0.000000001*ns) : 0.0;
+
+	printf(
+		"Sent %llu %s (%llu bytes) in %.3f s\n",
+		(unsigned long long)tx->sent,tx->tcp ? "writes" : "packets",
+		(unsigned long long)tx->bytes,ns/1000000000.0
+	);
+	if(tx->cfg.rateKibps){
+		printf(
+			"Downlink throughput was ~ %lf kib/s (target %u kib/s)\n",
+			throughput,tx->cfg.rateKibps
+		);
+	}
+	else{
+		printf("Downlink throughput was ~ %lf kib/s\n",throughput);
+	}
+
+	if(tx->tcp){
+		if(tx->zerocopy){
+			printf(
+				"Zero copy: %llu of %llu sends completed, %llu "
+				"copied by the kernel\n",
+				(unsigned long long)tx->zcCompleted,
+				(unsigned long long)tx->sent,
+				(unsigned long long)tx->zcCopied
+			);
+		}
+		return;
+	}
+
+	if(tx->txtime){
+		printf(
+			"Paced by the kernel with SO_TXTIME, %llu sendmmsg calls\n",
+			(unsigned long long)tx->calls
+		);
+	}
+	else if(tx->lateCount){
+		printf(
+			"Paced with a timer, %llu sendmmsg calls, lateness "
+			"mean/max %.1f/%.1f us\n",(unsigned long long)tx->calls,
+			tx->lateSum/1000.0/tx->lateCount,tx->lateMax/1000.0
+		);
+	}
+
+	if(tx->acks.received){
+		uint64_t acked = tx->acks.received - tx->acks.late;
+		uint64_t lost = (tx->sent > acked) ? tx->sent - acked : 0;
+
+		printf(
+			"Acked %llu of %llu packets, %llu lost (%.3f%%), %llu "
+			"reordered or duplicated\n",(unsigned long long)acked,
+			(unsigned long long)tx->sent,(unsigned long long)lost,
+			tx->sent ? 100.0*lost/tx->sent : 0.0,
+			(unsigned long long)tx->acks.late
+		);
+	}
+	if(tx->rttMax){
+		printf(
+			"Round trip min/avg/max: %.3f/%.3f/%.3f ms\n",
+			tx->rttMin/1000000.0,
+			tx->rttSum/1000000.0/tx->rttCount,
+			tx->rttMax/1000000.0
+		);
+	}
+}
+/**
+* Returns the number of bytes sent so far, may be called from any thread
+*
+* Returns zero if tx is NULL.
+**/
+uint64_t txStream_bytes(struct txStream* tx){
+	if(!tx){
+		return 0;
+	}
+
+	return __atomic_load_n(&tx->bytes,__ATOMIC_RELAXED);
+}
+/**
+* Stops the stream if it is still sending, waits for its thread, prints the
+* results and frees it
+*
+* Returns:
+* The number of bytes the stream sent, zero if tx is NULL.
+**/
+uint64_t txStream_stop(struct txStream* tx){
+	if(!tx){
+		return 0;
+	}
+
+	__atomic_store_n(&tx->stop,true,__ATOMIC_RELEASE);
+	pthread_join(tx->thread,NULL);
+
+	printReport(tx);
+
+	uint64_t bytes = tx->bytes;
+
+	free(tx->data);
+	free(tx->sendTimes);
+	free(tx);
+
+	return bytes;
+}
@@ -0,0 +1,788 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Multi connection TCP load client for the throughput server                   *
+*                                                                              *
+* Opens any number of parallel connections, spread over a few threads which    *
+* each drive their share with epoll, and streams on all of them for a fixed    *
+* byte count or duration. Each connection ends with a shutdown of its sending  *
+* side, the zero length read the server takes as the end of a session.         *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "packetTrace.h"
+#include "throughputServer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <netdb.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+#define DEFAULT_DURATION_S 10
+#define DEFAULT_WRITE_SIZE (128*1024)
+
+#define MAX_THREADS 256
+#define MAX_CONNECTIONS 65536
+
+//writes made on one connection before the others get a turn
+#define WRITE_BUDGET 16
+
+//how long the server gets to close its side once everything was sent
+#define LINGER_MS 5000
+
+#define EVENT_BATCH 64
+#define WAIT_MS 100
+/*******************************************************************************
+*                                     ENUMS                                    *
+*******************************************************************************/
+enum connState {CONN_CONNECTING, CONN_SENDING, CONN_CLOSING, CONN_DONE};
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+/**
+* What every connection sends, shared read only by all threads
+**/
+struct loadConfig{
+	struct sockaddr_storage addr;
+	socklen_t addrLen;
+
+	uint64_t bytes;
+	uint64_t durationNs;
+	unsigned writeSize;
+	bool zerocopy;
+
+	uint8_t* data;
+};
+
+/**
+* One connection, owned by the thread which drives it
+**/
+struct loadConn{
+	int fd;
+	enum connState state;
+	bool zerocopy;
+
+	uint64_t startNs;
+	uint64_t endNs;
+	uint64_t bytes;
+	uint64_t writes;
+
+	uint64_t zcCompleted;
+	uint64_t zcCopied;
+
+	int err;
+};
+
+struct loadThread{
+	pthread_t thread;
+	const struct loadConfig* cfg;
+
+	struct loadConn* conns;
+	int numConns;
+
+	//connections the server did not close within LINGER_MS
+	int lingering;
+	int err;
+};
+/*******************************************************************************
+*                                     DATA                                     *
+*******************************************************************************/
+static const char* HELP="Streams TCP data to the throughput server over\n"
+"parallel connections\n"
+"\n"
+"Usage:\n"
+"%s %s\n"
+"Options:\n"
+"-c,--connections n\n"
+"                 Number of parallel connections. Defaults to 1.\n"
+"-j,--threads n   Number of threads driving the connections. Defaults to\n"
+"                 1.\n"
+"-n,--bytes n     Send n bytes on every connection (K, M and G suffixes\n"
+"                 multiply by 1024). Without it every connection sends for\n"
+"                 the duration.\n"
+"-t,--duration s  Send for at most s seconds. Defaults to 10 without\n"
+"                 --bytes.\n"
+"-w,--write-size bytes\n"
+"                 Size of each write. Defaults to 131072.\n"
+"-z,--zerocopy    Send with MSG_ZEROCOPY.\n"
+"-v,--verbose     Print the results of every connection.\n";
+
+static const char* USAGE="[-h] [-c n] [-j n] [-n bytes] [-t s] [-w bytes]\n"
+"       [-z] [-v] HOST PORT";
+
+static const char* ARG_ERR="Try -h or --help to get help text";
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static uint64_t parseSize(const char* str);
+static void openConn(
+	struct loadThread* t, int epfd, struct loadConn* c
+);
+static void endConn(int epfd, struct loadConn* c, int err);
+static void drainCompletions(struct loadConn* c);
+static void sendConn(
+	const struct loadConfig* cfg, int epfd, struct loadConn* c,
+	uint64_t now
+);
+static void closeConn(int epfd, struct loadConn* c);
+static void* loadThread(void* arg);
+static int compareDouble(const void* a, const void* b);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Parses a byte count with an optional K, M or G suffix
+*
+* Returns:
+* The byte count or zero if str is not valid.
+**/
+static uint64_t parseSize(const char* str){
+	char* endptr;
+	uint64_t n = strtoull(str,&endptr,10);
+
+	switch(*endptr){
+	case 'G':
+		n *= 1024;
+		//fall through
+	case 'M':
+		n *= 1024;
+		//fall through
+	case 'K':
+		n *= 1024;
+		endptr += 1;
+		break;
+	}
+
+	return *endptr ? 0 : n;
+}
+/**
+* Starts a non-blocking connect and watches the connection
+**/
+static void openConn(struct loadThread* t, int epfd, struct loadConn* c){
+	const struct loadConfig* cfg = t->cfg;
+
+	c->fd = socket(
+		cfg->addr.ss_family,SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0
+	);
+	if(c->fd < 0){
+		c->err = errno;
+		c->state = CONN_DONE;
+		return;
+	}
+
+	int on = 1;
+	if(cfg->zerocopy){
+		c->zerocopy = !setsockopt(
+			c->fd,SOL_SOCKET,SO_ZEROCOPY,&on,sizeof(on)
+		);
+	}
+
+	if(connect(c->fd,(const struct sockaddr*)&cfg->addr,cfg->addrLen) &&
+		errno != EINPROGRESS){
+
+		endConn(epfd,c,errno);
+		return;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLOUT | EPOLLIN;
+	ev.data.ptr = c;
+
+	if(epoll_ctl(epfd,EPOLL_CTL_ADD,c->fd,&ev)){
+		endConn(epfd,c,errno);
+		return;
+	}
+
+	c->state = CONN_CONNECTING;
+}
+/**
+* Closes a connection for good
+*
+* Args:
+* epfd - epoll instance of the thread
+* c - the connection
+* err - errno of the failure which ended it, zero if it ended normally
+**/
+static void endConn(int epfd, struct loadConn* c, int err){
+	if(c->state == CONN_SENDING){
+		c->endNs = packetTrace_now();
+	}
+
+	if(c->zerocopy){
+		drainCompletions(c);
+	}
+
+	epoll_ctl(epfd,EPOLL_CTL_DEL,c->fd,NULL);
+	close(c->fd);
+
+	c->err = err;
+	c->state = CONN_DONE;
+}
+/**
+* Collects the MSG_ZEROCOPY completion notifications of a connection
+*
+* The notifications must be read or the socket runs out of option memory and
+* further zero copy sends fail with ENOBUFS.
+**/
+static void drainCompletions(struct loadConn* c){
+	uint8_t ctrl[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+
+	while(1){
+		struct msghdr msg;
+
+		memset(&msg,0,sizeof(msg));
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+
+		if(recvmsg(c->fd,&msg,MSG_ERRQUEUE) < 0){
+			return;
+		}
+
+		struct cmsghdr* cm;
+		for(cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg,cm)){
+			struct sock_extended_err ee;
+
+			if(!((cm->cmsg_level == SOL_IP &&
+				cm->cmsg_type == IP_RECVERR) ||
+				(cm->cmsg_level == SOL_IPV6 &&
+				cm->cmsg_type == IPV6_RECVERR))){
+
+				continue;
+			}
+
+			memcpy(&ee,CMSG_DATA(cm),sizeof(ee));
+
+			if(ee.ee_errno || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY){
+				continue;
+			}
+
+			uint64_t count = ((uint64_t)ee.ee_data) - ee.ee_info + 1;
+
+			c->zcCompleted += count;
+			if(ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED){
+				c->zcCopied += count;
+			}
+		}
+	}
+}
+/**
+* Writes to a writable connection and shuts its sending side down once it has
+* sent everything
+*
+* The payload buffer is never modified, so it can be handed to the next zero
+* copy send before the kernel has finished with the previous one.
+**/
+static void sendConn(
+	const struct loadConfig* cfg, int epfd, struct loadConn* c,
+	uint64_t now
+){
+	int flags = MSG_NOSIGNAL | (c->zerocopy ? MSG_ZEROCOPY : 0);
+	bool finished = now - c->startNs >= cfg->durationNs;
+
+	for(int i = 0; i < WRITE_BUDGET && !finished; i++){
+		uint64_t len = cfg->writeSize;
+
+		if(cfg->bytes && cfg->bytes - c->bytes < len){
+			len = cfg->bytes - c->bytes;
+		}
+
+		int rc = send(c->fd,cfg->data,len,flags);
+
+		if(rc < 0){
+			if(errno == ENOBUFS && c->zerocopy){
+				drainCompletions(c);
+				break;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR){
+
+				break;
+			}
+			endConn(epfd,c,errno);
+			return;
+		}
+
+		c->bytes += rc;
+		c->writes += 1;
+
+		finished = cfg->bytes && c->bytes >= cfg->bytes;
+	}
+
+	if(!finished){
+		return;
+	}
+
+	//the server ends the session on the zero length read this causes
+	c->endNs = packetTrace_now();
+	shutdown(c->fd,SHUT_WR);
+	c->state = CONN_CLOSING;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	epoll_ctl(epfd,EPOLL_CTL_MOD,c->fd,&ev);
+}
+/**
+* Reads and discards whatever the server sends after the shutdown until it
+* closes its side
+**/
+static void closeConn(int epfd, struct loadConn* c){
+	uint8_t buf[4096];
+
+	while(1){
+		ssize_t rc = read(c->fd,buf,sizeof(buf));
+
+		if(rc > 0){
+			continue;
+		}
+		if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+			errno == EINTR)){
+
+			return;
+		}
+
+		endConn(epfd,c,(rc < 0 && errno != ECONNRESET) ? errno : 0);
+		return;
+	}
+}
+/**
+* Thread entry point, drives a share of the connections until all of them are
+* done
+**/
+static void* loadThread(void* arg){
+	struct loadThread* t = arg;
+	struct epoll_event events[EVENT_BATCH];
+
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd < 0){
+		t->err = errno;
+		return NULL;
+	}
+
+	for(int i = 0; i < t->numConns; i++){
+		openConn(t,epfd,&t->conns[i]);
+	}
+
+	uint64_t lingerEnd = 0;
+
+	while(1){
+		int open = 0;
+		int sending = 0;
+
+		for(int i = 0; i < t->numConns; i++){
+			open += t->conns[i].state != CONN_DONE;
+			sending += t->conns[i].state < CONN_CLOSING;
+		}
+
+		if(!open){
+			break;
+		}
+
+		uint64_t now = packetTrace_now();
+
+		if(!sending && !lingerEnd){
+			lingerEnd = now + LINGER_MS*1000000ULL;
+		}
+		if(lingerEnd && now >= lingerEnd){
+			t->lingering = open;
+			for(int i = 0; i < t->numConns; i++){
+				if(t->conns[i].state != CONN_DONE){
+					endConn(epfd,&t->conns[i],0);
+				}
+			}
+			break;
+		}
+
+		int n = epoll_wait(epfd,events,EVENT_BATCH,WAIT_MS);
+		if(n < 0 && errno != EINTR){
+			t->err = errno;
+			break;
+		}
+
+		now = packetTrace_now();
+
+		for(int i = 0; i < n; i++){
+			struct loadConn* c = events[i].data.ptr;
+			int err = 0;
+			socklen_t len = sizeof(err);
+
+			if((events[i].events & EPOLLERR) && c->zerocopy){
+				drainCompletions(c);
+			}
+
+			switch(c->state){
+			case CONN_CONNECTING:
+				if(getsockopt(c->fd,SOL_SOCKET,SO_ERROR,&err,&len)){
+					err = errno;
+				}
+				if(err){
+					endConn(epfd,c,err);
+					break;
+				}
+				c->state = CONN_SENDING;
+				c->startNs = now;
+				//fall through
+			case CONN_SENDING:
+				if(events[i].events & EPOLLOUT){
+					sendConn(t->cfg,epfd,c,now);
+				}
+				if(c->state != CONN_SENDING ||
+					!(events[i].events & (EPOLLIN|EPOLLHUP))){
+
+					break;
+				}
+				//the server closed the connection early
+				//fall through
+			case CONN_CLOSING:
+				closeConn(epfd,c);
+				break;
+			case CONN_DONE:
+				break;
+			}
+		}
+
+		//connections which are not writable still end on time
+		for(int i = 0; i < t->numConns; i++){
+			struct loadConn* c = &t->conns[i];
+
+			if(c->state == CONN_SENDING &&
+				now - c->startNs >= t->cfg->durationNs){
+
+				sendConn(t->cfg,epfd,c,now);
+			}
+		}
+	}
+
+	close(epfd);
+
+	return NULL;
+}
+/**
+* qsort() comparison of doubles
+**/
+static int compareDouble(const void* a, const void* b){
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+/**
+* Program entry point
+*
+* Args:
+* argc - program argument count
+* argv - program arguments
+*
+* Returns:
+* Program exit code.
+**/
+int main(int argc, char** argv){
+	long numConns = 1;
+	long numThreads = 1;
+	uint64_t bytes = 0;
+	long durationS = 0;
+	long writeSize = DEFAULT_WRITE_SIZE;
+	bool zerocopy = false;
+	bool verbose = false;
+
+	int lopt_ind = 0;
+	int c;
+
+	const char* shopts = "hc:j:n:t:w:zv";
+	struct option lopts[] = {
+		{"help",0,NULL,'h'},
+		{"connections",1,NULL,'c'},
+		{"threads",1,NULL,'j'},
+		{"bytes",1,NULL,'n'},
+		{"duration",1,NULL,'t'},
+		{"write-size",1,NULL,'w'},
+		{"zerocopy",0,NULL,'z'},
+		{"verbose",0,NULL,'v'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while( (c = getopt_long(argc, argv,shopts,lopts,&lopt_ind)) != -1 ){
+		char* endptr;
+
+		switch(c){
+		case 'h':
+			printf(HELP,argv[0],USAGE);
+			exit(0);
+			break;
+		case 'c':
+			numConns = strtol(optarg,&endptr,10);
+			if(*endptr || numConns < 1 || numConns > MAX_CONNECTIONS){
+				fprintf(stderr,"Invalid connection count!\n");
+				exit(-1);
+			}
+			break;
+		case 'j':
+			numThreads = strtol(optarg,&endptr,10);
+			if(*endptr || numThreads < 1 || numThreads > MAX_THREADS){
+				fprintf(stderr,"Invalid thread count!\n");
+				exit(-1);
+			}
+			break;
+		case 'n':
+			bytes = parseSize(optarg);
+			if(!bytes){
+				fprintf(stderr,"Invalid byte count!\n");
+				exit(-1);
+			}
+			break;
+		case 't':
+			durationS = strtol(optarg,&endptr,10);
+			if(*endptr || durationS < 1){
+				fprintf(stderr,"Invalid duration!\n");
+				exit(-1);
+			}
+			break;
+		case 'w':
+			writeSize = strtol(optarg,&endptr,10);
+			if(*endptr || writeSize < 1 || writeSize > (1<<30)){
+				fprintf(stderr,"Invalid write size!\n");
+				exit(-1);
+			}
+			break;
+		case 'z':
+			zerocopy = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			printf("%s %s\n",argv[0],USAGE);
+			printf("%s\n",ARG_ERR);
+			exit(-1);
+		}
+	}
+
+	if(optind != argc-2){
+		printf("%s %s\n",argv[0],USAGE);
+		printf("%s\n",ARG_ERR);
+		exit(-1);
+	}
+
+	if(numThreads > numConns){
+		numThreads = numConns;
+	}
+
+	struct loadConfig cfg;
+	memset(&cfg,0,sizeof(cfg));
+
+	struct addrinfo hints;
+	struct addrinfo* res;
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	int rc = getaddrinfo(argv[optind],argv[optind+1],&hints,&res);
+	if(rc){
+		fprintf(
+			stderr,"Unable to resolve %s port %s: %s\n",argv[optind],
+			argv[optind+1],gai_strerror(rc)
+		);
+		exit(-1);
+	}
+	memcpy(&cfg.addr,res->ai_addr,res->ai_addrlen);
+	cfg.addrLen = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	//without a byte count the duration always applies
+	if(!durationS && !bytes){
+		durationS = DEFAULT_DURATION_S;
+	}
+	cfg.bytes = bytes;
+	cfg.durationNs = durationS ? durationS*1000000000ULL : ~0ULL;
+	cfg.writeSize = writeSize;
+	cfg.zerocopy = zerocopy;
+
+	cfg.data = calloc(1,writeSize);
+	struct loadConn* conns = calloc(numConns,sizeof(*conns));
+	struct loadThread* threads = calloc(numThreads,sizeof(*threads));
+	if(!cfg.data || !conns || !threads){
+		perror("Error allocating connections");
+		exit(-1);
+	}
+
+	long first = 0;
+	for(long i = 0; i < numThreads; i++){
+		threads[i].cfg = &cfg;
+		threads[i].conns = conns + first;
+		threads[i].numConns = numConns/numThreads +
+			(i < numConns%numThreads);
+		first += threads[i].numConns;
+
+		if(pthread_create(&threads[i].thread,NULL,loadThread,&threads[i])){
+			perror("Error creating thread");
+			exit(-1);
+		}
+	}
+
+	int lingering = 0;
+	for(long i = 0; i < numThreads; i++){
+		pthread_join(threads[i].thread,NULL);
+
+		if(threads[i].err){
+			fprintf(
+				stderr,"Error driving connections: %s\n",
+				strerror(threads[i].err)
+			);
+			exit(-1);
+		}
+		lingering += threads[i].lingering;
+	}
+
+	double* rates = calloc(numConns,sizeof(*rates));
+	if(!rates){
+		perror("Error allocating results");
+		exit(-1);
+	}
+
+	uint64_t total = 0;
+	uint64_t startNs = ~0ULL;
+	uint64_t endNs = 0;
+	uint64_t zcCompleted = 0;
+	uint64_t zcCopied = 0;
+	double sum = 0;
+	double sumSquares = 0;
+	long failed = 0;
+	long measured = 0;
+
+	if(verbose){
+		printf(
+			"%10s %14s %10s %14s\n","connection","bytes","time s","kib/s"
+		);
+	}
+
+	for(long i = 0; i < numConns; i++){
+		struct loadConn* c = &conns[i];
+
+		if(c->err){
+			fprintf(
+				stderr,"Connection %ld failed: %s\n",i,
+				strerror(c->err)
+			);
+			failed += 1;
+		}
+		if(!c->startNs){
+			continue;
+		}
+
+		double rate = throughputServer_calcThroughput(
+			c->bytes,c->endNs - c->startNs
+		);
+
+		if(verbose){
+			printf(
+				"%10ld %14llu %10.3f %14.3f\n",i,
+				(unsigned long long)c->bytes,
+				(c->endNs - c->startNs)/1e9,rate
+			);
+		}
+
+		rates[measured++] = rate;
+		sum += rate;
+		sumSquares += rate*rate;
+		total += c->bytes;
+		zcCompleted += c->zcCompleted;
+		zcCopied += c->zcCopied;
+		if(c->startNs < startNs){
+			startNs = c->startNs;
+		}
+		if(c->endNs > endNs){
+			endNs = c->endNs;
+		}
+	}
+
+	if(!measured){
+		fprintf(stderr,"No connection was established!\n");
+		exit(-1);
+	}
+
+	qsort(rates,measured,sizeof(*rates),compareDouble);
+
+	printf(
+		"Sent %llu bytes over %ld connections in %.3f s\n",
+		(unsigned long long)total,measured,(endNs - startNs)/1e9
+	);
+	printf(
+		"Throughput was ~ %lf kib/s\n",
+		throughputServer_calcThroughput(total,endNs - startNs)
+	);
+	printf(
+		"Per connection kib/s: min %.3f, median %.3f, max %.3f\n",
+		rates[0],rates[measured/2],rates[measured-1]
+	);
+	//1 when every connection got the same share, 1/n when one got all
+	printf(
+		"Fairness index (Jain) %.4f\n",
+		sumSquares ? sum*sum/(measured*sumSquares) : 1.0
+	);
+
+	if(zerocopy){
+		printf(
+			"Zero copy sends completed: %llu, copied by the kernel: "
+			"%llu\n",(unsigned long long)zcCompleted,
+			(unsigned long long)zcCopied
+		);
+	}
+	if(failed){
+		printf("%ld connections failed\n",failed);
+	}
+	if(lingering){
+		printf(
+			"%d connections were not closed by the server within %d "
+			"ms\n",lingering,LINGER_MS
+		);
+	}
+
+	free(rates);
+	free(threads);
+	free(conns);
+	free(cfg.data);
+
+	return failed ? -1 : 0;
+}
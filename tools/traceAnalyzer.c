@@ -0,0 +1,1007 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Offline analyzer for traces recorded with the --trace option of the server   *
+*                                                                              *
+* The trace is split into one contiguous chunk of records per thread. Each     *
+* thread streams through its chunk a mapped window at a time (so traces larger *
+* than RAM work) and gathers its own statistics which are merged in order once *
+* all threads are done.                                                        *
+*                                                                              *
+* A first pass finds the time range and the highest sequence number of every  *
+* session in each chunk so the second pass can bin every record and judge      *
+* reordering as if the trace was read in one go. Replies matching packets sent *
+* in an earlier chunk are picked up while merging, so the results do not       *
+* depend on the number of threads.                                             *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "packetTrace.h"
+#include "serverStrStuff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//bytes of the trace mapped at once by each thread
+#define ANALYZE_WINDOW_SIZE (64*1024*1024)
+
+//histograms use power of two buckets of nanoseconds
+#define HIST_BUCKETS 64
+
+//sent packets remembered per thread for matching replies to them
+#define RTT_TABLE_SIZE (1<<16)
+
+//sessions ids above this are assumed to be corrupt
+#define MAX_SESSIONS (1<<20)
+
+#define MAX_THREADS 256
+
+#define DEFAULT_BIN_MS 1000
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+struct sessionStats{
+	bool seen;
+	bool tcp;
+
+	uint64_t packets;
+	uint64_t bytes;
+
+	uint64_t seqPackets;
+	uint32_t minSeq;
+	uint32_t maxSeq;
+	uint64_t reordered;
+
+	uint64_t firstTs;
+	uint64_t lastTs;
+};
+
+struct rttEntry{
+	uint64_t timestamp;
+	uint32_t session;
+	uint32_t seqno;
+};
+
+struct chunkWork{
+	int fd;
+	uint64_t first;
+	uint64_t count;
+
+	uint64_t binNs;
+	uint64_t traceStart;
+
+	//time range of the chunk, found by the first pass
+	uint64_t minTs;
+	uint64_t maxTs;
+
+	//highest sequence number of each session in the chunks before this one
+	struct sessionStats* carry;
+	uint32_t numCarry;
+
+	//per thread results
+	struct sessionStats* sessions;
+	uint32_t numSessions;
+
+	uint64_t iatHist[HIST_BUCKETS];
+	uint64_t rttHist[HIST_BUCKETS];
+
+	uint64_t binBase;
+	uint64_t numBins;
+	uint64_t* binBytes;
+	uint64_t* binPackets;
+
+	//sent packets not yet matched and the slots written by this chunk, a
+	//reply at a slot not yet written may match a packet of an earlier chunk
+	struct rttEntry* rttTable;
+	uint8_t* rttTouched;
+	uint64_t lastUntouched;
+
+	int err;
+};
+
+/**
+* Matches replies at the start of a chunk to packets sent in earlier chunks
+*
+* table holds the unmatched packets left by all earlier chunks and live counts
+* those which the chunk has not yet replaced.
+**/
+struct rttFixup{
+	struct rttEntry* table;
+	uint8_t* touched;
+	uint64_t live;
+	uint64_t* rttHist;
+};
+
+//handles one record of a chunk, returns false to stop early
+typedef bool (*recordFn)(
+	void* arg, const struct traceRecord* rec, uint64_t index
+);
+/*******************************************************************************
+*                                     DATA                                     *
+*******************************************************************************/
+static const char* HELP="Analyzes a trace recorded by the test server\n"
+"\n"
+"Usage:\n"
+"%s %s\n"
+"Options:\n"
+"-j,--threads n   Number of threads to use. Defaults to the number of online\n"
+"                 cpus.\n"
+"-b,--bin ms      Width of the throughput time series bins in milliseconds.\n"
+"                 Defaults to 1000.\n"
+"-o,--series FILE Write the throughput time series to FILE as csv.\n";
+
+static const char* USAGE="[-h] [-j n] [-b ms] [-o FILE] TRACE";
+
+static const char* ARG_ERR="Try -h or --help to get help text";
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static int log2Bucket(uint64_t ns);
+static uint32_t rttSlot(const struct traceRecord* rec);
+static bool hasSeq(const struct traceRecord* rec);
+static struct sessionStats* getSession(struct chunkWork* w, uint32_t id);
+static int scanRecords(
+	int fd, uint64_t first, uint64_t count, recordFn fn, void* arg
+);
+static bool rangeRecord(
+	void* arg, const struct traceRecord* rec, uint64_t index
+);
+static bool analyzeRecord(
+	void* arg, const struct traceRecord* rec, uint64_t index
+);
+static bool fixupRecord(
+	void* arg, const struct traceRecord* rec, uint64_t index
+);
+static void* rangeChunk(void* arg);
+static void* analyzeChunk(void* arg);
+static void runChunks(
+	struct chunkWork* work, long numThreads, void* (*fn)(void*)
+);
+static void carrySeqs(struct chunkWork* work, long numThreads);
+static void mergeRtt(
+	struct chunkWork* work, long numThreads, uint64_t* rttHist
+);
+static void mergeSession(struct sessionStats* dst,const struct sessionStats* s);
+static void printHist(const char* title, const uint64_t* hist);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Returns the power of two histogram bucket for the given duration
+**/
+static int log2Bucket(uint64_t ns){
+	if(!ns){
+		return 0;
+	}
+
+	return 63 - __builtin_clzll(ns);
+}
+/**
+* Returns the slot of the round trip time table a packet is kept in
+**/
+static uint32_t rttSlot(const struct traceRecord* rec){
+	return (rec->seqno ^ (rec->session*2654435761U)) & (RTT_TABLE_SIZE-1);
+}
+/**
+* Returns true for received UDP packets carrying a sequence number
+**/
+static bool hasSeq(const struct traceRecord* rec){
+	uint32_t noSeq = TRACE_FLAG_TX | TRACE_FLAG_TCP | TRACE_FLAG_NOSEQ |
+		TRACE_FLAG_STOP;
+
+	return !(rec->flags & noSeq);
+}
+/**
+* Formats a duration in ns using a sensible unit
+**/
+/**
+* Looks up the statistics of a session, growing the session array as needed
+*
+* Returns:
+* The session statistics or NULL if the session id is out of range.
+**/
+static struct sessionStats* getSession(struct chunkWork* w, uint32_t id){
+	if(id >= MAX_SESSIONS){
+		return NULL;
+	}
+
+	if(id >= w->numSessions){
+		uint32_t n = w->numSessions ? w->numSessions : 16;
+
+		while(n <= id){
+			n *= 2;
+		}
+
+		struct sessionStats* tmp = realloc(w->sessions,n*sizeof(*tmp));
+		if(!tmp){
+			return NULL;
+		}
+
+		memset(tmp+w->numSessions,0,(n-w->numSessions)*sizeof(*tmp));
+		w->sessions = tmp;
+		w->numSessions = n;
+	}
+
+	return &w->sessions[id];
+}
+/**
+* Streams through a range of trace records a mapped window at a time
+*
+* Args:
+* fd - the trace file
+* first - index of the first record
+* count - number of records
+* fn - called for every record until it returns false
+* arg - passed to fn
+*
+* Returns:
+* Zero on success or an errno value.
+**/
+static int scanRecords(
+	int fd, uint64_t first, uint64_t count, recordFn fn, void* arg
+){
+	long pageSize = sysconf(_SC_PAGESIZE);
+	off_t start = PACKET_TRACE_HEADER_SIZE +
+		((off_t)first)*sizeof(struct traceRecord);
+	off_t pos = start;
+	off_t end = pos + ((off_t)count)*sizeof(struct traceRecord);
+
+	while(pos < end){
+		off_t mapOff = pos - (pos % pageSize);
+		size_t mapLen = ANALYZE_WINDOW_SIZE;
+
+		if(mapOff + (off_t)mapLen > end){
+			mapLen = end - mapOff;
+		}
+
+		uint8_t* win = mmap(NULL,mapLen,PROT_READ,MAP_SHARED,fd,mapOff);
+		if(win == MAP_FAILED){
+			return errno;
+		}
+		madvise(win,mapLen,MADV_SEQUENTIAL);
+
+		//only whole records are handled in each window, the
+		//remainder is picked up by the next window
+		size_t avail = (mapOff + mapLen - pos)/sizeof(struct traceRecord);
+		const struct traceRecord* rec =
+			(const struct traceRecord*)(win + (pos - mapOff));
+		uint64_t index = first + (pos - start)/sizeof(struct traceRecord);
+
+		for(size_t i = 0; i < avail; i++){
+			if(!fn(arg,&rec[i],index+i)){
+				munmap(win,mapLen);
+				return 0;
+			}
+		}
+
+		munmap(win,mapLen);
+		pos += avail*sizeof(struct traceRecord);
+	}
+
+	return 0;
+}
+/**
+* Accounts for a single trace record in the first pass
+*
+* Finds the time range of the chunk and the highest sequence number of each
+* session.
+**/
+static bool rangeRecord(
+	void* arg, const struct traceRecord* rec, uint64_t index
+){
+	struct chunkWork* w = arg;
+
+	if(rec->timestamp < w->minTs){
+		w->minTs = rec->timestamp;
+	}
+	if(rec->timestamp > w->maxTs){
+		w->maxTs = rec->timestamp;
+	}
+
+	if(!hasSeq(rec)){
+		return true;
+	}
+
+	struct sessionStats* s = getSession(w,rec->session);
+	if(s && (!s->seqPackets || rec->seqno > s->maxSeq)){
+		s->maxSeq = rec->seqno;
+	}
+	if(s){
+		s->seqPackets += 1;
+	}
+
+	return true;
+}
+/**
+* Accounts for a single trace record
+**/
+static bool analyzeRecord(
+	void* arg, const struct traceRecord* rec, uint64_t index
+){
+	struct chunkWork* w = arg;
+
+	if(rec->flags & TRACE_FLAG_TX){
+		uint32_t slot = rttSlot(rec);
+
+		w->rttTable[slot].timestamp = rec->timestamp;
+		w->rttTable[slot].session = rec->session;
+		w->rttTable[slot].seqno = rec->seqno;
+		w->rttTouched[slot] = 1;
+		return true;
+	}
+
+	struct sessionStats* s = getSession(w,rec->session);
+	if(!s){
+		return true;
+	}
+
+	if(s->seen){
+		uint64_t gap = rec->timestamp - s->lastTs;
+		w->iatHist[log2Bucket(gap)] += 1;
+	}
+	else{
+		s->seen = true;
+		s->firstTs = rec->timestamp;
+		s->minSeq = 0xFFFFFFFF;
+	}
+	s->lastTs = rec->timestamp;
+
+	s->packets += 1;
+	s->bytes += rec->len;
+
+	if(rec->flags & TRACE_FLAG_TCP){
+		s->tcp = true;
+	}
+	else if(!(rec->flags & (TRACE_FLAG_NOSEQ|TRACE_FLAG_STOP))){
+		bool before = s->seqPackets;
+		uint32_t maxSeq = s->maxSeq;
+
+		if(rec->session < w->numCarry && w->carry[rec->session].seqPackets){
+			uint32_t carried = w->carry[rec->session].maxSeq;
+
+			if(!before || carried > maxSeq){
+				maxSeq = carried;
+			}
+			before = true;
+		}
+
+		if(before && rec->seqno < maxSeq){
+			s->reordered += 1;
+		}
+		if(rec->seqno < s->minSeq){
+			s->minSeq = rec->seqno;
+		}
+		if(!s->seqPackets || rec->seqno > s->maxSeq){
+			s->maxSeq = rec->seqno;
+		}
+		s->seqPackets += 1;
+
+		uint32_t slot = rttSlot(rec);
+		struct rttEntry* e = &w->rttTable[slot];
+
+		if(!w->rttTouched[slot]){
+			w->lastUntouched = index+1;
+		}
+
+		if(e->timestamp && e->session == rec->session &&
+			e->seqno == rec->seqno && e->timestamp <= rec->timestamp){
+
+			w->rttHist[log2Bucket(rec->timestamp - e->timestamp)] += 1;
+			e->timestamp = 0;
+		}
+	}
+
+	uint64_t bin = (rec->timestamp - w->traceStart)/w->binNs;
+	if(bin >= w->binBase && bin < w->binBase + w->numBins){
+		w->binBytes[bin-w->binBase] += rec->len;
+		w->binPackets[bin-w->binBase] += 1;
+	}
+
+	return true;
+}
+/**
+* Matches a reply against the packets left unmatched by earlier chunks
+*
+* Mirrors the table updates of analyzeRecord() for the slots the chunk has
+* not written yet.
+**/
+static bool fixupRecord(
+	void* arg, const struct traceRecord* rec, uint64_t index
+){
+	struct rttFixup* f = arg;
+	uint32_t slot = rttSlot(rec);
+	struct rttEntry* e = &f->table[slot];
+
+	if(f->touched[slot]){
+		return true;
+	}
+
+	if(rec->flags & TRACE_FLAG_TX){
+		f->touched[slot] = 1;
+		if(e->timestamp){
+			f->live -= 1;
+		}
+	}
+	else if(hasSeq(rec) && e->timestamp && e->session == rec->session &&
+		e->seqno == rec->seqno && e->timestamp <= rec->timestamp){
+
+		f->rttHist[log2Bucket(rec->timestamp - e->timestamp)] += 1;
+		e->timestamp = 0;
+		f->live -= 1;
+	}
+
+	return f->live > 0;
+}
+/**
+* Thread entry point which makes the first pass over one chunk of the trace
+**/
+static void* rangeChunk(void* arg){
+	struct chunkWork* w = arg;
+
+	w->minTs = ~0ULL;
+	w->maxTs = 0;
+
+	w->err = scanRecords(w->fd,w->first,w->count,rangeRecord,w);
+
+	return NULL;
+}
+/**
+* Thread entry point which analyzes one chunk of the trace
+**/
+static void* analyzeChunk(void* arg){
+	struct chunkWork* w = arg;
+
+	w->rttTable = calloc(RTT_TABLE_SIZE,sizeof(*w->rttTable));
+	w->rttTouched = calloc(RTT_TABLE_SIZE,sizeof(*w->rttTouched));
+
+	w->binBase = (w->minTs - w->traceStart)/w->binNs;
+	w->numBins = (w->maxTs - w->traceStart)/w->binNs - w->binBase + 1;
+	w->binBytes = calloc(w->numBins,sizeof(*w->binBytes));
+	w->binPackets = calloc(w->numBins,sizeof(*w->binPackets));
+
+	if(!w->rttTable || !w->rttTouched || !w->binBytes || !w->binPackets){
+		w->err = ENOMEM;
+		return NULL;
+	}
+
+	w->err = scanRecords(w->fd,w->first,w->count,analyzeRecord,w);
+
+	return NULL;
+}
+/**
+* Runs fn on every chunk, each on its own thread, and waits for them
+*
+* Exits if any of them fails.
+**/
+static void runChunks(
+	struct chunkWork* work, long numThreads, void* (*fn)(void*)
+){
+	pthread_t threads[MAX_THREADS];
+
+	for(long i = 0; i < numThreads; i++){
+		if(pthread_create(&threads[i],NULL,fn,&work[i])){
+			perror("Error creating thread");
+			exit(-1);
+		}
+	}
+
+	for(long i = 0; i < numThreads; i++){
+		pthread_join(threads[i],NULL);
+	}
+
+	for(long i = 0; i < numThreads; i++){
+		if(work[i].err){
+			fprintf(
+				stderr,"Error analyzing trace: %s\n",
+				strerror(work[i].err)
+			);
+			exit(-1);
+		}
+	}
+}
+/**
+* Hands every chunk the highest sequence numbers of the chunks before it
+*
+* Takes the per session results of the first pass, which are cleared for the
+* second one.
+**/
+static void carrySeqs(struct chunkWork* work, long numThreads){
+	struct sessionStats* carry = NULL;
+	uint32_t numCarry = 0;
+
+	for(long i = 0; i < numThreads; i++){
+		struct chunkWork* w = &work[i];
+
+		w->carry = NULL;
+		w->numCarry = numCarry;
+		if(numCarry){
+			w->carry = malloc(numCarry*sizeof(*carry));
+			if(!w->carry){
+				perror("Error allocating results");
+				exit(-1);
+			}
+			memcpy(w->carry,carry,numCarry*sizeof(*carry));
+		}
+
+		if(w->numSessions > numCarry){
+			struct sessionStats* tmp = realloc(
+				carry,w->numSessions*sizeof(*tmp)
+			);
+			if(!tmp){
+				perror("Error allocating results");
+				exit(-1);
+			}
+
+			memset(
+				tmp+numCarry,0,(w->numSessions-numCarry)*sizeof(*tmp)
+			);
+			carry = tmp;
+			numCarry = w->numSessions;
+		}
+
+		for(uint32_t n = 0; n < w->numSessions; n++){
+			const struct sessionStats* s = &w->sessions[n];
+
+			if(s->seqPackets && (!carry[n].seqPackets ||
+				s->maxSeq > carry[n].maxSeq)){
+
+				carry[n].maxSeq = s->maxSeq;
+			}
+			carry[n].seqPackets += s->seqPackets;
+		}
+
+		free(w->sessions);
+		w->sessions = NULL;
+		w->numSessions = 0;
+	}
+
+	free(carry);
+}
+/**
+* Merges the round trip times of all chunks in order
+*
+* Replies in a chunk at a slot the chunk had not written yet could only be
+* matched by the thread of an earlier chunk. The packets left unmatched by
+* all earlier chunks are carried along and those replies are matched against
+* them here, reading each chunk only until no carried packet can be matched
+* any more.
+**/
+static void mergeRtt(
+	struct chunkWork* work, long numThreads, uint64_t* rttHist
+){
+	struct rttFixup f;
+
+	f.table = calloc(RTT_TABLE_SIZE,sizeof(*f.table));
+	f.touched = malloc(RTT_TABLE_SIZE*sizeof(*f.touched));
+	f.rttHist = rttHist;
+	if(!f.table || !f.touched){
+		perror("Error allocating results");
+		exit(-1);
+	}
+
+	for(long i = 0; i < numThreads; i++){
+		struct chunkWork* w = &work[i];
+
+		f.live = 0;
+		for(uint32_t n = 0; n < RTT_TABLE_SIZE; n++){
+			f.live += f.table[n].timestamp != 0;
+		}
+		memset(f.touched,0,RTT_TABLE_SIZE*sizeof(*f.touched));
+
+		if(f.live && w->lastUntouched){
+			int err = scanRecords(
+				w->fd,w->first,w->lastUntouched - w->first,fixupRecord,&f
+			);
+			if(err){
+				fprintf(stderr,"Error analyzing trace: %s\n",strerror(err));
+				exit(-1);
+			}
+		}
+
+		for(uint32_t n = 0; n < RTT_TABLE_SIZE; n++){
+			if(w->rttTouched[n]){
+				f.table[n] = w->rttTable[n];
+			}
+		}
+	}
+
+	free(f.table);
+	free(f.touched);
+}
+/**
+* Merges the statistics of a session from a later chunk into dst
+**/
+static void mergeSession(struct sessionStats* dst,const struct sessionStats* s){
+	if(!s->seen){
+		return;
+	}
+
+	if(!dst->seen){
+		*dst = *s;
+		return;
+	}
+
+	dst->tcp = dst->tcp || s->tcp;
+	dst->packets += s->packets;
+	dst->bytes += s->bytes;
+
+	if(s->seqPackets){
+		if(!dst->seqPackets){
+			dst->minSeq = s->minSeq;
+			dst->maxSeq = s->maxSeq;
+		}
+		else{
+			if(s->minSeq < dst->minSeq){
+				dst->minSeq = s->minSeq;
+			}
+			if(s->maxSeq > dst->maxSeq){
+				dst->maxSeq = s->maxSeq;
+			}
+		}
+	}
+	dst->seqPackets += s->seqPackets;
+	dst->reordered += s->reordered;
+
+	dst->lastTs = s->lastTs;
+}
+/**
+* Prints the non-empty buckets of a histogram
+**/
+static void printHist(const char* title, const uint64_t* hist){
+	uint64_t total = 0;
+
+	for(int i = 0; i < HIST_BUCKETS; i++){
+		total += hist[i];
+	}
+
+	printf("\n%s (%llu samples)\n",title,(unsigned long long)total);
+
+	if(!total){
+		return;
+	}
+
+	for(int i = 0; i < HIST_BUCKETS; i++){
+		if(!hist[i]){
+			continue;
+		}
+
+		char lo[32];
+		char hi[32];
+		fmtNs(lo,sizeof(lo),i ? (1ULL << i) : 0);
+		fmtNs(hi,sizeof(hi),(i < 63) ? (1ULL << (i+1)) : ~0ULL);
+
+		printf(
+			"  [%8s, %8s) %12llu %6.2f%%\n",lo,hi,
+			(unsigned long long)hist[i],100.0*hist[i]/total
+		);
+	}
+}
+/**
+* Program entry point
+*
+* Args:
+* argc - program argument count
+* argv - program arguments
+*
+* Returns:
+* Program exit code.
+**/
+int main(int argc, char** argv){
+	long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	long binMs = DEFAULT_BIN_MS;
+	const char* seriesPath = NULL;
+
+	int lopt_ind = 0;
+	int c;
+
+	const char* shopts = "hj:b:o:";
+	struct option lopts[] = {
+		{"help",0,NULL,'h'},
+		{"threads",1,NULL,'j'},
+		{"bin",1,NULL,'b'},
+		{"series",1,NULL,'o'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while( (c = getopt_long(argc, argv,shopts,lopts,&lopt_ind)) != -1 ){
+		char* endptr;
+
+		switch(c){
+		case 'h':
+			printf(HELP,argv[0],USAGE);
+			exit(0);
+			break;
+		case 'j':
+			numThreads = strtol(optarg,&endptr,10);
+			if(*endptr || numThreads < 1 || numThreads > MAX_THREADS){
+				fprintf(stderr,"Invalid thread count!\n");
+				exit(-1);
+			}
+			break;
+		case 'b':
+			binMs = strtol(optarg,&endptr,10);
+			if(*endptr || binMs < 1){
+				fprintf(stderr,"Invalid bin width!\n");
+				exit(-1);
+			}
+			break;
+		case 'o':
+			seriesPath = optarg;
+			break;
+		default:
+			printf("%s %s\n",argv[0],USAGE);
+			printf("%s\n",ARG_ERR);
+			exit(-1);
+		}
+	}
+
+	if(optind != argc-1){
+		printf("%s %s\n",argv[0],USAGE);
+		printf("%s\n",ARG_ERR);
+		exit(-1);
+	}
+
+	if(numThreads < 1){
+		numThreads = 1;
+	}
+	else if(numThreads > MAX_THREADS){
+		numThreads = MAX_THREADS;
+	}
+
+	const char* path = argv[optind];
+	int fd = open(path,O_RDONLY);
+	if(fd < 0){
+		perror("Error opening trace");
+		exit(-1);
+	}
+
+	struct traceHeader hdr;
+	uint64_t count;
+	if(packetTrace_readHeader(fd,&hdr,&count)){
+		exit(-1);
+	}
+
+	printf("Trace: %s\n",path);
+	printf(
+		"Records: %llu%s\n",(unsigned long long)count,
+		hdr.clean ? "" : " (recovered, trace was not closed cleanly)"
+	);
+
+	if(!count){
+		return 0;
+	}
+
+	if((uint64_t)numThreads > count){
+		numThreads = count;
+	}
+
+	struct chunkWork* work = calloc(numThreads,sizeof(*work));
+	if(!work){
+		perror("Error allocating work");
+		exit(-1);
+	}
+
+	uint64_t first = 0;
+	for(long i = 0; i < numThreads; i++){
+		work[i].fd = fd;
+		work[i].first = first;
+		work[i].count = count/numThreads + ((uint64_t)i < count%numThreads);
+		work[i].binNs = binMs*1000000ULL;
+		first += work[i].count;
+	}
+
+	runChunks(work,numThreads,rangeChunk);
+
+	//the server does not write records in strict timestamp order
+	uint64_t traceStart = work[0].minTs;
+	uint64_t traceEnd = work[0].maxTs;
+
+	for(long i = 1; i < numThreads; i++){
+		if(work[i].minTs < traceStart){
+			traceStart = work[i].minTs;
+		}
+		if(work[i].maxTs > traceEnd){
+			traceEnd = work[i].maxTs;
+		}
+	}
+
+	for(long i = 0; i < numThreads; i++){
+		work[i].traceStart = traceStart;
+	}
+
+	carrySeqs(work,numThreads);
+	runChunks(work,numThreads,analyzeChunk);
+
+	//merge everything into the first chunk's results
+	struct chunkWork* res = &work[0];
+	uint64_t numBins = (traceEnd - traceStart)/res->binNs + 1;
+	uint64_t* binBytes = calloc(numBins,sizeof(*binBytes));
+	uint64_t* binPackets = calloc(numBins,sizeof(*binPackets));
+	uint32_t numSessions = 0;
+
+	for(long i = 0; i < numThreads; i++){
+		if(work[i].numSessions > numSessions){
+			numSessions = work[i].numSessions;
+		}
+	}
+
+	struct sessionStats* sessions = calloc(
+		numSessions ? numSessions : 1,sizeof(*sessions)
+	);
+	if(!binBytes || !binPackets || !sessions){
+		perror("Error allocating results");
+		exit(-1);
+	}
+
+	for(long i = 0; i < numThreads; i++){
+		struct chunkWork* w = &work[i];
+
+		for(uint32_t n = 0; n < w->numSessions; n++){
+			//the gap between chunks belongs in the histogram too
+			if(sessions[n].seen && w->sessions[n].seen){
+				uint64_t gap = w->sessions[n].firstTs -
+					sessions[n].lastTs;
+				res->iatHist[log2Bucket(gap)] += 1;
+			}
+			mergeSession(&sessions[n],&w->sessions[n]);
+		}
+
+		for(uint64_t b = 0; b < w->numBins; b++){
+			if(w->binBase + b < numBins){
+				binBytes[w->binBase+b] += w->binBytes[b];
+				binPackets[w->binBase+b] += w->binPackets[b];
+			}
+		}
+
+		if(i){
+			for(int b = 0; b < HIST_BUCKETS; b++){
+				res->iatHist[b] += w->iatHist[b];
+				res->rttHist[b] += w->rttHist[b];
+			}
+		}
+	}
+
+	mergeRtt(work,numThreads,res->rttHist);
+
+	double duration = (traceEnd - traceStart)/1000000000.0;
+	uint64_t totalBytes = 0;
+	uint64_t totalPackets = 0;
+
+	printf("Duration: %.3lf s\n",duration);
+	printf("\nSessions:\n");
+	printf(
+		"%8s %12s %14s %12s %12s %8s %10s %14s\n","session","packets",
+		"bytes","expected","lost","loss%","reordered","kib/s"
+	);
+
+	for(uint32_t n = 0; n < numSessions; n++){
+		struct sessionStats* s = &sessions[n];
+
+		if(!s->seen){
+			continue;
+		}
+
+		totalBytes += s->bytes;
+		totalPackets += s->packets;
+
+		double secs = (s->lastTs - s->firstTs)/1000000000.0;
+		double kibps = secs > 0.0 ? (s->bytes/(1024.0/8.0))/secs : 0.0;
+
+		if(s->tcp || !s->seqPackets){
+			printf(
+				"%8u %12llu %14llu %12s %12s %8s %10s %14.3lf\n",
+				n,(unsigned long long)s->packets,
+				(unsigned long long)s->bytes,"-","-","-","-",kibps
+			);
+			continue;
+		}
+
+		uint64_t expected = ((uint64_t)s->maxSeq) - s->minSeq + 1;
+		uint64_t lost = (expected > s->seqPackets) ?
+			expected - s->seqPackets : 0;
+
+		printf(
+			"%8u %12llu %14llu %12llu %12llu %8.3lf %10llu %14.3lf\n",
+			n,(unsigned long long)s->packets,
+			(unsigned long long)s->bytes,(unsigned long long)expected,
+			(unsigned long long)lost,100.0*lost/expected,
+			(unsigned long long)s->reordered,kibps
+		);
+	}
+
+	printf(
+		"\nTotal: %llu packets, %llu bytes, ~ %.3lf kib/s\n",
+		(unsigned long long)totalPackets,(unsigned long long)totalBytes,
+		duration > 0.0 ? (totalBytes/(1024.0/8.0))/duration : 0.0
+	);
+
+	double binSecs = binMs/1000.0;
+	double minRate = -1.0;
+	double maxRate = 0.0;
+	FILE* series = NULL;
+
+	if(seriesPath){
+		series = fopen(seriesPath,"w");
+		if(!series){
+			perror("Error opening series file");
+			exit(-1);
+		}
+		fprintf(series,"time_s,packets,bytes,kibps\n");
+	}
+
+	for(uint64_t b = 0; b < numBins; b++){
+		double rate = (binBytes[b]/(1024.0/8.0))/binSecs;
+
+		if(minRate < 0.0 || rate < minRate){
+			minRate = rate;
+		}
+		if(rate > maxRate){
+			maxRate = rate;
+		}
+
+		if(series){
+			fprintf(
+				series,"%.3lf,%llu,%llu,%.3lf\n",b*binSecs,
+				(unsigned long long)binPackets[b],
+				(unsigned long long)binBytes[b],rate
+			);
+		}
+	}
+
+	if(series){
+		fclose(series);
+	}
+
+	printf(
+		"Throughput per %ld ms bin: min %.3lf, max %.3lf kib/s "
+		"(%llu bins)\n",binMs,minRate,maxRate,(unsigned long long)numBins
+	);
+
+	printHist("Inter-arrival times",res->iatHist);
+	printHist("Round trip times",res->rttHist);
+
+	close(fd);
+
+	return 0;
+}
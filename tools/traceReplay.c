@@ -0,0 +1,749 @@
+/*
+ * Copyright (c) 2015, Scanimetrics - http://www.scanimetrics.com
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*******************************************************************************
+* Replays the UDP packets of a trace recorded with the --trace option          *
+*                                                                              *
+* Every session of the trace is sent from its own socket so the server sees    *
+* the same clients again, with the packet sizes, sequence numbers, stop        *
+* packets and spacing of the original run, optionally sped up or slowed down.  *
+*******************************************************************************/
+
+/*******************************************************************************
+*                                   INCLUDES                                   *
+*******************************************************************************/
+#include "packetTrace.h"
+#include "throughputServer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <linux/net_tstamp.h>
+/*******************************************************************************
+*                                    DEFINES                                   *
+*******************************************************************************/
+//records read from the trace at once
+#define READ_RECORDS 4096
+
+//packets handed to sendmmsg() at once
+#define REPLAY_BATCH 64
+
+//largest UDP payload over IPv6
+#define REPLAY_MAX_SIZE 65527
+
+//with SO_TXTIME packets are handed to the kernel this far ahead of their
+//departure time
+#define LOOKAHEAD_NS (2000000ULL)
+
+//longest sleep between checks for replies
+#define MAX_SLEEP_NS (100000000ULL)
+
+//a recorded stop packet is sent this many times in all, as clients do
+#define STOP_REPEAT 8
+
+//how long to wait for the last ping pong replies
+#define REPLY_GRACE_MS 500
+
+//sessions ids above this are assumed to be corrupt
+#define MAX_SESSIONS (1<<20)
+/*******************************************************************************
+*                                    STRUCTS                                   *
+*******************************************************************************/
+struct replaySession{
+	bool open;
+	int fd;
+
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t replies;
+	bool stopped;
+};
+
+struct replayer{
+	int traceFd;
+	uint64_t count;
+	uint64_t next;
+
+	struct traceRecord records[READ_RECORDS];
+	unsigned numRecords;
+	unsigned pos;
+
+	uint64_t firstTs;
+	uint64_t lastDue;
+	uint64_t startNs;
+	double speed;
+
+	struct sockaddr_storage addr;
+	socklen_t addrLen;
+	bool txtime;
+
+	int epfd;
+	struct replaySession* sessions;
+	uint32_t numSessions;
+	uint32_t usedSessions;
+
+	uint8_t* data;
+
+	uint64_t sent;
+	uint64_t bytes;
+	uint64_t failed;
+	uint64_t replies;
+	uint64_t lateSum;
+	uint64_t lateMax;
+};
+/*******************************************************************************
+*                                     DATA                                     *
+*******************************************************************************/
+static const char* HELP="Replays the UDP packets of a trace recorded by the\n"
+"test server with their original timing\n"
+"\n"
+"Usage:\n"
+"%s %s\n"
+"Options:\n"
+"-x,--speed f     Replay f times as fast, e.g. 2 or 10 (or 0.5 for half\n"
+"                 speed). Defaults to 1.\n"
+"-s,--session id  Only replay the session with the given id.\n"
+"-p,--pacing MODE timer to sleep on a timerfd until each packet is due or\n"
+"                 txtime to hand every packet to the kernel with its\n"
+"                 departure time (SO_TXTIME, which needs the fq or etf\n"
+"                 qdisc). Defaults to timer.\n"
+"-v,--verbose     Print what was sent for every session.\n"
+"\n"
+"Each session is sent from its own socket. Packets carry their recorded\n"
+"sequence number and size, stop packets are sent again as stop packets. TCP\n"
+"records and packets sent by the server are skipped. Replies of a ping pong\n"
+"server are counted.\n";
+
+static const char* USAGE="[-h] [-x f] [-s id] [-p timer|txtime] [-v]\n"
+"       TRACE HOST PORT";
+
+static const char* ARG_ERR="Try -h or --help to get help text";
+/*******************************************************************************
+*                              FUNCTION PROTOTYPES                             *
+*******************************************************************************/
+static bool nextRecord(
+	struct replayer* r, struct traceRecord* rec, bool all, uint32_t only
+);
+static uint64_t dueTime(struct replayer* r, const struct traceRecord* rec);
+static struct replaySession* getSession(struct replayer* r, uint32_t id);
+static void sleepUntil(int tfd, uint64_t deadline);
+static void drainReplies(struct replayer* r, int timeoutMs);
+static void sendBatch(
+	struct replayer* r, struct replaySession* s,
+	const struct traceRecord* recs, const uint64_t* due, unsigned n
+);
+/*******************************************************************************
+*                             FUNCTION DEFINITIONS                             *
+*******************************************************************************/
+/**
+* Reads the next UDP packet received by the server from the trace
+*
+* Args:
+* r - the replay
+* rec - loaded with the record
+* all - replay every session
+* only - the session to replay unless all is set
+*
+* Returns:
+* False at the end of the trace.
+**/
+static bool nextRecord(
+	struct replayer* r, struct traceRecord* rec, bool all, uint32_t only
+){
+	while(1){
+		if(r->pos == r->numRecords){
+			uint64_t left = r->count - r->next;
+			size_t n = (left < READ_RECORDS) ? left : READ_RECORDS;
+			off_t off = PACKET_TRACE_HEADER_SIZE +
+				((off_t)r->next)*sizeof(*rec);
+
+			if(!n){
+				return false;
+			}
+
+			ssize_t rc = pread(
+				r->traceFd,r->records,n*sizeof(*rec),off
+			);
+			if(rc < (ssize_t)sizeof(*rec)){
+				if(rc < 0){
+					perror("Error reading trace");
+				}
+				return false;
+			}
+
+			r->numRecords = rc/sizeof(*rec);
+			r->next += r->numRecords;
+			r->pos = 0;
+		}
+
+		*rec = r->records[r->pos++];
+
+		if(rec->flags & (TRACE_FLAG_TCP|TRACE_FLAG_TX)){
+			continue;
+		}
+		if(!all && rec->session != only){
+			continue;
+		}
+
+		return true;
+	}
+}
+/**
+* Returns the time a record is due to be sent again
+*
+* Records of a pipelined server may be slightly out of order, those are sent
+* right after the one before them.
+**/
+static uint64_t dueTime(struct replayer* r, const struct traceRecord* rec){
+	uint64_t due = r->startNs;
+
+	if(rec->timestamp > r->firstTs){
+		due += (uint64_t)((rec->timestamp - r->firstTs)/r->speed);
+	}
+	if(due < r->lastDue){
+		due = r->lastDue;
+	}
+
+	r->lastDue = due;
+
+	return due;
+}
+/**
+* Looks up a session, opening its socket the first time it is used
+*
+* Returns:
+* The session or NULL if it can not be used (an error message will have been
+* printed).
+**/
+static struct replaySession* getSession(struct replayer* r, uint32_t id){
+	if(id >= MAX_SESSIONS){
+		fprintf(stderr,"Session id %u is out of range\n",id);
+		return NULL;
+	}
+
+	if(id >= r->numSessions){
+		uint32_t n = r->numSessions ? r->numSessions : 16;
+
+		while(n <= id){
+			n *= 2;
+		}
+
+		struct replaySession* tmp = realloc(r->sessions,n*sizeof(*tmp));
+		if(!tmp){
+			perror("Error allocating sessions");
+			exit(-1);
+		}
+
+		memset(tmp+r->numSessions,0,(n-r->numSessions)*sizeof(*tmp));
+		r->sessions = tmp;
+		r->numSessions = n;
+	}
+
+	struct replaySession* s = &r->sessions[id];
+
+	if(s->open){
+		return s;
+	}
+
+	s->fd = socket(
+		r->addr.ss_family,SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0
+	);
+	if(s->fd < 0){
+		perror("Error creating socket");
+		exit(-1);
+	}
+
+	if(connect(s->fd,(const struct sockaddr*)&r->addr,r->addrLen)){
+		perror("Error connecting socket");
+		exit(-1);
+	}
+
+	if(r->txtime){
+		struct sock_txtime txtime;
+
+		memset(&txtime,0,sizeof(txtime));
+		txtime.clockid = CLOCK_MONOTONIC;
+
+		if(setsockopt(s->fd,SOL_SOCKET,SO_TXTIME,&txtime,sizeof(txtime))){
+			perror("Unable to enable SO_TXTIME, pacing with a timer");
+			r->txtime = false;
+		}
+	}
+
+	//the sessions array moves when it grows, so replies are matched to
+	//their session by id
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0;
+	ev.data.u32 = id;
+	if(epoll_ctl(r->epfd,EPOLL_CTL_ADD,s->fd,&ev)){
+		perror("Error watching socket");
+		exit(-1);
+	}
+
+	s->open = true;
+	r->usedSessions += 1;
+
+	return s;
+}
+/**
+* Sleeps until the given CLOCK_MONOTONIC time using a timerfd
+**/
+static void sleepUntil(int tfd, uint64_t deadline){
+	struct itimerspec its;
+	uint64_t expirations;
+
+	memset(&its,0,sizeof(its));
+	its.it_value.tv_sec = deadline/1000000000ULL;
+	its.it_value.tv_nsec = deadline%1000000000ULL;
+
+	if(timerfd_settime(tfd,TFD_TIMER_ABSTIME,&its,NULL)){
+		return;
+	}
+
+	if(read(tfd,&expirations,sizeof(expirations)) < 0){
+		return;
+	}
+}
+/**
+* Counts the ping pong replies waiting on the session sockets
+*
+* Args:
+* r - the replay
+* timeoutMs - how long to wait for the first reply, zero to only take what
+* 	has already arrived
+**/
+static void drainReplies(struct replayer* r, int timeoutMs){
+	struct epoll_event events[REPLAY_BATCH];
+	uint8_t buf[REPLAY_MAX_SIZE];
+
+	int n = epoll_wait(r->epfd,events,REPLAY_BATCH,timeoutMs);
+
+	for(int i = 0; i < n; i++){
+		struct replaySession* s = &r->sessions[events[i].data.u32];
+
+		while(recv(s->fd,buf,sizeof(buf),0) >= 0){
+			s->replies += 1;
+			r->replies += 1;
+		}
+	}
+}
+/**
+* Sends packets of one session with a single sendmmsg() call
+*
+* The payload of each packet is rebuilt from its record: the sequence number
+* followed by zeros, or all 0xFF for a stop packet.
+*
+* Args:
+* r - the replay
+* s - the session the packets belong to
+* recs - the records of the packets
+* due - departure time of each packet, used with SO_TXTIME
+* n - number of packets, at most REPLAY_BATCH
+**/
+static void sendBatch(
+	struct replayer* r, struct replaySession* s,
+	const struct traceRecord* recs, const uint64_t* due, unsigned n
+){
+	struct mmsghdr msgs[REPLAY_BATCH];
+	struct iovec iov[REPLAY_BATCH];
+	uint8_t ctrl[REPLAY_BATCH][CMSG_SPACE(sizeof(uint64_t))];
+
+	memset(msgs,0,n*sizeof(*msgs));
+
+	for(unsigned i = 0; i < n; i++){
+		uint8_t* buf = r->data + ((size_t)i)*REPLAY_MAX_SIZE;
+		uint32_t len = recs[i].len;
+		uint32_t seqno = recs[i].seqno;
+
+		if(len > REPLAY_MAX_SIZE){
+			len = REPLAY_MAX_SIZE;
+		}
+
+		if(recs[i].flags & TRACE_FLAG_STOP){
+			memset(buf,0xFF,len);
+		}
+		else{
+			memset(buf,0,len);
+			if(!(recs[i].flags & TRACE_FLAG_NOSEQ) && len >= 4){
+				buf[0] = (seqno >> 0 )&0xFF;
+				buf[1] = (seqno >> 8 )&0xFF;
+				buf[2] = (seqno >> 16)&0xFF;
+				buf[3] = (seqno >> 24)&0xFF;
+			}
+		}
+
+		iov[i].iov_base = buf;
+		iov[i].iov_len = len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+
+		if(r->txtime){
+			msgs[i].msg_hdr.msg_control = ctrl[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+
+			struct cmsghdr* cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+			cm->cmsg_level = SOL_SOCKET;
+			cm->cmsg_type = SCM_TXTIME;
+			cm->cmsg_len = CMSG_LEN(sizeof(due[i]));
+			memcpy(CMSG_DATA(cm),&due[i],sizeof(due[i]));
+		}
+	}
+
+	unsigned done = 0;
+
+	while(done < n){
+		int rc = sendmmsg(s->fd,msgs+done,n-done,0);
+
+		if(rc < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				struct pollfd pfd = {s->fd,POLLOUT,0};
+				poll(&pfd,1,MAX_SLEEP_NS/1000000ULL);
+				continue;
+			}
+			if(errno == EINTR){
+				continue;
+			}
+
+			//the packet is lost like it would be on the network
+			if(!r->failed){
+				perror("Error sending packet");
+			}
+			r->failed += 1;
+			done += 1;
+			continue;
+		}
+
+		for(int i = 0; i < rc; i++){
+			uint64_t len = iov[done+i].iov_len;
+
+			s->packets += 1;
+			s->bytes += len;
+			r->sent += 1;
+			r->bytes += len;
+		}
+		done += rc;
+	}
+
+	if(recs[n-1].flags & TRACE_FLAG_STOP){
+		s->stopped = true;
+	}
+}
+/**
+* Program entry point
+*
+* Args:
+* argc - program argument count
+* argv - program arguments
+*
+* Returns:
+* Program exit code.
+**/
+int main(int argc, char** argv){
+	double speed = 1.0;
+	bool all = true;
+	uint32_t only = 0;
+	bool txtime = false;
+	bool verbose = false;
+
+	int lopt_ind = 0;
+	int c;
+
+	const char* shopts = "hx:s:p:v";
+	struct option lopts[] = {
+		{"help",0,NULL,'h'},
+		{"speed",1,NULL,'x'},
+		{"session",1,NULL,'s'},
+		{"pacing",1,NULL,'p'},
+		{"verbose",0,NULL,'v'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while( (c = getopt_long(argc, argv,shopts,lopts,&lopt_ind)) != -1 ){
+		char* endptr;
+
+		switch(c){
+		case 'h':
+			printf(HELP,argv[0],USAGE);
+			exit(0);
+			break;
+		case 'x':
+			speed = strtod(optarg,&endptr);
+			if(*endptr || !(speed > 0)){
+				fprintf(stderr,"Invalid speed!\n");
+				exit(-1);
+			}
+			break;
+		case 's':
+			only = strtoul(optarg,&endptr,10);
+			if(*endptr){
+				fprintf(stderr,"Invalid session id!\n");
+				exit(-1);
+			}
+			all = false;
+			break;
+		case 'p':
+			if(!strcmp(optarg,"timer")){
+				txtime = false;
+			}
+			else if(!strcmp(optarg,"txtime")){
+				txtime = true;
+			}
+			else{
+				fprintf(stderr,"Invalid pacing mode!\n");
+				exit(-1);
+			}
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			printf("%s %s\n",argv[0],USAGE);
+			printf("%s\n",ARG_ERR);
+			exit(-1);
+		}
+	}
+
+	if(optind != argc-3){
+		printf("%s %s\n",argv[0],USAGE);
+		printf("%s\n",ARG_ERR);
+		exit(-1);
+	}
+
+	struct replayer* r = calloc(1,sizeof(*r));
+	if(!r){
+		perror("Error allocating replay");
+		exit(-1);
+	}
+	r->speed = speed;
+	r->txtime = txtime;
+
+	const char* path = argv[optind];
+	r->traceFd = open(path,O_RDONLY);
+	if(r->traceFd < 0){
+		perror("Error opening trace");
+		exit(-1);
+	}
+
+	struct traceHeader hdr;
+	if(packetTrace_readHeader(r->traceFd,&hdr,&r->count)){
+		exit(-1);
+	}
+
+	struct addrinfo hints;
+	struct addrinfo* res;
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	int rc = getaddrinfo(argv[optind+1],argv[optind+2],&hints,&res);
+	if(rc){
+		fprintf(
+			stderr,"Unable to resolve %s port %s: %s\n",
+			argv[optind+1],argv[optind+2],gai_strerror(rc)
+		);
+		exit(-1);
+	}
+	memcpy(&r->addr,res->ai_addr,res->ai_addrlen);
+	r->addrLen = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	int tfd = timerfd_create(CLOCK_MONOTONIC,TFD_CLOEXEC);
+	r->data = malloc(((size_t)REPLAY_BATCH)*REPLAY_MAX_SIZE);
+	if(r->epfd < 0 || tfd < 0 || !r->data){
+		perror("Error setting up replay");
+		exit(-1);
+	}
+
+	struct traceRecord rec;
+	bool have = nextRecord(r,&rec,all,only);
+
+	if(!have){
+		fprintf(stderr,"The trace holds no UDP packets to replay\n");
+		exit(-1);
+	}
+
+	r->firstTs = rec.timestamp;
+	r->startNs = packetTrace_now();
+
+	uint64_t recDue = dueTime(r,&rec);
+	uint64_t lastTs = rec.timestamp;
+
+	while(have){
+		uint64_t now = packetTrace_now();
+		uint64_t horizon = r->txtime ? now + LOOKAHEAD_NS : now;
+
+		if(recDue > horizon){
+			uint64_t wake = r->txtime ? recDue - LOOKAHEAD_NS/2 : recDue;
+
+			if(wake > now + MAX_SLEEP_NS){
+				wake = now + MAX_SLEEP_NS;
+			}
+
+			drainReplies(r,0);
+			sleepUntil(tfd,wake);
+			continue;
+		}
+
+		//batch up the packets of this session which are due
+		struct traceRecord recs[REPLAY_BATCH];
+		uint64_t due[REPLAY_BATCH];
+		unsigned n = 0;
+		uint32_t session = rec.session;
+
+		do{
+			if(!r->txtime){
+				uint64_t late = now - recDue;
+
+				r->lateSum += late;
+				if(late > r->lateMax){
+					r->lateMax = late;
+				}
+			}
+
+			recs[n] = rec;
+			due[n] = recDue;
+			n += 1;
+			lastTs = rec.timestamp;
+
+			have = nextRecord(r,&rec,all,only);
+			if(have){
+				recDue = dueTime(r,&rec);
+			}
+		}while(have && n < REPLAY_BATCH && rec.session == session &&
+			recDue <= horizon);
+
+		struct replaySession* s = getSession(r,session);
+		if(s){
+			sendBatch(r,s,recs,due,n);
+		}
+
+		drainReplies(r,0);
+	}
+
+	uint64_t endNs = packetTrace_now();
+
+	//clients repeat the stop sequence in case it gets lost
+	for(uint32_t i = 0; i < r->numSessions; i++){
+		struct replaySession* s = &r->sessions[i];
+		uint8_t stop[64];
+
+		memset(stop,0xFF,sizeof(stop));
+		for(int j = 1; s->open && s->stopped && j < STOP_REPEAT; j++){
+			if(send(s->fd,stop,sizeof(stop),0) < 0){
+				break;
+			}
+		}
+	}
+
+	drainReplies(r,REPLY_GRACE_MS);
+	uint64_t graceEnd = packetTrace_now() + REPLY_GRACE_MS*1000000ULL;
+	while(r->replies && packetTrace_now() < graceEnd){
+		drainReplies(r,REPLY_GRACE_MS/10);
+	}
+
+	printf("Trace: %s\n",path);
+	printf(
+		"Replayed %llu packets (%llu bytes) of %u sessions in %.3f s\n",
+		(unsigned long long)r->sent,(unsigned long long)r->bytes,
+		r->usedSessions,(endNs - r->startNs)/1e9
+	);
+	printf(
+		"The trace covered %.3f s, replayed at %gx speed\n",
+		(lastTs - r->firstTs)/1e9,speed
+	);
+	printf(
+		"Throughput was ~ %lf kib/s\n",
+		throughputServer_calcThroughput(r->bytes,endNs - r->startNs)
+	);
+	if(r->txtime){
+		printf("Paced by the kernel with SO_TXTIME\n");
+	}
+	else if(r->sent){
+		printf(
+			"Packets were sent %.1f us late on average and %.1f us at "
+			"most\n",r->lateSum/1000.0/(r->sent + r->failed),
+			r->lateMax/1000.0
+		);
+	}
+	if(r->replies){
+		printf(
+			"Received %llu ping pong replies\n",
+			(unsigned long long)r->replies
+		);
+	}
+	if(r->failed){
+		printf(
+			"%llu packets could not be sent\n",
+			(unsigned long long)r->failed
+		);
+	}
+
+	for(uint32_t i = 0; i < r->numSessions; i++){
+		struct replaySession* s = &r->sessions[i];
+
+		if(!s->open){
+			continue;
+		}
+
+		if(verbose){
+			printf(
+				"Session %u: %llu packets, %llu bytes, %llu replies%s\n",
+				i,(unsigned long long)s->packets,
+				(unsigned long long)s->bytes,
+				(unsigned long long)s->replies,
+				s->stopped ? ", stopped" : ""
+			);
+		}
+		close(s->fd);
+	}
+
+	free(r->sessions);
+	free(r->data);
+	close(tfd);
+	close(r->epfd);
+	close(r->traceFd);
+	free(r);
+
+	return 0;
+}